@@ -0,0 +1,423 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_animation.h>
+#include <epd/epd_output.h>
+
+#include <utils/box.h>
+#include <utils/env.h>
+#include <utils/time.h>
+
+
+/* Animated-region detection
+
+   The screen is cut into 64x64 tiles. Each commit marks the tiles it
+   changed, and a tile that changes in several commits in a row, each
+   within `quiet` ms of the last, is treated as animated: a spinner,
+   a progress bar, a video. Those parts of the screen are inked with
+   A2, the fastest (1 bit, no flashing) waveform, and frames are sent
+   more often while any tile is animated.
+
+   Changes just after input are taken to be its echo (typed text, a
+   button going down) rather than animation, so don't count towards a
+   streak. Touching animated tiles are inked together, separate groups
+   of them (two videos, a spinner and a progress bar) separately. The
+   scheduler merges them again where one update is cheaper.
+
+   Once a tile has gone `quiet` ms without changing it is still again.
+   The two-phase refresh (epd_cleanup.c) then gives it a quality pass
+   like any other fast ink. An active idle inhibitor is taken as a
+   hint that video is playing, and halves the streak needed.
+ */
+
+
+static unsigned int
+threshold(
+  struct epd_animation *animation
+)
+{
+  if (animation->video_hint && animation->threshold > 2) {
+    return (unsigned int) animation->threshold / 2;
+  }
+  return (unsigned int) animation->threshold;
+}
+
+static void
+tile_box(
+  struct epd_animation *animation,
+  unsigned int column,
+  unsigned int row,
+  pixman_box32_t * box
+)
+{
+  box->x1 = column << EPD_ANIMATION_TILE_SHIFT;
+  box->y1 = row << EPD_ANIMATION_TILE_SHIFT;
+  box->x2 = (column + 1) << EPD_ANIMATION_TILE_SHIFT;
+  box->y2 = (row + 1) << EPD_ANIMATION_TILE_SHIFT;
+}
+
+static void
+box_extend(
+  pixman_box32_t * box,
+  pixman_box32_t * other
+)
+{
+  /* Grow box to cover other. An empty box (x1 == x2) covers nothing. */
+  if (box->x1 == box->x2) {
+    *box = *other;
+    return;
+  }
+
+  *box = box_union(box, other);
+}
+
+static bool
+box_clip(
+  pixman_box32_t * box,
+  pixman_box32_t * clip
+)
+{
+  if (box->x1 < clip->x1)
+    box->x1 = clip->x1;
+
+  if (box->y1 < clip->y1)
+    box->y1 = clip->y1;
+
+  if (box->x2 > clip->x2)
+    box->x2 = clip->x2;
+
+  if (box->y2 > clip->y2)
+    box->y2 = clip->y2;
+
+  return box->x1 < box->x2 && box->y1 < box->y2;
+}
+
+static bool
+box_touches(
+  pixman_box32_t * a,
+  pixman_box32_t * b
+)
+{
+  /* Overlapping or side by side, corners included */
+  return a->x1 <= b->x2 && b->x1 <= a->x2 && a->y1 <= b->y2 && b->y1 <= a->y2;
+}
+
+static int
+group_add(
+  pixman_box32_t * groups,
+  int count,
+  pixman_box32_t * box
+)
+{
+  /* Add box to the group it touches, or start a new one. When there
+     is no room for another, the last one takes it. */
+  int group = 0;
+  while (group < count && !box_touches(&groups[group], box)) {
+    group += 1;
+  }
+
+  if (group == count) {
+    if (count < EPD_ANIMATION_MAX_GROUPS) {
+      groups[count] = *box;
+      return count + 1;
+    }
+    group = count - 1;
+  }
+
+  groups[group] = box_union(&groups[group], box);
+
+  /* The grown group may now touch others */
+  int i = 0;
+  while (i < count) {
+    if (i == group || !box_touches(&groups[group], &groups[i])) {
+      i += 1;
+      continue;
+    }
+
+    groups[group] = box_union(&groups[group], &groups[i]);
+    count -= 1;
+    groups[i] = groups[count];
+    if (group == count) {
+      group = i;
+    }
+    i = 0;
+  }
+
+  return count;
+}
+
+static void
+expire(
+  struct epd_animation *animation,
+  struct timespec *now
+)
+{
+  /* Tiles that haven't changed for a while stop being animated. If
+     there is no quality pass to clean up after A2, do one here. */
+  pixman_box32_t stopped = { 0 };
+
+  for (unsigned int row = 0; row < animation->rows; row++) {
+    for (unsigned int column = 0; column < animation->columns; column++) {
+      struct epd_animation_tile *tile =
+        &animation->tiles[row * animation->columns + column];
+
+      if (tile->streak == 0
+          || timespec_diff_ms(&tile->last_change, now) < animation->quiet) {
+        continue;
+      }
+
+      tile->streak = 0;
+
+      if (tile->animated) {
+        tile->animated = false;
+        animation->animated_count -= 1;
+
+        pixman_box32_t box;
+        tile_box(animation, column, row, &box);
+        box_extend(&stopped, &box);
+      }
+    }
+  }
+
+  if (stopped.x1 == stopped.x2) {
+    return;
+  }
+
+  wlr_log(WLR_INFO,
+          "epd_animation: stopped x=%i, y=%i, width=%i, height=%i",
+          stopped.x1, stopped.y1, stopped.x2 - stopped.x1,
+          stopped.y2 - stopped.y1);
+
+  struct epd_output *output = animation->output;
+  if (output->cleanup.delay <= 0) {
+    pixman_box32_t screen = {
+      .x1 = 0,
+      .y1 = 0,
+      .x2 = epd_output_get_width(&output->wlr_output),
+      .y2 = epd_output_get_height(&output->wlr_output),
+    };
+    box_clip(&stopped, &screen);
+    epd_output_ink(output, &stopped, output->update_mode,
+                   EPD_INK_BACKGROUND);
+  }
+}
+
+static int
+handle_animation_timer(
+  void *data
+)
+{
+  struct epd_animation *animation = data;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  expire(animation, &now);
+
+  if (animation->animated_count > 0) {
+    wl_event_source_timer_update(animation->timer, animation->quiet);
+  }
+  return 0;
+}
+
+int
+epd_animation_update(
+  struct epd_animation *animation,
+  pixman_box32_t * ink_box,
+  pixman_box32_t animated[EPD_ANIMATION_MAX_GROUPS],
+  pixman_box32_t * still_box
+)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  pixman_box32_t groups[EPD_ANIMATION_MAX_GROUPS];
+  int groups_count = 0;
+  pixman_box32_t still = { 0 };
+  bool started = false;
+  bool input = epd_scheduler_recent_input(&animation->output->scheduler);
+
+  for (unsigned int row = 0; row < animation->rows; row++) {
+    for (unsigned int column = 0; column < animation->columns; column++) {
+      unsigned int index = row * animation->columns + column;
+      struct epd_animation_tile *tile = &animation->tiles[index];
+
+      if (!animation->changed[index]) {
+        continue;
+      }
+      animation->changed[index] = 0;
+
+      pixman_box32_t box;
+      tile_box(animation, column, row, &box);
+
+      /* Input's echo, not animation */
+      if (input && !tile->animated) {
+        box_extend(&still, &box);
+        continue;
+      }
+
+      if (tile->streak > 0
+          && timespec_diff_ms(&tile->last_change, &now) < animation->quiet) {
+        tile->streak += 1;
+      } else {
+        tile->streak = 1;
+
+        if (tile->animated) {
+          tile->animated = false;
+          animation->animated_count -= 1;
+        }
+      }
+      tile->last_change = now;
+
+      if (!tile->animated && threshold(animation) > 0
+          && tile->streak >= threshold(animation)) {
+        tile->animated = true;
+        animation->animated_count += 1;
+        started = true;
+      }
+
+      if (tile->animated) {
+        groups_count = group_add(groups, groups_count, &box);
+      } else {
+        box_extend(&still, &box);
+      }
+    }
+  }
+
+  if (started) {
+    wlr_log(WLR_INFO, "epd_animation: %u animated tiles",
+            animation->animated_count);
+    wl_event_source_timer_update(animation->timer, animation->quiet);
+  }
+
+  int animated_count = 0;
+  for (int i = 0; i < groups_count; i++) {
+    if (box_clip(&groups[i], ink_box)) {
+      animated[animated_count] = groups[i];
+      animated_count += 1;
+    }
+  }
+
+  if (animated_count == 0) {
+    return 0;
+  }
+
+  *still_box = still;
+
+  if (still.x1 == still.x2 || !box_clip(still_box, ink_box)) {
+    still_box->x1 = still_box->x2 = 0;
+  }
+
+  return animated_count;
+}
+
+void
+epd_animation_discard(
+  struct epd_animation *animation
+)
+{
+  memset(animation->changed, 0, animation->columns * animation->rows);
+}
+
+bool
+epd_animation_active(
+  struct epd_animation *animation
+)
+{
+  return animation->animated_count > 0;
+}
+
+void
+epd_animation_set_video_hint(
+  struct epd_animation *animation,
+  bool video_hint
+)
+{
+  if (animation->video_hint != video_hint) {
+    wlr_log(WLR_INFO, "epd_animation: video hint %s",
+            video_hint ? "on" : "off");
+  }
+  animation->video_hint = video_hint;
+}
+
+void
+epd_animation_resize(
+  struct epd_animation *animation,
+  unsigned int width,
+  unsigned int height
+)
+{
+  unsigned int tile_size = 1 << EPD_ANIMATION_TILE_SHIFT;
+
+  free(animation->tiles);
+  free(animation->changed);
+
+  animation->columns = (width + tile_size - 1) / tile_size;
+  animation->rows = (height + tile_size - 1) / tile_size;
+  animation->tiles = calloc(animation->columns * animation->rows,
+                            sizeof(struct epd_animation_tile));
+  animation->changed = calloc(animation->columns * animation->rows, 1);
+  animation->animated_count = 0;
+}
+
+void
+epd_animation_init(
+  struct epd_animation *animation,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+)
+{
+  memset(animation, 0, sizeof(struct epd_animation));
+
+  animation->output = output;
+  animation->threshold = env_get_int("EPD_WM_ANIMATION_THRESHOLD",
+                                     EPD_ANIMATION_DEFAULT_THRESHOLD);
+  animation->quiet = env_get_int("EPD_WM_ANIMATION_QUIET",
+                                 EPD_ANIMATION_DEFAULT_QUIET);
+  animation->frame_delay = env_get_int("EPD_WM_ANIMATION_FRAME_DELAY",
+                                       EPD_ANIMATION_DEFAULT_FRAME_DELAY);
+
+  if (animation->threshold < 0) {
+    animation->threshold = 0;
+  }
+
+  if (animation->frame_delay < 1) {
+    animation->frame_delay = 1;
+  }
+
+  animation->timer =
+    wl_event_loop_add_timer(event_loop, handle_animation_timer, animation);
+
+  wlr_log(WLR_INFO,
+          "epd_animation: A2 after %i changes, %i ms apart at most",
+          animation->threshold, animation->quiet);
+}
+
+void
+epd_animation_finish(
+  struct epd_animation *animation
+)
+{
+  if (animation->timer) {
+    wl_event_source_remove(animation->timer);
+    animation->timer = NULL;
+  }
+
+  free(animation->tiles);
+  free(animation->changed);
+  animation->tiles = NULL;
+  animation->changed = NULL;
+  animation->animated_count = 0;
+}
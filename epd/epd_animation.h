@@ -0,0 +1,100 @@
+#ifndef EPD_ANIMATION_H
+#define EPD_ANIMATION_H
+
+#include <pixman.h>
+#include <stdbool.h>
+#include <time.h>
+#include <wayland-server.h>
+
+#define EPD_ANIMATION_TILE_SHIFT 6     // 64 x 64 pixel tiles
+#define EPD_ANIMATION_DEFAULT_THRESHOLD 4       // commits
+#define EPD_ANIMATION_DEFAULT_QUIET 1000        // ms
+#define EPD_ANIMATION_DEFAULT_FRAME_DELAY 50    // ms
+#define EPD_ANIMATION_MAX_GROUPS 8      // animated areas inked separately
+
+struct epd_output;
+
+struct epd_animation_tile
+{
+  struct timespec last_change;  // CLOCK_MONOTONIC
+  unsigned int streak;          // commits in a row this tile changed in
+  bool animated;
+};
+
+// Tracks how often each tile of the screen changes, to find
+// spinners, progress bars and video. Those get inked with A2 at a
+// higher frame rate until they stop.
+struct epd_animation
+{
+  struct epd_output *output;
+  struct wl_event_source *timer;
+
+  unsigned int columns;
+  unsigned int rows;
+  struct epd_animation_tile *tiles;
+  unsigned char *changed;       // per tile, set while converting a commit
+
+  int threshold;                // streak at which a tile is animated, 0 = off
+  int quiet;                    // ms without a change before it is still again
+  int frame_delay;              // ms between frames while anything animates
+  bool video_hint;              // a client is inhibiting idle (video player)
+
+  unsigned int animated_count;
+};
+
+void epd_animation_init(
+  struct epd_animation *animation,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+);
+
+void epd_animation_resize(
+  struct epd_animation *animation,
+  unsigned int width,
+  unsigned int height
+);
+
+void epd_animation_finish(
+  struct epd_animation *animation
+);
+
+// Note that pixel (x, y) changed in the commit being converted
+static inline void
+epd_animation_mark(
+  struct epd_animation *animation,
+  unsigned int x,
+  unsigned int y
+)
+{
+  animation->changed[(y >> EPD_ANIMATION_TILE_SHIFT) * animation->columns
+                     + (x >> EPD_ANIMATION_TILE_SHIFT)] = 1;
+}
+
+// Fold the marks from the commit just converted into each tile's
+// history, then split ink_box into groups of touching, changed,
+// animated tiles (into animated) and the part covering other changed
+// tiles. Returns the number of groups, 0 leaving the boxes alone if
+// nothing animated changed.
+int epd_animation_update(
+  struct epd_animation *animation,
+  pixman_box32_t * ink_box,
+  pixman_box32_t animated[EPD_ANIMATION_MAX_GROUPS],
+  pixman_box32_t * still_box
+);
+
+// Forget the marks from the commit being converted, e.g. because it
+// was a caret blinking rather than animation.
+void epd_animation_discard(
+  struct epd_animation *animation
+);
+
+bool epd_animation_active(
+  struct epd_animation *animation
+);
+
+void epd_animation_set_video_hint(
+  struct epd_animation *animation,
+  bool video_hint
+);
+
+#endif
@@ -85,10 +85,12 @@ backend_start(
 
   struct epd_output *output;
   wl_list_for_each(output, &backend->outputs, link) {
-    wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+    wl_event_source_timer_update(output->frame_timer,
+                                 epd_output_frame_delay(output));
     wlr_output_update_enabled(&output->wlr_output, true);
     wlr_signal_emit_safe(&backend->backend.events.new_output,
                          &output->wlr_output);
+    epd_export_start(&output->export);
   }
 
   backend->started = true;
@@ -3,8 +3,6 @@
 
 #include <wlr/backend/interface.h>
 
-#define EPD_BACKEND_DEFAULT_REFRESH (2 * 1000)  // 2 Hz
-
 struct epd_backend
 {
   struct wlr_backend backend;
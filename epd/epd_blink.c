@@ -0,0 +1,201 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <time.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_blink.h>
+
+#include <utils/box.h>
+#include <utils/env.h>
+#include <utils/time.h>
+
+
+/* Blink suppression
+
+   Terminals and editors blink their caret about once a second, and
+   every blink would otherwise cost us a transfer and a refresh. A
+   blink shows up as the same small damage box over and over, with its
+   content alternating between two states. Once we've seen that for a
+   few cycles we stop inking it altogether and leave the caret on (the
+   darker state, so it stays visible).
+
+   Anything else, a different box or a third state, ends the hold, as
+   does input (see epd_blink_release). If the panel was left showing
+   the caret when the content says it's off, the next ink covers it.
+ */
+
+
+static uint32_t
+box_hash(
+  const unsigned char *pixels,
+  unsigned int stride,
+  pixman_box32_t * box,
+  unsigned long *sum
+)
+{
+  /* FNV-1a, plus a plain sum to compare brightness */
+  uint32_t hash = 2166136261u;
+  *sum = 0;
+
+  for (int y = box->y1; y < box->y2; y++) {
+    const unsigned char *row = pixels + y * stride;
+
+    for (int x = box->x1; x < box->x2; x++) {
+      hash = (hash ^ row[x]) * 16777619u;
+      *sum += row[x];
+    }
+  }
+
+  return hash;
+}
+
+static void
+release(
+  struct epd_blink *blink,
+  pixman_box32_t * held_box
+)
+{
+  /* Stop holding. If the caret was held on while the content says
+     it's off, the held box needs inking too. It goes out on its own:
+     the new damage may be anywhere. */
+  if (!blink->frozen) {
+    return;
+  }
+
+  wlr_log(WLR_INFO, "epd_blink: releasing x=%i, y=%i", blink->box.x1,
+          blink->box.y1);
+
+  blink->frozen = false;
+  if (blink->current != blink->on) {
+    *held_box = blink->box;
+  }
+}
+
+static void
+start(
+  struct epd_blink *blink,
+  const unsigned char *pixels,
+  unsigned int stride,
+  pixman_box32_t * box,
+  struct timespec *now
+)
+{
+  /* Take this box as the start of a possible blink */
+  blink->box = *box;
+  blink->hash[0] = box_hash(pixels, stride, box, &blink->sum[0]);
+  blink->toggles = 0;
+  blink->current = 0;
+  blink->last_toggle = *now;
+}
+
+enum epd_blink_result
+epd_blink_check(
+  struct epd_blink *blink,
+  const unsigned char *pixels,
+  unsigned int stride,
+  pixman_box32_t * ink_box,
+  pixman_box32_t * held_box
+)
+{
+  held_box->x1 = held_box->x2 = 0;
+
+  if (blink->cycles <= 0) {
+    return EPD_BLINK_CHANGE;
+  }
+
+  /* Bring the panel up to date after input ended a hold */
+  if (blink->stale) {
+    blink->stale = false;
+    *held_box = blink->box;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if (box_area(ink_box) > EPD_BLINK_MAX_AREA) {
+    release(blink, held_box);
+    blink->toggles = 0;
+    blink->box.x1 = blink->box.x2 = 0;
+    return EPD_BLINK_CHANGE;
+  }
+
+  if (!box_equal(ink_box, &blink->box)
+      || timespec_diff_ms(&blink->last_toggle, &now)
+      > EPD_BLINK_MAX_INTERVAL) {
+    release(blink, held_box);
+    start(blink, pixels, stride, ink_box, &now);
+    return EPD_BLINK_CHANGE;
+  }
+
+  /* Same box. Is it the other of the two states? */
+  unsigned long sum;
+  uint32_t hash = box_hash(pixels, stride, ink_box, &sum);
+  unsigned int other = blink->current ^ 1;
+
+  if (blink->toggles == 0 && hash != blink->hash[0]) {
+    blink->hash[1] = hash;
+    blink->sum[1] = sum;
+  } else if (blink->toggles == 0 || hash != blink->hash[other]) {
+    release(blink, held_box);
+    start(blink, pixels, stride, ink_box, &now);
+    return EPD_BLINK_CHANGE;
+  }
+
+  blink->toggles += 1;
+  blink->current = other;
+  blink->last_toggle = now;
+
+  if (blink->frozen) {
+    return EPD_BLINK_HOLD;
+  }
+
+  if (blink->toggles >= 2 * (unsigned int) blink->cycles) {
+    blink->frozen = true;
+    blink->on = blink->sum[0] <= blink->sum[1] ? 0 : 1;
+
+    wlr_log(WLR_INFO,
+            "epd_blink: holding x=%i, y=%i, width=%i, height=%i",
+            ink_box->x1, ink_box->y1, ink_box->x2 - ink_box->x1,
+            ink_box->y2 - ink_box->y1);
+
+    /* The panel shows the state before this one, ink this one only if
+       it's the one to hold */
+    return blink->current == blink->on ? EPD_BLINK_TOGGLE : EPD_BLINK_HOLD;
+  }
+
+  return blink->toggles >= 2 ? EPD_BLINK_TOGGLE : EPD_BLINK_CHANGE;
+}
+
+void
+epd_blink_release(
+  struct epd_blink *blink
+)
+{
+  if (!blink->frozen) {
+    return;
+  }
+
+  blink->frozen = false;
+  blink->toggles = 0;
+  blink->stale = blink->current != blink->on;
+}
+
+void
+epd_blink_init(
+  struct epd_blink *blink
+)
+{
+  memset(blink, 0, sizeof(struct epd_blink));
+  blink->cycles = env_get_int("EPD_WM_BLINK_CYCLES",
+                              EPD_BLINK_DEFAULT_CYCLES);
+}
@@ -0,0 +1,61 @@
+#ifndef EPD_BLINK_H
+#define EPD_BLINK_H
+
+#include <pixman.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define EPD_BLINK_DEFAULT_CYCLES 3
+#define EPD_BLINK_MAX_AREA 4096         // pixels
+#define EPD_BLINK_MAX_INTERVAL 2000     // ms between toggles
+
+// What epd_blink_check made of a commit
+enum epd_blink_result
+{
+  EPD_BLINK_CHANGE,             // ordinary damage, ink it
+  EPD_BLINK_TOGGLE,             // a region flipping between two states, ink it
+  EPD_BLINK_HOLD,               // a frozen region flipping, don't ink
+};
+
+// Watches for a small region flipping back and forth between the same
+// two states (a blinking caret) and, after `cycles` on/off cycles,
+// holds it in the darker of the two.
+struct epd_blink
+{
+  int cycles;                   // on/off cycles before freezing, 0 = off
+
+  pixman_box32_t box;
+  uint32_t hash[2];
+  unsigned long sum[2];         // to tell which state is darker
+  unsigned int toggles;         // alternations seen so far
+  unsigned int current;         // index of the state in target_pixels
+  struct timespec last_toggle;  // CLOCK_MONOTONIC
+
+  bool frozen;
+  unsigned int on;              // index of the state left on the panel
+  bool stale;                   // panel differs from target_pixels in box
+};
+
+void epd_blink_init(
+  struct epd_blink *blink
+);
+
+// Look at the content of ink_box, which has just changed. If this
+// ends a hold and the panel is behind, held_box is set to the held
+// region, to be inked as well; otherwise it's left empty (x1 == x2).
+enum epd_blink_result epd_blink_check(
+  struct epd_blink *blink,
+  const unsigned char *pixels,
+  unsigned int stride,
+  pixman_box32_t * ink_box,
+  pixman_box32_t * held_box
+);
+
+// The user did something, stop holding. The next commit re-inks the
+// region if the panel is out of date.
+void epd_blink_release(
+  struct epd_blink *blink
+);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_cleanup.h>
+#include <epd/epd_driver.h>
+#include <epd/epd_output.h>
+
+#include <utils/box.h>
+#include <utils/env.h>
+#include <utils/time.h>
+
+
+/* Two-phase refresh
+
+   Fast waveforms (A2, DU, DU4) are quick and don't flash, but they
+   can only show 2 or 4 grey levels and leave a little ghosting
+   behind. The 16 level waveforms look good but take roughly twice as
+   long. So we ink damage with a fast waveform first, remember where we
+   did that, and come back with a quality waveform once the area has
+   stopped changing.
+
+   Each tracked region carries the time it was last inked. New damage
+   that touches a pending region is merged into it and pushes its
+   deadline back, so a region that keeps changing (typing, scrolling)
+   never gets a slow refresh in the middle of being used.
+ */
+
+
+static void
+remove_region(
+  struct epd_cleanup *cleanup,
+  int index
+)
+{
+  cleanup->regions_count -= 1;
+  cleanup->regions[index] = cleanup->regions[cleanup->regions_count];
+}
+
+static void
+schedule(
+  struct epd_cleanup *cleanup,
+  struct timespec *now
+)
+{
+  /* Arm the timer for whichever region settles first. A timeout of
+     zero disarms it. */
+  long long next = -1;
+
+  for (int i = 0; i < cleanup->regions_count; i++) {
+    long long remaining = cleanup->delay
+      - timespec_diff_ms(&cleanup->regions[i].last_inked, now);
+
+    if (remaining < 1) {
+      remaining = 1;
+    }
+
+    if (next < 0 || remaining < next) {
+      next = remaining;
+    }
+  }
+
+  wl_event_source_timer_update(cleanup->timer, next < 0 ? 0 : (int) next);
+}
+
+static int
+handle_cleanup_timer(
+  void *data
+)
+{
+  struct epd_cleanup *cleanup = data;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  /* Pull the settled regions out before inking any of them: inking
+     calls back into epd_cleanup_track, which edits the regions
+     array. */
+  pixman_box32_t due[EPD_CLEANUP_MAX_REGIONS];
+  int due_count = 0;
+
+  int i = 0;
+  while (i < cleanup->regions_count) {
+    struct epd_cleanup_region *region = &cleanup->regions[i];
+
+    if (timespec_diff_ms(&region->last_inked, &now) >= cleanup->delay) {
+      due[due_count] = region->box;
+      due_count += 1;
+      remove_region(cleanup, i);
+      continue;
+    }
+
+    i += 1;
+  }
+
+  for (i = 0; i < due_count; i++) {
+    wlr_log(WLR_INFO,
+            "epd_cleanup: quality pass x=%i, y=%i, width=%i, height=%i",
+            due[i].x1, due[i].y1, due[i].x2 - due[i].x1,
+            due[i].y2 - due[i].y1);
+    epd_output_ink(cleanup->output, &due[i], cleanup->mode,
+                   EPD_INK_BACKGROUND);
+  }
+
+  schedule(cleanup, &now);
+  return 0;
+}
+
+void
+epd_cleanup_track(
+  struct epd_cleanup *cleanup,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode
+)
+{
+  if (cleanup->delay <= 0) {
+    return;
+  }
+
+  /* A quality ink settles anything pending underneath it */
+  if (epd_update_mode_levels(update_mode)
+      >= epd_update_mode_levels(cleanup->mode)) {
+    epd_cleanup_settle(cleanup, box);
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  /* Otherwise, merge with (and so postpone) any pass it overlaps */
+  struct epd_cleanup_region region = {
+    .box = *box,
+    .last_inked = now,
+  };
+
+  int i = 0;
+  while (i < cleanup->regions_count) {
+    if (box_intersects(&region.box, &cleanup->regions[i].box)) {
+      region.box = box_union(&region.box, &cleanup->regions[i].box);
+      remove_region(cleanup, i);
+      i = 0;                    // the grown box may now touch earlier regions
+      continue;
+    }
+    i += 1;
+  }
+
+  if (cleanup->regions_count < EPD_CLEANUP_MAX_REGIONS) {
+    cleanup->regions[cleanup->regions_count] = region;
+    cleanup->regions_count += 1;
+    schedule(cleanup, &now);
+    return;
+  }
+
+  /* Out of slots, fold it into whichever region grows the least */
+  int best = 0;
+  long long best_growth = -1;
+
+  for (i = 0; i < cleanup->regions_count; i++) {
+    pixman_box32_t merged = box_union(&region.box, &cleanup->regions[i].box);
+    long long growth = box_area(&merged) - box_area(&cleanup->regions[i].box);
+
+    if (best_growth < 0 || growth < best_growth) {
+      best = i;
+      best_growth = growth;
+    }
+  }
+
+  cleanup->regions[best].box =
+    box_union(&region.box, &cleanup->regions[best].box);
+  cleanup->regions[best].last_inked = now;
+
+  schedule(cleanup, &now);
+}
+
+void
+epd_cleanup_settle(
+  struct epd_cleanup *cleanup,
+  pixman_box32_t * box
+)
+{
+  int i = 0;
+  while (i < cleanup->regions_count) {
+    if (box_contains(box, &cleanup->regions[i].box)) {
+      remove_region(cleanup, i);
+      continue;
+    }
+    i += 1;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  schedule(cleanup, &now);
+}
+
+void
+epd_cleanup_init(
+  struct epd_cleanup *cleanup,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+)
+{
+  memset(cleanup, 0, sizeof(struct epd_cleanup));
+
+  cleanup->output = output;
+  cleanup->mode = EPD_UPD_GL16;
+  cleanup->delay =
+    env_get_int("EPD_WM_CLEANUP_DELAY", EPD_CLEANUP_DEFAULT_DELAY);
+
+  cleanup->timer =
+    wl_event_loop_add_timer(event_loop, handle_cleanup_timer, cleanup);
+
+  wlr_log(WLR_INFO, "epd_cleanup: quality pass after %i ms", cleanup->delay);
+}
+
+void
+epd_cleanup_finish(
+  struct epd_cleanup *cleanup
+)
+{
+  if (cleanup->timer) {
+    wl_event_source_remove(cleanup->timer);
+    cleanup->timer = NULL;
+  }
+
+  cleanup->regions_count = 0;
+}
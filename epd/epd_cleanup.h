@@ -0,0 +1,61 @@
+#ifndef EPD_CLEANUP_H
+#define EPD_CLEANUP_H
+
+#include <pixman.h>
+#include <time.h>
+#include <wayland-server.h>
+
+#include <epd/epd_driver.h>
+
+#define EPD_CLEANUP_MAX_REGIONS 16
+#define EPD_CLEANUP_DEFAULT_DELAY 1000  // ms
+
+struct epd_output;
+
+// A rectangle last inked with a low-fidelity (fewer than 16 level)
+// waveform, which is waiting for its quality pass.
+struct epd_cleanup_region
+{
+  pixman_box32_t box;
+  struct timespec last_inked;   // CLOCK_MONOTONIC
+};
+
+// Two-phase refresh policy: damage is inked straight away with a fast
+// waveform (A2/DU/DU4), then silently re-inked with a 16 level
+// waveform once it has been left alone for `delay` ms.
+struct epd_cleanup
+{
+  struct epd_output *output;
+  struct wl_event_source *timer;
+
+  enum epd_update_mode mode;    // waveform used for the quality pass
+  int delay;                    // ms, <= 0 disables the quality pass
+
+  int regions_count;
+  struct epd_cleanup_region regions[EPD_CLEANUP_MAX_REGIONS];
+};
+
+void epd_cleanup_init(
+  struct epd_cleanup *cleanup,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+);
+
+void epd_cleanup_finish(
+  struct epd_cleanup *cleanup
+);
+
+void epd_cleanup_track(
+  struct epd_cleanup *cleanup,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode
+);
+
+// Forget pending passes inside box, e.g. because it was just inked
+// with content a fast waveform reproduces exactly.
+void epd_cleanup_settle(
+  struct epd_cleanup *cleanup,
+  pixman_box32_t * box
+);
+
+#endif
@@ -0,0 +1,526 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <epd/epd_clients.h>
+#include <epd/epd_stats.h>
+
+
+/* Who's using the panel
+
+   When the panel can't keep up, it helps to know which window is
+   keeping it busy. Damage arrives tagged with the window it came from
+   (see output_damage_view_surface), and is followed from there:
+
+   - A commit's changed pixels go to the windows that damaged where
+     they changed, split by how much of the changed area each one
+     damaged. Usually only one window drew, and gets them all.
+   - What they damaged becomes theirs until it's inked. Each ink is
+     split the same way between the windows it covers: the bytes sent,
+     the time spent dithering and sending, and how long the waveform
+     keeps the panel busy. Every window it touches counts an ink in
+     that mode.
+
+   Anything no window damaged (the cursor, wet ink, quality passes
+   over pixels that have already been paid for) goes to epd-wm
+   itself, so everything adds up to the totals in epd_stats.
+
+   Windows get a slot each, and keep it for a while after they close.
+   With more than EPD_CLIENTS_MAX, the one that drew longest ago goes,
+   preferring closed ones. Its totals aren't lost: they're added to a
+   retired entry for its app_id and pid, so what's exported per app
+   only ever grows, as counters must. When those run out too, the one
+   that drew longest ago is folded into epd-wm's.
+ */
+
+
+static uint64_t
+region_area(
+  pixman_region32_t * region
+)
+{
+  int rects_count;
+  pixman_box32_t *rects = pixman_region32_rectangles(region, &rects_count);
+  uint64_t area = 0;
+
+  for (int i = 0; i < rects_count; i++) {
+    area += (uint64_t) (rects[i].x2 - rects[i].x1)
+      * (rects[i].y2 - rects[i].y1);
+  }
+  return area;
+}
+
+static void
+clear_region(
+  pixman_region32_t * region
+)
+{
+  pixman_region32_fini(region);
+  pixman_region32_init(region);
+}
+
+static void
+clear_slot(
+  struct epd_client *slot
+)
+{
+  clear_region(&slot->damage);
+  clear_region(&slot->pending);
+
+  slot->view = NULL;
+  slot->used = false;
+  slot->app_id[0] = '\0';
+  slot->title[0] = '\0';
+  slot->pid = 0;
+  slot->last_damage = 0;
+  slot->commits = 0;
+  slot->pixels = 0;
+  slot->bytes = 0;
+  slot->ink_ns = 0;
+  slot->refresh_us = 0;
+  memset(slot->inks, 0, sizeof(slot->inks));
+}
+
+void
+epd_clients_add_totals(
+  struct epd_client *sum,
+  const struct epd_client *client
+)
+{
+  sum->commits += client->commits;
+  sum->pixels += client->pixels;
+  sum->bytes += client->bytes;
+  sum->ink_ns += client->ink_ns;
+  sum->refresh_us += client->refresh_us;
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    sum->inks[mode] += client->inks[mode];
+  }
+  if (client->last_damage > sum->last_damage) {
+    sum->last_damage = client->last_damage;
+  }
+}
+
+static bool
+same_app(
+  const struct epd_client *a,
+  const struct epd_client *b
+)
+{
+  return a->pid == b->pid && strcmp(a->app_id, b->app_id) == 0;
+}
+
+static int
+retired_rank(
+  struct epd_clients *clients,
+  struct epd_client *entry
+)
+{
+  /* Which retired entry to give up first: a free one, then one whose
+     app has no windows left (its series only goes away, rather than
+     going down) */
+  if (!entry->used) {
+    return 0;
+  }
+  for (int i = 0; i < EPD_CLIENTS_MAX; i++) {
+    if (clients->clients[i].used && same_app(&clients->clients[i], entry)) {
+      return 2;
+    }
+  }
+  return 1;
+}
+
+static void
+retire(
+  struct epd_clients *clients,
+  struct epd_client *slot
+)
+{
+  struct epd_client *kept = NULL;
+  struct epd_client *oldest = NULL;
+  int oldest_rank = 0;
+
+  for (int i = 0; i < EPD_CLIENTS_RETIRED; i++) {
+    struct epd_client *entry = &clients->retired[i];
+
+    if (entry->used && same_app(entry, slot)) {
+      kept = entry;
+      break;
+    }
+
+    int rank = retired_rank(clients, entry);
+    if (oldest == NULL || rank < oldest_rank
+        || (rank == oldest_rank && entry->last_damage < oldest->last_damage)) {
+      oldest = entry;
+      oldest_rank = rank;
+    }
+  }
+
+  if (kept == NULL) {
+    kept = oldest;
+    if (kept->used) {
+      epd_clients_add_totals(&clients->compositor, kept);
+    }
+    memset(kept, 0, sizeof(struct epd_client));
+    kept->used = true;
+    memcpy(kept->app_id, slot->app_id, sizeof(kept->app_id));
+    kept->pid = slot->pid;
+  }
+
+  memcpy(kept->title, slot->title, sizeof(kept->title));
+  epd_clients_add_totals(kept, slot);
+}
+
+static struct epd_client *
+find_client(
+  struct epd_clients *clients,
+  const void *view
+)
+{
+  /* The window's slot, or a free one, or the one that drew longest
+     ago, closed ones first */
+  struct epd_client *free_slot = NULL;
+  struct epd_client *oldest = NULL;
+
+  for (int i = 0; i < EPD_CLIENTS_MAX; i++) {
+    struct epd_client *slot = &clients->clients[i];
+
+    if (slot->used && slot->view == view) {
+      return slot;
+    }
+
+    if (!slot->used) {
+      if (free_slot == NULL) {
+        free_slot = slot;
+      }
+      continue;
+    }
+
+    if (oldest == NULL
+        || (slot->view == NULL && oldest->view != NULL)
+        || ((slot->view == NULL) == (oldest->view == NULL)
+            && slot->last_damage < oldest->last_damage)) {
+      oldest = slot;
+    }
+  }
+
+  struct epd_client *slot = free_slot ? free_slot : oldest;
+  if (slot->used) {
+    retire(clients, slot);
+  }
+  clear_slot(slot);
+  slot->used = true;
+  slot->view = view;
+  return slot;
+}
+
+static void
+copy_name(
+  char name[EPD_CLIENTS_NAME_SIZE],
+  const char *value
+)
+{
+  if (value == NULL) {
+    name[0] = '\0';
+    return;
+  }
+  strncpy(name, value, EPD_CLIENTS_NAME_SIZE - 1);
+  name[EPD_CLIENTS_NAME_SIZE - 1] = '\0';
+}
+
+void
+epd_clients_damage(
+  struct epd_clients *clients,
+  const void *view,
+  const char *app_id,
+  const char *title,
+  pid_t pid,
+  pixman_region32_t * damage
+)
+{
+  struct epd_client *slot = find_client(clients, view);
+
+  /* Titles change as the window goes, keep the latest */
+  copy_name(slot->app_id, app_id);
+  copy_name(slot->title, title);
+  slot->pid = pid;
+  slot->last_damage = epd_stats_now();
+  slot->commits += 1;
+
+  pixman_region32_union(&slot->damage, &slot->damage, damage);
+}
+
+pixman_region32_t *
+epd_clients_pending(
+  struct epd_clients *clients,
+  const void *view
+)
+{
+  for (int i = 0; i < EPD_CLIENTS_MAX; i++) {
+    struct epd_client *slot = &clients->clients[i];
+
+    if (slot->used && slot->view == view) {
+      return &slot->pending;
+    }
+  }
+
+  return NULL;
+}
+
+void
+epd_clients_forget(
+  struct epd_clients *clients,
+  const void *view
+)
+{
+  for (int i = 0; i < EPD_CLIENTS_MAX; i++) {
+    struct epd_client *slot = &clients->clients[i];
+
+    if (slot->used && slot->view == view) {
+      slot->view = NULL;
+      clear_region(&slot->damage);
+      clear_region(&slot->pending);
+    }
+  }
+}
+
+void
+epd_clients_commit(
+  struct epd_clients *clients,
+  pixman_box32_t * box,
+  unsigned int pixels
+)
+{
+  uint64_t areas[EPD_CLIENTS_MAX] = { 0 };
+  uint64_t total = 0;
+
+  for (int i = 0; i < EPD_CLIENTS_MAX; i++) {
+    struct epd_client *slot = &clients->clients[i];
+
+    if (!slot->used || !pixman_region32_not_empty(&slot->damage)) {
+      continue;
+    }
+
+    if (box != NULL) {
+      pixman_region32_t changed;
+      pixman_region32_init_rect(&changed, box->x1, box->y1,
+                                box->x2 - box->x1, box->y2 - box->y1);
+      pixman_region32_intersect(&changed, &changed, &slot->damage);
+
+      areas[i] = region_area(&changed);
+      total += areas[i];
+      pixman_region32_union(&slot->pending, &slot->pending, &changed);
+      pixman_region32_fini(&changed);
+    }
+
+    /* Damage that changed nothing is forgotten */
+    clear_region(&slot->damage);
+  }
+
+  if (box == NULL) {
+    return;
+  }
+
+  if (total == 0) {
+    clients->compositor.pixels += pixels;
+    return;
+  }
+
+  for (int i = 0; i < EPD_CLIENTS_MAX; i++) {
+    if (areas[i] > 0) {
+      clients->clients[i].pixels += pixels * areas[i] / total;
+    }
+  }
+}
+
+static void
+add_ink(
+  struct epd_client *slot,
+  uint64_t share,
+  uint64_t total,
+  unsigned int update_mode,
+  unsigned int bytes,
+  uint64_t ns,
+  float waveform_ms
+)
+{
+  slot->bytes += bytes * share / total;
+  slot->ink_ns += ns * share / total;
+  slot->refresh_us += (uint64_t) (waveform_ms * 1000) * share / total;
+  if (update_mode < EPD_UPD_COUNT) {
+    slot->inks[update_mode] += 1;
+  }
+}
+
+void
+epd_clients_ink(
+  struct epd_clients *clients,
+  pixman_box32_t * box,
+  unsigned int update_mode,
+  unsigned int bytes,
+  uint64_t ns,
+  float waveform_ms
+)
+{
+  uint64_t areas[EPD_CLIENTS_MAX] = { 0 };
+  uint64_t total = 0;
+
+  pixman_region32_t inked;
+  pixman_region32_init_rect(&inked, box->x1, box->y1,
+                            box->x2 - box->x1, box->y2 - box->y1);
+
+  for (int i = 0; i < EPD_CLIENTS_MAX; i++) {
+    struct epd_client *slot = &clients->clients[i];
+
+    if (!slot->used || !pixman_region32_not_empty(&slot->pending)) {
+      continue;
+    }
+
+    pixman_region32_t covered;
+    pixman_region32_init(&covered);
+    pixman_region32_intersect(&covered, &inked, &slot->pending);
+    areas[i] = region_area(&covered);
+    total += areas[i];
+    pixman_region32_fini(&covered);
+
+    pixman_region32_subtract(&slot->pending, &slot->pending, &inked);
+  }
+  pixman_region32_fini(&inked);
+
+  if (total == 0) {
+    add_ink(&clients->compositor, 1, 1, update_mode, bytes, ns,
+            waveform_ms);
+    return;
+  }
+
+  for (int i = 0; i < EPD_CLIENTS_MAX; i++) {
+    if (areas[i] > 0) {
+      add_ink(&clients->clients[i], areas[i], total, update_mode, bytes, ns,
+              waveform_ms);
+    }
+  }
+}
+
+static int
+compare_refresh(
+  const void *a,
+  const void *b
+)
+{
+  const struct epd_client *client_a = *(struct epd_client * const *) a;
+  const struct epd_client *client_b = *(struct epd_client * const *) b;
+
+  if (client_a->refresh_us != client_b->refresh_us) {
+    return client_a->refresh_us < client_b->refresh_us ? 1 : -1;
+  }
+  return client_a->bytes < client_b->bytes ? 1
+    : client_a->bytes > client_b->bytes ? -1 : 0;
+}
+
+int
+epd_clients_sorted(
+  struct epd_clients *clients,
+  struct epd_client **sorted,
+  int max
+)
+{
+  struct epd_client *all[EPD_CLIENTS_ENTRIES];
+  int count = 0;
+
+  for (int i = 0; i < EPD_CLIENTS_MAX; i++) {
+    if (clients->clients[i].used) {
+      all[count++] = &clients->clients[i];
+    }
+  }
+  for (int i = 0; i < EPD_CLIENTS_RETIRED; i++) {
+    if (clients->retired[i].used) {
+      all[count++] = &clients->retired[i];
+    }
+  }
+  all[count++] = &clients->compositor;
+
+  qsort(all, count, sizeof(struct epd_client *), compare_refresh);
+
+  if (count > max) {
+    count = max;
+  }
+  memcpy(sorted, all, count * sizeof(struct epd_client *));
+  return count;
+}
+
+void
+epd_clients_report(
+  struct epd_clients *clients
+)
+{
+  struct epd_client *sorted[EPD_CLIENTS_REPORTED];
+  int count = epd_clients_sorted(clients, sorted, EPD_CLIENTS_REPORTED);
+
+  printf("epd_clients: %-24s %7s %8s %10s %8s %9s %9s  %s\n", "window",
+         "pid", "commits", "pixels", "MB", "ink (ms)", "panel (s)", "inks");
+
+  for (int i = 0; i < count; i++) {
+    struct epd_client *client = sorted[i];
+    const char *name = client->app_id[0] != '\0' ? client->app_id
+      : client->title[0] != '\0' ? client->title : "?";
+
+    printf("epd_clients: %-24.24s %7i %8llu %10llu %8.2f %9.1f %9.1f ",
+           name, (int) client->pid,
+           (unsigned long long) client->commits,
+           (unsigned long long) client->pixels, client->bytes / 1e6,
+           client->ink_ns / 1e6, client->refresh_us / 1e6);
+
+    for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+      if (client->inks[mode] > 0) {
+        printf(" %s %llu", epd_update_mode_to_string(mode),
+               (unsigned long long) client->inks[mode]);
+      }
+    }
+    printf("%s\n", client->view == NULL && client != &clients->compositor
+           ? " (closed)" : "");
+  }
+  fflush(stdout);
+}
+
+void
+epd_clients_init(
+  struct epd_clients *clients
+)
+{
+  memset(clients, 0, sizeof(struct epd_clients));
+
+  for (int i = 0; i < EPD_CLIENTS_MAX; i++) {
+    pixman_region32_init(&clients->clients[i].damage);
+    pixman_region32_init(&clients->clients[i].pending);
+  }
+
+  pixman_region32_init(&clients->compositor.damage);
+  pixman_region32_init(&clients->compositor.pending);
+  clients->compositor.used = true;
+  copy_name(clients->compositor.app_id, "epd-wm");
+  clients->compositor.pid = getpid();
+}
+
+void
+epd_clients_finish(
+  struct epd_clients *clients
+)
+{
+  for (int i = 0; i < EPD_CLIENTS_MAX; i++) {
+    pixman_region32_fini(&clients->clients[i].damage);
+    pixman_region32_fini(&clients->clients[i].pending);
+  }
+
+  pixman_region32_fini(&clients->compositor.damage);
+  pixman_region32_fini(&clients->compositor.pending);
+}
@@ -0,0 +1,118 @@
+#ifndef EPD_CLIENTS_H
+#define EPD_CLIENTS_H
+
+#include <pixman.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <epd/epd_driver.h>
+
+#define EPD_CLIENTS_MAX 32
+#define EPD_CLIENTS_RETIRED 32  // totals of evicted windows, by app
+#define EPD_CLIENTS_ENTRIES (EPD_CLIENTS_MAX + EPD_CLIENTS_RETIRED + 1)
+#define EPD_CLIENTS_NAME_SIZE 64
+#define EPD_CLIENTS_REPORTED 10 // windows in each summary
+
+// What one window has cost since it first drew. Costs shared with
+// other windows are split by area.
+struct epd_client
+{
+  const void *view;             // whose damage this is, NULL once gone
+  bool used;
+  char app_id[EPD_CLIENTS_NAME_SIZE];
+  char title[EPD_CLIENTS_NAME_SIZE];
+  pid_t pid;
+  uint64_t last_damage;         // ns, CLOCK_MONOTONIC
+
+  pixman_region32_t damage;     // since the last output commit
+  pixman_region32_t pending;    // changed by a commit, not inked yet
+
+  uint64_t commits;             // that damaged the output
+  uint64_t pixels;              // changed
+  uint64_t bytes;               // sent to the controller
+  uint64_t ink_ns;              // dithering and sending
+  uint64_t refresh_us;          // waveforms running on the panel
+  uint64_t inks[EPD_UPD_COUNT]; // covering any of its pixels
+};
+
+// Follows damage from the window that caused it to the pixels it
+// changed and the inks that showed them
+struct epd_clients
+{
+  struct epd_client clients[EPD_CLIENTS_MAX];
+  struct epd_client retired[EPD_CLIENTS_RETIRED];       // no view, no regions
+  struct epd_client compositor; // whatever no window damaged
+};
+
+void epd_clients_init(
+  struct epd_clients *clients
+);
+
+void epd_clients_finish(
+  struct epd_clients *clients
+);
+
+// The window identified by view (any pointer that stays the same for
+// its lifetime) damaged the output, in buffer coordinates
+void epd_clients_damage(
+  struct epd_clients *clients,
+  const void *view,
+  const char *app_id,
+  const char *title,
+  pid_t pid,
+  pixman_region32_t * damage
+);
+
+// What view changed that hasn't been inked yet, NULL if it has no slot
+pixman_region32_t *epd_clients_pending(
+  struct epd_clients *clients,
+  const void *view
+);
+
+// The window is gone. Its totals are kept until the slot is needed.
+void epd_clients_forget(
+  struct epd_clients *clients,
+  const void *view
+);
+
+// An output commit changed `pixels` pixels within box, or nothing
+// when box is NULL
+void epd_clients_commit(
+  struct epd_clients *clients,
+  pixman_box32_t * box,
+  unsigned int pixels
+);
+
+// box was inked with update_mode: bytes sent in ns, then the panel
+// busy for waveform_ms
+void epd_clients_ink(
+  struct epd_clients *clients,
+  pixman_box32_t * box,
+  unsigned int update_mode,
+  unsigned int bytes,
+  uint64_t ns,
+  float waveform_ms
+);
+
+// Add client's totals to sum's
+void epd_clients_add_totals(
+  struct epd_client *sum,
+  const struct epd_client *client
+);
+
+// The windows that have cost the most, by waveform time, most first,
+// with retired totals and epd-wm's among them. Returns how many were
+// put in sorted (at most max, EPD_CLIENTS_ENTRIES gets them all).
+int epd_clients_sorted(
+  struct epd_clients *clients,
+  struct epd_client **sorted,
+  int max
+);
+
+// Print what the costliest windows have cost
+void epd_clients_report(
+  struct epd_clients *clients
+);
+
+#endif
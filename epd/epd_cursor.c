@@ -0,0 +1,313 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_cursor.h>
+#include <epd/epd_output.h>
+
+#include <utils/box.h>
+#include <utils/env.h>
+#include <utils/time.h>
+
+
+/* Cursor plane
+
+   Moving the pointer used to draw nothing: a software cursor would
+   damage the frame, and each move would cost a render, a read back
+   and a refresh of whatever it passed over.
+
+   Instead the backend takes the cursor as a hardware cursor. The
+   sprite is thresholded to black and white once, when it is set. Each
+   move then composites it onto a copy of epd_pixels around the old and
+   new positions, loads just that rectangle into the controller and
+   inks it with A2, which the scheduler is told about so nothing queued
+   lands on it mid-waveform. Moves arriving faster than `interval` are
+   folded into the next draw.
+
+   epd_pixels never contains the sprite, so uncovering the old position
+   is just a matter of sending what is there. A2 only does black and
+   white though, so anything grey the cursor passed over gets a quality
+   pass afterwards. Anything else inked over the cursor erases it; it
+   is drawn again straight after (see epd_cursor_damage).
+ */
+
+
+static bool
+sprite_box(
+  struct epd_cursor *cursor,
+  pixman_box32_t * box
+)
+{
+  int width = epd_output_get_width(&cursor->output->wlr_output);
+  int height = epd_output_get_height(&cursor->output->wlr_output);
+
+  box->x1 = cursor->x - cursor->hotspot_x;
+  box->y1 = cursor->y - cursor->hotspot_y;
+  box->x2 = box->x1 + cursor->width;
+  box->y2 = box->y1 + cursor->height;
+
+  box->x1 = box->x1 < 0 ? 0 : box->x1;
+  box->y1 = box->y1 < 0 ? 0 : box->y1;
+  box->x2 = box->x2 > width ? width : box->x2;
+  box->y2 = box->y2 > height ? height : box->y2;
+
+  return cursor->visible && box->x1 < box->x2 && box->y1 < box->y2;
+}
+
+static void
+send_box(
+  struct epd_cursor *cursor,
+  pixman_box32_t * box,
+  pixman_box32_t * sprite,
+  bool has_sprite
+)
+{
+  struct epd_output *output = cursor->output;
+  unsigned int width = epd_output_get_width(&output->wlr_output);
+  const unsigned char *level = output->tone.level[EPD_UPD_A2];
+
+  /* What the panel should show, plus the sprite */
+  for (int y = box->y1; y < box->y2; y++) {
+    memcpy(cursor->frame + y * width + box->x1,
+           output->epd_pixels + y * width + box->x1, box->x2 - box->x1);
+  }
+
+  if (has_sprite) {
+    int origin_x = cursor->x - cursor->hotspot_x;
+    int origin_y = cursor->y - cursor->hotspot_y;
+
+    for (int y = sprite->y1; y < sprite->y2; y++) {
+      int row = (y - origin_y) * cursor->width - origin_x;
+
+      for (int x = sprite->x1; x < sprite->x2; x++) {
+        if (cursor->mask[row + x]) {
+          cursor->frame[y * width + x] = level[cursor->image[row + x]];
+        }
+      }
+    }
+  }
+
+  epd_transfer_image_region(&output->epd, box->x1, box->y1,
+                            box->x2 - box->x1, box->y2 - box->y1,
+                            cursor->frame);
+  epd_idle_wake(&output->idle);
+  epd_display_area(&output->epd, box->x1, box->y1, box->x2 - box->x1,
+                   box->y2 - box->y1, EPD_UPD_A2, 0);
+  epd_scheduler_busy(&output->scheduler, box, EPD_UPD_A2);
+}
+
+static void
+draw(
+  struct epd_cursor *cursor
+)
+{
+  struct epd_output *output = cursor->output;
+
+  pixman_box32_t sprite;
+  bool has_sprite = sprite_box(cursor, &sprite);
+
+  if (!has_sprite && !cursor->drawn) {
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &cursor->last_draw);
+
+  /* Old and new positions in one go when they're close, separately
+     when the cursor jumped */
+  pixman_box32_t *old = &cursor->drawn_box;
+  bool moved = !cursor->drawn || !has_sprite
+    || memcmp(old, &sprite, sizeof(pixman_box32_t)) != 0;
+
+  if (cursor->drawn && has_sprite) {
+    pixman_box32_t both = box_union(old, &sprite);
+
+    if (box_area(&both) <= 2 * (box_area(old) + box_area(&sprite))) {
+      send_box(cursor, &both, &sprite, true);
+    } else {
+      send_box(cursor, old, &sprite, false);
+      send_box(cursor, &sprite, &sprite, true);
+    }
+  } else if (cursor->drawn) {
+    send_box(cursor, old, &sprite, false);
+  } else {
+    send_box(cursor, &sprite, &sprite, true);
+  }
+
+  /* A2 has flattened any grey where the cursor was */
+  if (cursor->drawn && moved) {
+    if (output->cleanup.delay > 0) {
+      epd_cleanup_track(&output->cleanup, old, EPD_UPD_A2);
+    } else {
+      epd_output_ink(output, old, output->update_mode, EPD_INK_BACKGROUND);
+    }
+  }
+
+  cursor->drawn = has_sprite;
+  cursor->drawn_box = sprite;
+}
+
+static int
+handle_cursor_timer(
+  void *data
+)
+{
+  struct epd_cursor *cursor = data;
+
+  cursor->pending = false;
+  draw(cursor);
+  return 0;
+}
+
+static void
+schedule(
+  struct epd_cursor *cursor
+)
+{
+  if (cursor->pending || cursor->frame == NULL) {
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long long wait =
+    cursor->interval - timespec_diff_ms(&cursor->last_draw, &now);
+  wl_event_source_timer_update(cursor->timer, wait > 0 ? (int) wait : 1);
+  cursor->pending = true;
+}
+
+void
+epd_cursor_set_image(
+  struct epd_cursor *cursor,
+  const uint32_t * pixels,
+  int width,
+  int height,
+  int hotspot_x,
+  int hotspot_y
+)
+{
+  for (int i = 0; i < width * height; i++) {
+    unsigned int a = pixels[i] >> 24;
+    unsigned int r = (pixels[i] >> 16) & 0xff;
+    unsigned int g = (pixels[i] >> 8) & 0xff;
+    unsigned int b = pixels[i] & 0xff;
+
+    /* Premultiplied, so the luma is scaled back up by alpha */
+    cursor->mask[i] = a >= 128;
+    cursor->image[i] = a > 0
+      ? (((r * 77 + g * 150 + b * 29) >> 8) * 255 / a >= 128 ? 255 : 0)
+      : 255;
+  }
+
+  cursor->width = width;
+  cursor->height = height;
+  cursor->hotspot_x = hotspot_x;
+  cursor->hotspot_y = hotspot_y;
+  cursor->visible = true;
+  schedule(cursor);
+}
+
+void
+epd_cursor_set_hotspot(
+  struct epd_cursor *cursor,
+  int hotspot_x,
+  int hotspot_y
+)
+{
+  cursor->hotspot_x = hotspot_x;
+  cursor->hotspot_y = hotspot_y;
+  schedule(cursor);
+}
+
+void
+epd_cursor_hide(
+  struct epd_cursor *cursor
+)
+{
+  cursor->visible = false;
+  schedule(cursor);
+}
+
+void
+epd_cursor_move(
+  struct epd_cursor *cursor,
+  int x,
+  int y
+)
+{
+  if (cursor->x == x && cursor->y == y) {
+    return;
+  }
+
+  cursor->x = x;
+  cursor->y = y;
+
+  if (cursor->visible) {
+    schedule(cursor);
+  }
+}
+
+void
+epd_cursor_damage(
+  struct epd_cursor *cursor,
+  pixman_box32_t * box
+)
+{
+  if (cursor->drawn && box_intersects(box, &cursor->drawn_box)) {
+    schedule(cursor);
+  }
+}
+
+void
+epd_cursor_resize(
+  struct epd_cursor *cursor,
+  unsigned int width,
+  unsigned int height
+)
+{
+  free(cursor->frame);
+  cursor->frame = malloc(width * height);
+  cursor->drawn = false;
+}
+
+void
+epd_cursor_init(
+  struct epd_cursor *cursor,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+)
+{
+  memset(cursor, 0, sizeof(struct epd_cursor));
+
+  cursor->output = output;
+  cursor->interval = env_get_int("EPD_WM_CURSOR_INTERVAL",
+                                 EPD_CURSOR_DEFAULT_INTERVAL);
+  cursor->timer =
+    wl_event_loop_add_timer(event_loop, handle_cursor_timer, cursor);
+}
+
+void
+epd_cursor_finish(
+  struct epd_cursor *cursor
+)
+{
+  if (cursor->timer) {
+    wl_event_source_remove(cursor->timer);
+    cursor->timer = NULL;
+  }
+
+  free(cursor->frame);
+  cursor->frame = NULL;
+}
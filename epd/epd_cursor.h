@@ -0,0 +1,93 @@
+#ifndef EPD_CURSOR_H
+#define EPD_CURSOR_H
+
+#include <pixman.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <wayland-server.h>
+
+#define EPD_CURSOR_MAX_SIZE 64  // pixels square
+#define EPD_CURSOR_DEFAULT_INTERVAL 100 // ms
+
+struct epd_output;
+
+// The pointer, drawn straight onto the panel with A2 on top of whatever
+// is in epd_pixels, without going through the frame pipeline.
+struct epd_cursor
+{
+  struct epd_output *output;
+  struct wl_event_source *timer;
+
+  int interval;                 // ms between draws, <= 0 disables
+  bool pending;                 // timer armed
+  struct timespec last_draw;    // CLOCK_MONOTONIC
+
+  // The sprite, thresholded to black and white
+  bool visible;
+  int width, height;
+  int hotspot_x, hotspot_y;
+  unsigned char image[EPD_CURSOR_MAX_SIZE * EPD_CURSOR_MAX_SIZE];
+  bool mask[EPD_CURSOR_MAX_SIZE * EPD_CURSOR_MAX_SIZE];
+
+  int x, y;                     // hotspot position on the output
+
+  // Where it is on the panel right now
+  bool drawn;
+  pixman_box32_t drawn_box;
+
+  // epd_pixels with the sprite on top, only valid around the cursor
+  unsigned char *frame;
+};
+
+void epd_cursor_init(
+  struct epd_cursor *cursor,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+);
+
+void epd_cursor_resize(
+  struct epd_cursor *cursor,
+  unsigned int width,
+  unsigned int height
+);
+
+void epd_cursor_finish(
+  struct epd_cursor *cursor
+);
+
+// A new sprite, as premultiplied ARGB8888 pixels, at most
+// EPD_CURSOR_MAX_SIZE square
+void epd_cursor_set_image(
+  struct epd_cursor *cursor,
+  const uint32_t * pixels,
+  int width,
+  int height,
+  int hotspot_x,
+  int hotspot_y
+);
+
+void epd_cursor_set_hotspot(
+  struct epd_cursor *cursor,
+  int hotspot_x,
+  int hotspot_y
+);
+
+void epd_cursor_hide(
+  struct epd_cursor *cursor
+);
+
+void epd_cursor_move(
+  struct epd_cursor *cursor,
+  int x,
+  int y
+);
+
+// Something was just inked over box; draw the cursor again if it was
+// there
+void epd_cursor_damage(
+  struct epd_cursor *cursor,
+  pixman_box32_t * box
+);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <time.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_debounce.h>
+
+#include <utils/box.h>
+#include <utils/env.h>
+#include <utils/time.h>
+
+
+/* Debouncing slow updates
+
+   A web page loading commits a frame for every image that arrives. If
+   the first of those starts a 450ms GC16 refresh, everything after it
+   waits, and then gets its own GC16. Better to wait a moment and ink
+   the lot once.
+
+   How long a moment depends on the client, so we learn it: every
+   client's gaps between commits are averaged, ignoring gaps longer
+   than `max` (those are between bursts, not in them). Damage headed
+   for a 16 level waveform then waits 1.5 times the average gap of
+   whichever clients drew there, and is pushed back again by each new
+   commit (see epd_scheduler). A client that only ever commits now and
+   then has no average, so its damage goes straight out.
+ */
+
+
+static struct epd_debounce_client *
+find_client(
+  struct epd_debounce *debounce,
+  struct wl_client *client
+)
+{
+  /* The client's slot, or a free one, or the least recently used */
+  struct epd_debounce_client *free_slot = NULL;
+  struct epd_debounce_client *oldest = NULL;
+
+  for (int i = 0; i < EPD_DEBOUNCE_MAX_CLIENTS; i++) {
+    struct epd_debounce_client *slot = &debounce->clients[i];
+
+    if (slot->client == client) {
+      return slot;
+    }
+
+    if (slot->client == NULL) {
+      if (free_slot == NULL) {
+        free_slot = slot;
+      }
+      continue;
+    }
+
+    if (oldest == NULL
+        || timespec_diff_ms(&slot->last_commit, &oldest->last_commit) > 0) {
+      oldest = slot;
+    }
+  }
+
+  struct epd_debounce_client *slot = free_slot ? free_slot : oldest;
+  memset(slot, 0, sizeof(struct epd_debounce_client));
+  return slot;
+}
+
+void
+epd_debounce_commit(
+  struct epd_debounce *debounce,
+  struct wl_client *client,
+  pixman_box32_t * box
+)
+{
+  if (debounce->max <= 0) {
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  struct epd_debounce_client *slot = find_client(debounce, client);
+
+  if (slot->client != NULL) {
+    long long gap = timespec_diff_ms(&slot->last_commit, &now);
+
+    if (gap <= debounce->max) {
+      slot->interval = slot->interval == 0
+        ? gap : 0.75 * slot->interval + 0.25 * gap;
+    }
+  }
+
+  slot->client = client;
+  slot->box = *box;
+  slot->last_commit = now;
+}
+
+int
+epd_debounce_window(
+  struct epd_debounce *debounce,
+  pixman_box32_t * box
+)
+{
+  float window = 0;
+
+  for (int i = 0; i < EPD_DEBOUNCE_MAX_CLIENTS; i++) {
+    struct epd_debounce_client *slot = &debounce->clients[i];
+
+    if (slot->client != NULL && box_intersects(box, &slot->box)
+        && 1.5 * slot->interval > window) {
+      window = 1.5 * slot->interval;
+    }
+  }
+
+  return window > debounce->max ? debounce->max : (int) window;
+}
+
+void
+epd_debounce_init(
+  struct epd_debounce *debounce
+)
+{
+  memset(debounce, 0, sizeof(struct epd_debounce));
+  debounce->max = env_get_int("EPD_WM_DEBOUNCE_MAX", EPD_DEBOUNCE_DEFAULT_MAX);
+
+  wlr_log(WLR_INFO, "epd_debounce: slow updates wait up to %i ms",
+          debounce->max);
+}
@@ -0,0 +1,46 @@
+#ifndef EPD_DEBOUNCE_H
+#define EPD_DEBOUNCE_H
+
+#include <pixman.h>
+#include <time.h>
+#include <wayland-server.h>
+
+#define EPD_DEBOUNCE_MAX_CLIENTS 16
+#define EPD_DEBOUNCE_DEFAULT_MAX 300    // ms
+
+// How often one client commits, learned as it goes
+struct epd_debounce_client
+{
+  struct wl_client *client;     // NULL for an unused slot
+  pixman_box32_t box;           // where its last commit was
+  struct timespec last_commit;  // CLOCK_MONOTONIC
+  float interval;               // ms, average gap between commits in a burst
+};
+
+// Holds back damage headed for a slow, 16 level waveform until the
+// client that caused it has probably finished its burst of commits.
+struct epd_debounce
+{
+  int max;                      // ms, longest we'll wait, <= 0 disables
+  struct epd_debounce_client clients[EPD_DEBOUNCE_MAX_CLIENTS];
+};
+
+void epd_debounce_init(
+  struct epd_debounce *debounce
+);
+
+// A client committed new content covering box
+void epd_debounce_commit(
+  struct epd_debounce *debounce,
+  struct wl_client *client,
+  pixman_box32_t * box
+);
+
+// How long (ms) to wait for more commits before inking damage in box
+// with a slow waveform
+int epd_debounce_window(
+  struct epd_debounce *debounce,
+  pixman_box32_t * box
+);
+
+#endif
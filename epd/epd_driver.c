@@ -19,7 +19,10 @@
 
 #include<wlr/util/log.h>
 #include<epd/epd_driver.h>
+#include<epd/epd_emulator.h>
 #include<utils/pgm.h>
+#include<utils/probes.h>
+#include<utils/trace.h>
 
 
 /* SCSI Generic ----------------------------------------------------------------
@@ -47,14 +50,15 @@ code. Here is the file & commit this library was written against:
     https://github.com/torvalds/linux/blob/6f0d349d922ba44e4348a17a78ea51b7135965b1/include/scsi/sg.h#L44
 
 */
-int
-send_message(
+static int
+sg_io(
   int fd,
   int command_length,
   sg_command * command_pointer,
   int data_direction,
   int data_length,
-  sg_data * data_pointer
+  sg_data * data_pointer,
+  unsigned int *info
 )
 {
   // In cases of error, the sense buffer may be filled by the kernel or device.
@@ -87,18 +91,216 @@ send_message(
   if (status != 0) {
     wlr_log(WLR_INFO, "send_message: failed with status %i", status);
   }
+  PROBE6(send_message, command_pointer[6], data_direction, data_length,
+         status, message_pointer->host_status, message_pointer->driver_status);
 
+  if (info != NULL) {
+    *info = message_pointer->info;
+  }
   free(message_pointer);
 
   return status;
 }
 
+int
+send_message(
+  int fd,
+  int command_length,
+  sg_command * command_pointer,
+  int data_direction,
+  int data_length,
+  sg_data * data_pointer
+)
+{
+  return sg_io(fd, command_length, command_pointer, data_direction,
+               data_length, data_pointer, NULL);
+}
+
+
+static int
+sg_open(
+  epd * display,
+  const char *path
+)
+{
+  display->fd = open(path, O_RDWR);
+  return display->fd < 0 ? -1 : 0;
+}
+
+static int
+sg_send(
+  epd * display,
+  int command_length,
+  sg_command * command_pointer,
+  int data_direction,
+  int data_length,
+  sg_data * data_pointer
+)
+{
+  /* SG_FLAG_DIRECT_IO is only a request: the kernel falls back to
+     copying when the buffer doesn't suit it, so keep count */
+  unsigned int info = 0;
+  int status = sg_io(display->fd, command_length, command_pointer,
+                     data_direction, data_length, data_pointer, &info);
+
+  if (status == 0 && data_length > 0) {
+    if ((info & SG_INFO_DIRECT_IO_MASK) == SG_INFO_DIRECT_IO) {
+      display->direct_io += 1;
+    } else {
+      display->indirect_io += 1;
+    }
+  }
+  return status;
+}
+
+static void
+sg_close(
+  epd * display
+)
+{
+  close(display->fd);
+}
+
+const struct epd_transport epd_sg_transport = {
+  .name = "sg",
+  .open = sg_open,
+  .send = sg_send,
+  .close = sg_close,
+};
+
+static const char *
+command_name(
+  sg_command * command_pointer
+)
+{
+  if (command_pointer[0] == SG_OP_INQUIRY) {
+    return "INQUIRY";
+  }
+
+  switch (command_pointer[6]) {
+  case EPD_OP_GET_SYS:
+    return "GET_SYS";
+  case EPD_OP_READ_MEM:
+    return "READ_MEM";
+  case EPD_OP_WRITE_MEM:
+    return "WRITE_MEM";
+  case EPD_OP_DPY_AREA:
+    return "DPY_AREA";
+  case EPD_OP_LD_IMG_AREA:
+    return "LD_IMG_AREA";
+  case EPD_OP_PMIC_CTRL:
+    return "PMIC_CTRL";
+  case EPD_OP_FAST_WRITE_MEM:
+    return "FAST_WRITE_MEM";
+  case EPD_OP_READ_REG:
+    return "READ_REG";
+  case EPD_OP_WRITE_REG:
+    return "WRITE_REG";
+  default:
+    return "command";
+  }
+}
+
+static int
+epd_send(
+  epd * display,
+  int command_length,
+  sg_command * command_pointer,
+  int data_direction,
+  int data_length,
+  sg_data * data_pointer
+)
+{
+  uint64_t start = trace_enabled ? trace_now() : 0;
+  PROBE2(command_start, command_name(command_pointer), data_length);
+  int status = display->transport->send(display, command_length,
+                                        command_pointer, data_direction,
+                                        data_length, data_pointer);
+  PROBE3(command_done, command_name(command_pointer), data_length, status);
+
+  if (trace_enabled) {
+    trace_slice(TRACE_USB, command_name(command_pointer), start, trace_now(),
+                "\"bytes\": %i, \"status\": %i", data_length, status);
+  }
+
+  display->commands += 1;
+  display->bytes += data_length;
+  if (status != 0) {
+    display->errors += 1;
+  }
+  return status;
+}
+
 
 /* IT8951 EPD Driver -----------------------------------------------------------
 
 */
 
 
+const char *
+epd_update_mode_to_string(
+  enum epd_update_mode update_mode
+)
+{
+  switch (update_mode) {
+  case EPD_UPD_RESET:
+    return "RESET";
+  case EPD_UPD_DU:
+    return "DU";
+  case EPD_UPD_GC16:
+    return "GC16";
+  case EPD_UPD_GL16:
+    return "GL16";
+  case EPD_UPD_GLR16:
+    return "GLR16";
+  case EPD_UPD_GLD16:
+    return "GLD16";
+  case EPD_UPD_A2:
+    return "A2";
+  case EPD_UPD_DU4:
+    return "DU4";
+  }
+  return "UNKNOWN";
+}
+
+int
+epd_update_mode_from_string(
+  const char *name
+)
+{
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    if (strcmp(name, epd_update_mode_to_string(mode)) == 0) {
+      return mode;
+    }
+  }
+
+  return -1;
+}
+
+
+unsigned int
+epd_update_mode_levels(
+  enum epd_update_mode update_mode
+)
+{
+  for (unsigned int i = 0;
+       i < sizeof(EPD_ONE_BIT_MODES) / sizeof(EPD_ONE_BIT_MODES[0]); i++) {
+    if (EPD_ONE_BIT_MODES[i] == update_mode) {
+      return 2;
+    }
+  }
+
+  for (unsigned int i = 0;
+       i < sizeof(EPD_TWO_BIT_MODES) / sizeof(EPD_TWO_BIT_MODES[0]); i++) {
+    if (EPD_TWO_BIT_MODES[i] == update_mode) {
+      return 4;
+    }
+  }
+
+  return 16;
+}
+
+
 int
 epd_fast_write_mem(
   epd * display,
@@ -124,12 +326,12 @@ epd_fast_write_mem(
   fw_command.epd_op = EPD_OP_FAST_WRITE_MEM;
   fw_command.length = htonl((short) size);
 
-  int fw_status = send_message(display->fd,
-                               16,
-                               (sg_command *) & fw_command,
-                               SG_DXFER_TO_DEV,
-                               size,
-                               (sg_data *) (pixels + offset));
+  int fw_status = epd_send(display,
+                           16,
+                           (sg_command *) & fw_command,
+                           SG_DXFER_TO_DEV,
+                           size,
+                           (sg_data *) (pixels + offset));
 
   if (fw_status != 0) {
     wlr_log(WLR_INFO, "epd_fast_write_mem: failed to write to memory");
@@ -237,11 +439,11 @@ epd_transfer_image_region(
     }
 
     /* Send the message */
-    int status = send_message(display->fd,
-                              16,
-                              load_image_command,
-                              SG_DXFER_TO_DEV,
-                              args_size, (sg_data *) load_image_args);
+    int status = epd_send(display,
+                          16,
+                          load_image_command,
+                          SG_DXFER_TO_DEV,
+                          args_size, (sg_data *) load_image_args);
 
     free(load_image_args);
 
@@ -326,12 +528,12 @@ epd_transfer_image(
     memcpy(load_image_args->pixels,
            (unsigned char *) chunk_address_in_our_memory, num_pixels);
 
-    int status = send_message(display->fd,
-                              16,
-                              load_image_command,
-                              SG_DXFER_TO_DEV,
-                              args_length,
-                              (sg_data *) load_image_args);
+    int status = epd_send(display,
+                          16,
+                          load_image_command,
+                          SG_DXFER_TO_DEV,
+                          args_length,
+                          (sg_data *) load_image_args);
 
     free(load_image_args);
 
@@ -416,12 +618,12 @@ epd_draw(
   draw_data.height = htonl(height);
   draw_data.wait_display_ready = 0;
 
-  int status = send_message(display->fd,
-                            16,
-                            draw_command,
-                            SG_DXFER_TO_DEV,
-                            sizeof(epd_display_area_args_addr),
-                            (sg_data *) & draw_data);
+  int status = epd_send(display,
+                        16,
+                        draw_command,
+                        SG_DXFER_TO_DEV,
+                        sizeof(epd_display_area_args_addr),
+                        (sg_data *) & draw_data);
 
   if (status != 0) {
     return -1;
@@ -484,12 +686,12 @@ epd_draw_region(
   draw_data.height = htonl(region_height);
   draw_data.wait_display_ready = 1;
 
-  int status = send_message(display->fd,
-                            16,
-                            draw_command,
-                            SG_DXFER_TO_DEV,
-                            sizeof(epd_display_area_args_addr),
-                            (sg_data *) & draw_data);
+  int status = epd_send(display,
+                        16,
+                        draw_command,
+                        SG_DXFER_TO_DEV,
+                        sizeof(epd_display_area_args_addr),
+                        (sg_data *) & draw_data);
 
   if (status != 0) {
     return -1;
@@ -508,7 +710,7 @@ epd_pmic_on(
 )
 {
 
-  if (display->state != EPD_INIT) {
+  if (display->state == EPD_BUSY) {
     return -1;
   }
 
@@ -517,14 +719,14 @@ epd_pmic_on(
   pmic_command.sg_op = SG_OP_CUSTOM;
   pmic_command.epd_op = EPD_OP_PMIC_CTRL;
   pmic_command.set_pmic = 1;
-  pmic_command.pmic_value = htonl(1);
+  pmic_command.pmic_value = 1;
 
-  int status = send_message(display->fd,
-                            sizeof(epd_set_pmic_command),
-                            (sg_command *) & pmic_command,
-                            SG_DXFER_TO_DEV,
-                            0,
-                            (sg_data *) NULL);
+  int status = epd_send(display,
+                        sizeof(epd_set_pmic_command),
+                        (sg_command *) & pmic_command,
+                        SG_DXFER_TO_DEV,
+                        0,
+                        (sg_data *) NULL);
 
   if (status != 0) {
     return -1;
@@ -540,7 +742,7 @@ epd_pmic_off(
 )
 {
 
-  if (display->state != EPD_INIT) {
+  if (display->state == EPD_BUSY) {
     return -1;
   }
 
@@ -549,14 +751,14 @@ epd_pmic_off(
   pmic_command.sg_op = SG_OP_CUSTOM;
   pmic_command.epd_op = EPD_OP_PMIC_CTRL;
   pmic_command.set_pmic = 1;
-  pmic_command.pmic_value = htonl(0);
+  pmic_command.pmic_value = 0;
 
-  int status = send_message(display->fd,
-                            sizeof(epd_set_pmic_command),
-                            (sg_command *) & pmic_command,
-                            SG_DXFER_TO_DEV,
-                            0,
-                            (sg_data *) NULL);
+  int status = epd_send(display,
+                        sizeof(epd_set_pmic_command),
+                        (sg_command *) & pmic_command,
+                        SG_DXFER_TO_DEV,
+                        0,
+                        (sg_data *) NULL);
 
   if (status != 0) {
     return -1;
@@ -589,12 +791,12 @@ epd_reset(
   reset_data.height = display->info.height;
   reset_data.wait_display_ready = 1;
 
-  int status = send_message(display->fd,
-                            16,
-                            reset_command,
-                            SG_DXFER_TO_DEV,
-                            sizeof(epd_display_area_args_addr),
-                            (sg_data *) & reset_data);
+  int status = epd_send(display,
+                        16,
+                        reset_command,
+                        SG_DXFER_TO_DEV,
+                        sizeof(epd_display_area_args_addr),
+                        (sg_data *) & reset_data);
 
   if (status != 0) {
     return -1;
@@ -637,12 +839,12 @@ epd_set_vcom(
   vcom_command.set_vcom = 1;
   vcom_command.vcom_value = htonl(voltage);
 
-  int status = send_message(display->fd,
-                            sizeof(epd_set_vcom_command),
-                            (sg_command *) & vcom_command,
-                            SG_DXFER_TO_DEV,
-                            0,
-                            (sg_data *) NULL);
+  int status = epd_send(display,
+                        sizeof(epd_set_vcom_command),
+                        (sg_command *) & vcom_command,
+                        SG_DXFER_TO_DEV,
+                        0,
+                        (sg_data *) NULL);
 
   if (status != 0) {
     return -1;
@@ -668,11 +870,11 @@ epd_get_system_info(
     0, 0, 0, 0, 0
   };
 
-  int status = send_message(display->fd,
-                            16,
-                            (sg_command *) info_command,
-                            SG_DXFER_FROM_DEV,
-                            info_length, (sg_data *) & (display->info));
+  int status = epd_send(display,
+                        16,
+                        (sg_command *) info_command,
+                        SG_DXFER_FROM_DEV,
+                        info_length, (sg_data *) & (display->info));
 
   if (status != 0) {
     return -1;
@@ -697,12 +899,12 @@ epd_ensure_it8951_display(
     { 0x12, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
   sg_data inquiry_response[40] = { 0 };
 
-  int status = send_message(display->fd,
-                            16,
-                            inquiry_command,
-                            SG_DXFER_FROM_DEV,
-                            40,
-                            inquiry_response);
+  int status = epd_send(display,
+                        16,
+                        inquiry_command,
+                        SG_DXFER_FROM_DEV,
+                        40,
+                        inquiry_response);
 
   if (status != 0) {
     wlr_log(WLR_INFO, "epd_ensure_it8951_display: inquiry msg failed");
@@ -739,10 +941,17 @@ epd_init(
   wlr_log(WLR_INFO, "epd_init:");
   wlr_log(WLR_INFO, "epd_init: %s, %u", path, vcom_voltage);
 
-  display->fd = open(path, O_RDWR);
+  display->transport = strcmp(path, "emulator") == 0
+    || strcmp(path, "null") == 0
+    ? &epd_emulator_transport : &epd_sg_transport;
   display->state = EPD_INIT;
   display->max_transfer = 60000;
 
+  if (display->transport->open(display, path) != 0) {
+    wlr_log(WLR_ERROR, "epd_init: could not open %s", path);
+    return -1;
+  }
+
   wlr_log(WLR_INFO, "epd_init: ensure we are talking to an it8951 on path %s",
           path);
   if (epd_ensure_it8951_display(display) != 0) {
@@ -818,12 +1027,14 @@ epd_display_area(
   draw_data.height = htonl(height);
   draw_data.wait_display_ready = wait;
 
-  int status = send_message(display->fd,
-                            16,
-                            draw_command,
-                            SG_DXFER_TO_DEV,
-                            sizeof(epd_display_area_args_addr),
-                            (sg_data *) & draw_data);
+  PROBE6(display_area, x, y, width, height, update_mode, wait);
+  int status = epd_send(display,
+                        16,
+                        draw_command,
+                        SG_DXFER_TO_DEV,
+                        sizeof(epd_display_area_args_addr),
+                        (sg_data *) & draw_data);
+  PROBE2(display_area_done, update_mode, status);
 
   if (status != 0) {
     return -1;
@@ -833,3 +1044,12 @@ epd_display_area(
   return 0;
 
 }
+
+
+void
+epd_finish(
+  epd * display
+)
+{
+  display->transport->close(display);
+}
@@ -77,6 +77,13 @@ enum epd_update_mode
   EPD_UPD_DU4 = 7,
 };
 
+#define EPD_UPD_COUNT (EPD_UPD_DU4 + 1)
+
+// Short name for update_mode ("DU4", "GC16", ...)
+const char *epd_update_mode_to_string(
+  enum epd_update_mode update_mode
+);
+
 static const enum epd_update_mode EPD_ONE_BIT_MODES[] =
   { EPD_UPD_DU, EPD_UPD_A2 };
 static const enum epd_update_mode EPD_ONE_BIT_LEVELS[] = { 0 * 8, 30 * 8 };
@@ -92,6 +99,18 @@ static const enum epd_update_mode EPD_FOUR_BIT_LEVELS[] = {
   20 * 8, 22 * 8, 24 * 8, 26 * 8, 28 * 8, 30 * 8
 };
 
+// The update_mode called name ("DU4", "GC16", ...), or -1
+int epd_update_mode_from_string(
+  const char *name
+);
+
+// Number of grey levels the waveform behind update_mode can show (2,
+// 4 or 16). Anything not in the tables above (i.e. EPD_UPD_RESET)
+// counts as 16.
+unsigned int epd_update_mode_levels(
+  enum epd_update_mode update_mode
+);
+
 // Fill this code to CDB[6].
 enum epd_opcode
 {
@@ -140,15 +159,57 @@ enum epd_state
 { EPD_INIT, EPD_READY, EPD_BUSY };
 
 
+struct epd_transport;
+
 typedef struct
 {
   int fd;
   int state;
   unsigned int max_transfer;
   epd_info info;
+
+  // How commands reach the controller, see epd_transport
+  const struct epd_transport *transport;
+  void *transport_data;
+
+  // Running totals, for metrics
+  unsigned long long commands;
+  unsigned long long bytes;
+  unsigned long long errors;
+  unsigned long long direct_io;         // transfers the kernel didn't copy
+  unsigned long long indirect_io;       // and ones it did
 } epd;
 
 
+// Carries SCSI commands (and their data) to an IT8951, or something
+// pretending to be one. send has the same contract as send_message.
+struct epd_transport
+{
+  const char *name;
+
+  int (*open)(
+    epd * display,
+    const char *path
+  );
+
+  int (*send)(
+    epd * display,
+    int command_length,
+    sg_command * command_pointer,
+    int data_direction,
+    int data_length,
+    sg_data * data_pointer
+  );
+
+  void (*close)(
+    epd * display
+  );
+};
+
+// A real display, through a /dev/sgN device
+extern const struct epd_transport epd_sg_transport;
+
+
 typedef struct
 {
   unsigned char sg_op;
@@ -286,12 +347,18 @@ int epd_set_vcom(
 );
 
 
+// path is a /dev/sgN device, or "emulator" for epd_emulator_transport
 int epd_init(
   epd * display,
   char path[],
   unsigned int vcom_voltage
 );
 
+// Close whatever epd_init opened
+void epd_finish(
+  epd * display
+);
+
 int epd_display_area(
   epd * display,
   unsigned int x,
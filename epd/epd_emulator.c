@@ -0,0 +1,434 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_driver.h>
+#include <epd/epd_emulator.h>
+#include <epd/epd_panel.h>
+
+#include <utils/env.h>
+
+
+/* IT8951 emulator
+
+   Everything between epd_output and the panel (chunking, transfers,
+   display commands) could only be exercised with a display plugged
+   in. Setting EPD_WM_DEVICE=emulator swaps the SCSI generic transport
+   for this one, which decodes the same commands and applies them to an
+   image buffer in memory.
+
+   Only what epd_driver sends is understood: INQUIRY, GET_SYS,
+   LD_IMG_AREA, FAST_WRITE_MEM, DPY_AREA, READ_REG, WRITE_REG and
+   PMIC_CTRL (power and VCOM). Display commands are checked, counted
+   and handed to the panel simulator (see epd_panel), which works out
+   when the waveform runs and what the panel looks like after it.
+
+   To make timings meaningful, each command takes `latency` us plus its
+   data at `bandwidth` bytes per ms, spent sleeping like a blocking
+   SG_IO call would. Display commands also block until their waveform
+   starts, or ends if the driver asked to wait for it.
+
+   EPD_WM_DEVICE=null is the same emulator with all of that turned off:
+   commands are checked and answered, but take no time and leave
+   nothing behind. It's for measuring the compositor on its own.
+ */
+
+
+static unsigned int
+read_be32(
+  const unsigned char *bytes
+)
+{
+  unsigned int value;
+  memcpy(&value, bytes, sizeof(unsigned int));
+  return ntohl(value);
+}
+
+static void
+simulate_transfer(
+  struct epd_emulator *emulator,
+  int data_length
+)
+{
+  long long ns = (long long) emulator->latency * 1000;
+  if (emulator->bandwidth > 0) {
+    ns += (long long) data_length * 1000000 / emulator->bandwidth;
+  }
+
+  if (ns > 0) {
+    struct timespec delay = {
+      .tv_sec = ns / 1000000000,
+      .tv_nsec = ns % 1000000000,
+    };
+    nanosleep(&delay, NULL);
+  }
+
+  emulator->commands += 1;
+  emulator->bytes += data_length;
+}
+
+static bool
+area_valid(
+  struct epd_emulator *emulator,
+  unsigned int x,
+  unsigned int y,
+  unsigned int width,
+  unsigned int height
+)
+{
+  return x + width <= emulator->width && y + height <= emulator->height
+    && x + width >= x && y + height >= y;
+}
+
+static struct epd_emulator_register *
+find_register(
+  struct epd_emulator *emulator,
+  unsigned int address,
+  bool create
+)
+{
+  for (int i = 0; i < emulator->registers_count; i++) {
+    if (emulator->registers[i].address == address) {
+      return &emulator->registers[i];
+    }
+  }
+
+  if (!create || emulator->registers_count == EPD_EMULATOR_MAX_REGISTERS) {
+    return NULL;
+  }
+
+  struct epd_emulator_register *reg =
+    &emulator->registers[emulator->registers_count++];
+  reg->address = address;
+  reg->value = 0;
+  return reg;
+}
+
+static int
+get_sys(
+  struct epd_emulator *emulator,
+  int data_length,
+  sg_data * data_pointer
+)
+{
+  epd_info info;
+  memset(&info, 0, sizeof(epd_info));
+
+  info.signature = htonl(0x31353938);   // "8951"
+  info.width = htonl(emulator->width);
+  info.height = htonl(emulator->height);
+  info.update_buffer_address = htonl(EPD_EMULATOR_IMAGE_ADDRESS);
+  info.image_buffer_address = htonl(EPD_EMULATOR_IMAGE_ADDRESS);
+  info.display_modes_count = htonl(EPD_UPD_COUNT);
+  info.image_buffers_count = htonl(1);
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    info.display_mode_frame_counts[mode] =
+      htonl(emulator->panel.frame_counts[mode]);
+  }
+
+  size_t length = data_length > 0 ? (size_t) data_length : 0;
+  if (length > sizeof(epd_info)) {
+    length = sizeof(epd_info);
+  }
+
+  memcpy(data_pointer, &info, length);
+  return 0;
+}
+
+static int
+load_image_area(
+  struct epd_emulator *emulator,
+  int data_length,
+  sg_data * data_pointer
+)
+{
+  if (data_length < (int) sizeof(epd_load_image_args_addr)) {
+    return -1;
+  }
+
+  epd_load_image_args_addr *args = (epd_load_image_args_addr *) data_pointer;
+  unsigned int x = ntohl(args->x);
+  unsigned int y = ntohl(args->y);
+  unsigned int width = ntohl(args->width);
+  unsigned int height = ntohl(args->height);
+
+  if (!area_valid(emulator, x, y, width, height)
+      || data_length - sizeof(epd_load_image_args_addr) < width * height) {
+    wlr_log(WLR_ERROR, "epd_emulator: bad LD_IMG_AREA %ux%u+%u+%u",
+            width, height, x, y);
+    return -1;
+  }
+
+  if (emulator->null_sink) {
+    return 0;
+  }
+
+  for (unsigned int row = 0; row < height; row++) {
+    memcpy(emulator->image + (y + row) * emulator->width + x,
+           args->pixels + row * width, width);
+  }
+  return 0;
+}
+
+static int
+fast_write_mem(
+  struct epd_emulator *emulator,
+  sg_command * command_pointer,
+  int data_length,
+  sg_data * data_pointer
+)
+{
+  /* The length in the command is unreliable (see
+     epd_fast_write_mem), so go by the data sent */
+  unsigned int address = read_be32(command_pointer + 2);
+  unsigned long long image_size =
+    (unsigned long long) emulator->width * emulator->height;
+
+  if (address < EPD_EMULATOR_IMAGE_ADDRESS
+      || address - EPD_EMULATOR_IMAGE_ADDRESS + data_length > image_size) {
+    wlr_log(WLR_ERROR, "epd_emulator: bad FAST_WRITE_MEM %i bytes at 0x%x",
+            data_length, address);
+    return -1;
+  }
+
+  if (!emulator->null_sink) {
+    memcpy(emulator->image + (address - EPD_EMULATOR_IMAGE_ADDRESS),
+           data_pointer, data_length);
+  }
+  return 0;
+}
+
+static int
+display_area(
+  struct epd_emulator *emulator,
+  int data_length,
+  sg_data * data_pointer
+)
+{
+  if (data_length < (int) sizeof(epd_display_area_args_addr)) {
+    return -1;
+  }
+
+  epd_display_area_args_addr *args =
+    (epd_display_area_args_addr *) data_pointer;
+  unsigned int mode = ntohl(args->update_mode);
+  unsigned int x = ntohl(args->x);
+  unsigned int y = ntohl(args->y);
+  unsigned int width = ntohl(args->width);
+  unsigned int height = ntohl(args->height);
+
+  if (mode >= EPD_UPD_COUNT || !area_valid(emulator, x, y, width, height)) {
+    wlr_log(WLR_ERROR, "epd_emulator: bad DPY_AREA %ux%u+%u+%u mode %u",
+            width, height, x, y, mode);
+    return -1;
+  }
+
+  if (!emulator->pmic) {
+    wlr_log(WLR_ERROR, "epd_emulator: DPY_AREA with the PMIC off");
+  }
+
+  emulator->updates += 1;
+  if (emulator->null_sink) {
+    return 0;
+  }
+
+  struct timespec start, end;
+  epd_panel_display(&emulator->panel, emulator->image, x, y, width, height,
+                    mode, &start, &end);
+
+  wlr_log(WLR_DEBUG, "epd_emulator: %s %ux%u+%u+%u",
+          epd_update_mode_to_string(mode), width, height, x, y);
+
+  /* Like the controller, don't take the next command before this one
+     has a LUT */
+  struct timespec *until = args->wait_display_ready ? &end : &start;
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, until, NULL);
+  return 0;
+}
+
+static int
+pmic_ctrl(
+  struct epd_emulator *emulator,
+  sg_command * command_pointer
+)
+{
+  /* See epd_set_vcom_command and epd_set_pmic_command */
+  if (command_pointer[9]) {
+    emulator->vcom = command_pointer[7] << 8 | command_pointer[8];
+  }
+  if (command_pointer[10]) {
+    emulator->pmic = command_pointer[11] != 0;
+  }
+  return 0;
+}
+
+static int
+emulator_send(
+  epd * display,
+  int command_length,
+  sg_command * command_pointer,
+  int data_direction,
+  int data_length,
+  sg_data * data_pointer
+)
+{
+  struct epd_emulator *emulator = display->transport_data;
+  simulate_transfer(emulator, data_length);
+
+  if (command_pointer[0] == SG_OP_INQUIRY) {
+    static const char name[] = "Generic Storage RamDisc 1.00";
+
+    memset(data_pointer, 0, data_length);
+    if (data_length >= 8 + 28) {
+      memcpy(data_pointer + 8, name, 28);
+    }
+    return 0;
+  }
+
+  if (command_pointer[0] != SG_OP_CUSTOM || command_length < 12) {
+    return -1;
+  }
+
+  unsigned int address = read_be32(command_pointer + 2);
+  struct epd_emulator_register *reg;
+
+  switch (command_pointer[6]) {
+  case EPD_OP_GET_SYS:
+    return get_sys(emulator, data_length, data_pointer);
+  case EPD_OP_LD_IMG_AREA:
+    return load_image_area(emulator, data_length, data_pointer);
+  case EPD_OP_FAST_WRITE_MEM:
+    return fast_write_mem(emulator, command_pointer, data_length,
+                          data_pointer);
+  case EPD_OP_DPY_AREA:
+    return display_area(emulator, data_length, data_pointer);
+  case EPD_OP_PMIC_CTRL:
+    return pmic_ctrl(emulator, command_pointer);
+  case EPD_OP_READ_REG:
+    if (data_length < 4) {
+      return -1;
+    }
+    reg = find_register(emulator, address, false);
+    unsigned int value = htonl(reg ? reg->value : 0);
+    memcpy(data_pointer, &value, 4);
+    return 0;
+  case EPD_OP_WRITE_REG:
+    if (data_length < 4) {
+      return -1;
+    }
+    reg = find_register(emulator, address, true);
+    if (reg) {
+      reg->value = read_be32(data_pointer);
+    }
+    return 0;
+  default:
+    wlr_log(WLR_ERROR, "epd_emulator: unsupported command 0x%02x",
+            command_pointer[6]);
+    return -1;
+  }
+}
+
+static int
+emulator_open(
+  epd * display,
+  const char *path
+)
+{
+  struct epd_emulator *emulator = calloc(1, sizeof(struct epd_emulator));
+  if (emulator == NULL) {
+    return -1;
+  }
+
+  emulator->width = EPD_EMULATOR_DEFAULT_WIDTH;
+  emulator->height = EPD_EMULATOR_DEFAULT_HEIGHT;
+
+  const char *size = getenv("EPD_WM_EMULATOR_SIZE");
+  if (size != NULL
+      && sscanf(size, "%ux%u", &emulator->width, &emulator->height) != 2) {
+    wlr_log(WLR_ERROR, "Ignoring EPD_WM_EMULATOR_SIZE: expected WxH");
+    emulator->width = EPD_EMULATOR_DEFAULT_WIDTH;
+    emulator->height = EPD_EMULATOR_DEFAULT_HEIGHT;
+  }
+
+  emulator->null_sink = strcmp(path, "null") == 0;
+  emulator->pmic = true;
+
+  if (!emulator->null_sink) {
+    emulator->bandwidth = env_get_int("EPD_WM_EMULATOR_BANDWIDTH", 0);
+    emulator->latency = env_get_int("EPD_WM_EMULATOR_LATENCY", 0);
+  }
+
+  emulator->image = malloc(emulator->width * emulator->height);
+  if (emulator->image == NULL) {
+    free(emulator);
+    return -1;
+  }
+  memset(emulator->image, 255, emulator->width * emulator->height);
+
+  if (!emulator->null_sink
+      && epd_panel_init(&emulator->panel, emulator->width,
+                        emulator->height) < 0) {
+    free(emulator->image);
+    free(emulator);
+    return -1;
+  }
+
+  wlr_log(WLR_INFO, "epd_emulator: %ux%u, %i bytes/ms, %i us/command%s",
+          emulator->width, emulator->height, emulator->bandwidth,
+          emulator->latency, emulator->null_sink ? ", null sink" : "");
+
+  display->fd = -1;
+  display->transport_data = emulator;
+  return 0;
+}
+
+static void
+emulator_close(
+  epd * display
+)
+{
+  struct epd_emulator *emulator = display->transport_data;
+
+  wlr_log(WLR_INFO,
+          "epd_emulator: %llu commands, %llu bytes, %llu display updates",
+          emulator->commands, emulator->bytes, emulator->updates);
+  if (!emulator->null_sink) {
+    epd_panel_report(&emulator->panel);
+    epd_panel_finish(&emulator->panel);
+  }
+  free(emulator->image);
+  free(emulator);
+  display->transport_data = NULL;
+}
+
+const struct epd_transport epd_emulator_transport = {
+  .name = "emulator",
+  .open = emulator_open,
+  .send = emulator_send,
+  .close = emulator_close,
+};
+
+struct epd_emulator *
+epd_emulator_from_display(
+  epd * display
+)
+{
+  if (display->transport != &epd_emulator_transport) {
+    return NULL;
+  }
+  return display->transport_data;
+}
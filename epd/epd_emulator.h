@@ -0,0 +1,54 @@
+#ifndef EPD_EMULATOR_H
+#define EPD_EMULATOR_H
+
+#include <stdbool.h>
+
+#include <epd/epd_driver.h>
+#include <epd/epd_panel.h>
+
+#define EPD_EMULATOR_DEFAULT_WIDTH 1200
+#define EPD_EMULATOR_DEFAULT_HEIGHT 825
+#define EPD_EMULATOR_IMAGE_ADDRESS 0x001236e0
+#define EPD_EMULATOR_MAX_REGISTERS 16
+
+struct epd_emulator_register
+{
+  unsigned int address;
+  unsigned int value;
+};
+
+// A software IT8951: keeps the image buffer in memory and answers the
+// commands epd_driver sends, taking as long as a real one would to
+// receive them.
+struct epd_emulator
+{
+  unsigned int width, height;
+  bool null_sink;               // accept everything, store nothing
+  unsigned char *image;         // the controller's image buffer
+  struct epd_panel panel;       // what's actually on the glass
+
+  bool pmic;
+  unsigned int vcom;
+
+  int bandwidth;                // bytes per ms, <= 0 for instant
+  int latency;                  // us per command
+
+  int registers_count;
+  struct epd_emulator_register registers[EPD_EMULATOR_MAX_REGISTERS];
+
+  // Running totals, for benchmarks
+  unsigned long long commands;
+  unsigned long long bytes;
+  unsigned long long updates;
+};
+
+// Use with epd_init(display, "emulator", vcom), or "null" for a sink
+// that takes no time and keeps nothing
+extern const struct epd_transport epd_emulator_transport;
+
+// The emulator behind display, or NULL if it is a real one
+struct epd_emulator *epd_emulator_from_display(
+  epd * display
+);
+
+#endif
@@ -0,0 +1,721 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_export.h>
+#include <epd/epd_output.h>
+
+
+/* Metrics export
+
+   With EPD_WM_METRICS_SOCKET set, epd-wm listens on a UNIX socket
+   there and answers each connection with the commit metrics (see
+   epd_stats) and the driver's totals, then hangs up. What comes back
+   depends on the first line sent:
+
+   - "GET /metrics HTTP/1.1" and the like get an HTTP reply, so
+     `curl --unix-socket` works. Paths containing "json" get JSON.
+   - "json" gets bare JSON, anything else bare Prometheus text.
+   - Either way, asking for "records" gets the per-commit records
+     still in epd_stats' ring as JSON, from "from=N" on if given. The
+     reply says which to ask from next time, so a poller can follow
+     every commit and see from the seqs when it fell behind.
+
+   Everything happens on the event loop, with non-blocking sockets: a
+   reply is rendered in one go (a few KB), and then written out as
+   fast as the reader takes it, between frames. A slow or stuck reader
+   never holds up a commit, at worst it holds one of
+   EPD_EXPORT_MAX_CLIENTS slots until it goes away.
+ */
+
+
+// Prometheus histogram buckets, in seconds
+static const double BUCKETS[] = {
+  0.0001, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25,
+  0.5, 1, 2.5, 5,
+};
+
+
+static void
+write_counter(
+  FILE * file,
+  const char *name,
+  const char *help,
+  unsigned long long value
+)
+{
+  fprintf(file, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help,
+          name, name, value);
+}
+
+static void
+write_histogram(
+  FILE * file,
+  const char *name,
+  const char *label,
+  const char *value,
+  struct epd_stats_histogram *histogram
+)
+{
+  char labels[64] = "";
+  if (label != NULL) {
+    snprintf(labels, sizeof(labels), "%s=\"%s\",", label, value);
+  }
+
+  for (size_t i = 0; i < sizeof(BUCKETS) / sizeof(BUCKETS[0]); i++) {
+    fprintf(file, "%s_bucket{%sle=\"%g\"} %llu\n", name, labels, BUCKETS[i],
+            (unsigned long long) epd_stats_count_below(histogram,
+                                                       BUCKETS[i] * 1e9));
+  }
+
+  /* Trailing comma only goes in front of le */
+  size_t length = strlen(labels);
+  if (length > 0) {
+    labels[length - 1] = '\0';
+  }
+
+  fprintf(file, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels,
+          length > 0 ? "," : "", (unsigned long long) histogram->count);
+  fprintf(file, "%s_sum{%s} %.9f\n", name, labels, histogram->total / 1e9);
+  fprintf(file, "%s_count{%s} %llu\n", name, labels,
+          (unsigned long long) histogram->count);
+}
+
+/* Prometheus label values and JSON strings escape the same few
+   characters; anything else below a space is dropped */
+static void
+write_escaped(
+  FILE * file,
+  const char *value
+)
+{
+  for (const char *c = value; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(file, "\\%c", *c);
+    } else if (*c == '\n') {
+      fprintf(file, "\\n");
+    } else if ((unsigned char) *c >= ' ') {
+      fputc(*c, file);
+    }
+  }
+}
+
+static void
+write_client_counter(
+  FILE * file,
+  const char *name,
+  const char *help,
+  struct epd_client **clients,
+  int clients_count,
+  size_t offset,
+  double scale
+)
+{
+  fprintf(file, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+  for (int i = 0; i < clients_count; i++) {
+    uint64_t value = *(uint64_t *) ((char *) clients[i] + offset);
+
+    fprintf(file, "%s{app_id=\"", name);
+    write_escaped(file, clients[i]->app_id);
+    fprintf(file, "\",pid=\"%i\"} %.9g\n", (int) clients[i]->pid,
+            value * scale);
+  }
+}
+
+static int
+sum_by_process(
+  struct epd_client **clients,
+  int clients_count,
+  struct epd_client *sums,
+  struct epd_client **summed
+)
+{
+  /* One series per app_id and pid: windows of the same client, or a
+     closed one and its successor, would otherwise repeat a label set,
+     and Prometheus rejects the whole scrape for that. Only the names
+     and totals are filled in. */
+  int count = 0;
+
+  for (int i = 0; i < clients_count; i++) {
+    struct epd_client *client = clients[i];
+    struct epd_client *sum = NULL;
+
+    for (int j = 0; j < count && sum == NULL; j++) {
+      if (sums[j].pid == client->pid
+          && strcmp(sums[j].app_id, client->app_id) == 0) {
+        sum = &sums[j];
+      }
+    }
+
+    if (sum == NULL) {
+      sum = &sums[count];
+      summed[count++] = sum;
+      memset(sum, 0, sizeof(struct epd_client));
+      memcpy(sum->app_id, client->app_id, sizeof(sum->app_id));
+      sum->pid = client->pid;
+    }
+
+    epd_clients_add_totals(sum, client);
+  }
+  return count;
+}
+
+static void
+render_prometheus_clients(
+  FILE * file,
+  struct epd_clients *clients
+)
+{
+  /* Titles change too often to make good labels, JSON has them */
+  struct epd_client *sorted[EPD_CLIENTS_ENTRIES];
+  int sorted_count =
+    epd_clients_sorted(clients, sorted, EPD_CLIENTS_ENTRIES);
+
+  struct epd_client sums[EPD_CLIENTS_ENTRIES];
+  struct epd_client *summed[EPD_CLIENTS_ENTRIES];
+  int count = sum_by_process(sorted, sorted_count, sums, summed);
+
+  write_client_counter(file, "epd_client_pixels_changed_total",
+                       "Pixels changed by each client's windows.", summed,
+                       count, offsetof(struct epd_client, pixels), 1);
+  write_client_counter(file, "epd_client_ink_bytes_total",
+                       "Bytes sent for each client's inks.", summed, count,
+                       offsetof(struct epd_client, bytes), 1);
+  write_client_counter(file, "epd_client_ink_seconds_total",
+                       "Time spent dithering and sending each "
+                       "client's inks.", summed, count,
+                       offsetof(struct epd_client, ink_ns), 1e-9);
+  write_client_counter(file, "epd_client_refresh_seconds_total",
+                       "Waveform time spent showing each client.", summed,
+                       count, offsetof(struct epd_client, refresh_us),
+                       1e-6);
+
+  fprintf(file, "# HELP epd_client_inks_total Inks covering each client's "
+          "windows, by update mode.\n# TYPE epd_client_inks_total counter\n");
+  for (int i = 0; i < count; i++) {
+    for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+      if (summed[i]->inks[mode] == 0) {
+        continue;
+      }
+      fprintf(file, "epd_client_inks_total{app_id=\"");
+      write_escaped(file, summed[i]->app_id);
+      fprintf(file, "\",pid=\"%i\",mode=\"%s\"} %llu\n",
+              (int) summed[i]->pid, epd_update_mode_to_string(mode),
+              (unsigned long long) summed[i]->inks[mode]);
+    }
+  }
+}
+
+static void
+render_prometheus(
+  FILE * file,
+  struct epd_output *output
+)
+{
+  struct epd_stats *stats = &output->stats;
+  epd *display = &output->epd;
+
+  write_counter(file, "epd_commits_total", "Frames committed.",
+                stats->commit.count);
+  write_counter(file, "epd_commits_unchanged_total",
+                "Frames committed that changed no pixels.", stats->skipped);
+  write_counter(file, "epd_pixels_changed_total",
+                "Pixels changed by commits.", stats->pixels);
+  write_counter(file, "epd_ink_bytes_total",
+                "Bytes of pixels sent for inks.", stats->bytes);
+  write_counter(file, "epd_inputs_dropped_total",
+                "Inputs not followed to the panel.", stats->inputs_dropped);
+
+  write_counter(file, "epd_usb_commands_total",
+                "Commands sent to the controller.", display->commands);
+  write_counter(file, "epd_usb_bytes_total",
+                "Bytes of data sent with commands.", display->bytes);
+  write_counter(file, "epd_usb_errors_total",
+                "Commands that failed.", display->errors);
+  write_counter(file, "epd_usb_direct_io_total",
+                "Transfers done with direct I/O.", display->direct_io);
+  write_counter(file, "epd_usb_indirect_io_total",
+                "Transfers the kernel fell back to copying for.",
+                display->indirect_io);
+
+  fprintf(file, "# HELP epd_inks_total Inks sent, by update mode.\n"
+          "# TYPE epd_inks_total counter\n");
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    fprintf(file, "epd_inks_total{mode=\"%s\"} %llu\n",
+            epd_update_mode_to_string(mode),
+            (unsigned long long) stats->modes[mode].count);
+  }
+
+  fprintf(file, "# HELP epd_waveform_seconds Estimated waveform duration, "
+          "by update mode.\n# TYPE epd_waveform_seconds gauge\n");
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    fprintf(file, "epd_waveform_seconds{mode=\"%s\"} %g\n",
+            epd_update_mode_to_string(mode),
+            output->governor.waveform_time[mode] / 1000.0);
+  }
+
+  fprintf(file, "# HELP epd_stage_seconds Time spent in each stage, "
+          "per commit.\n# TYPE epd_stage_seconds histogram\n");
+  for (int stage = 0; stage < EPD_STAGE_COUNT; stage++) {
+    write_histogram(file, "epd_stage_seconds", "stage",
+                    epd_stats_stage_name(stage), &stats->stages[stage]);
+  }
+
+  fprintf(file, "# HELP epd_commit_seconds Time spent on each commit, "
+          "including its inks.\n# TYPE epd_commit_seconds histogram\n");
+  write_histogram(file, "epd_commit_seconds", NULL, NULL, &stats->commit);
+
+  fprintf(file, "# HELP epd_ink_seconds Time from dithering to display "
+          "command, by update mode.\n# TYPE epd_ink_seconds histogram\n");
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    write_histogram(file, "epd_ink_seconds", "mode",
+                    epd_update_mode_to_string(mode), &stats->modes[mode]);
+  }
+
+  fprintf(file, "# HELP epd_input_latency_seconds Time from input to the "
+          "end of the refresh showing it.\n"
+          "# TYPE epd_input_latency_seconds histogram\n");
+  for (int kind = 0; kind < EPD_INPUT_COUNT; kind++) {
+    write_histogram(file, "epd_input_latency_seconds", "input",
+                    epd_stats_input_name(kind), &stats->latency[kind]);
+  }
+
+  render_prometheus_clients(file, &output->clients);
+}
+
+static void
+render_json_histogram(
+  FILE * file,
+  const char *name,
+  struct epd_stats_histogram *histogram
+)
+{
+  fprintf(file, "\"%s\": {\"count\": %llu, \"mean_ms\": %.3f, "
+          "\"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, "
+          "\"p999_ms\": %.3f, \"max_ms\": %.3f}", name,
+          (unsigned long long) histogram->count,
+          histogram->count ? histogram->total / 1e6 / histogram->count : 0,
+          epd_stats_percentile(histogram, 0.5) / 1e6,
+          epd_stats_percentile(histogram, 0.9) / 1e6,
+          epd_stats_percentile(histogram, 0.99) / 1e6,
+          epd_stats_percentile(histogram, 0.999) / 1e6,
+          histogram->max / 1e6);
+}
+
+static void
+render_json(
+  FILE * file,
+  struct epd_output *output
+)
+{
+  struct epd_stats *stats = &output->stats;
+  epd *display = &output->epd;
+
+  fprintf(file, "{\"commits\": %llu, \"commits_unchanged\": %llu, "
+          "\"pixels_changed\": %llu, \"ink_bytes\": %llu,\n",
+          (unsigned long long) stats->commit.count,
+          (unsigned long long) stats->skipped,
+          (unsigned long long) stats->pixels,
+          (unsigned long long) stats->bytes);
+
+  unsigned long long transfers = display->direct_io + display->indirect_io;
+  fprintf(file, " \"usb\": {\"commands\": %llu, \"bytes\": %llu, "
+          "\"errors\": %llu, \"direct_io\": %llu, \"indirect_io\": %llu, "
+          "\"direct_io_ratio\": %.4f},\n", display->commands, display->bytes,
+          display->errors, display->direct_io, display->indirect_io,
+          transfers ? (double) display->direct_io / transfers : 0);
+
+  fprintf(file, " \"stages\": {");
+  for (int stage = 0; stage < EPD_STAGE_COUNT; stage++) {
+    fprintf(file, "%s\n  ", stage > 0 ? "," : "");
+    render_json_histogram(file, epd_stats_stage_name(stage),
+                          &stats->stages[stage]);
+  }
+  fprintf(file, ",\n  ");
+  render_json_histogram(file, "commit", &stats->commit);
+  fprintf(file, "},\n");
+
+  fprintf(file, " \"modes\": {");
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    fprintf(file, "%s\n  \"%s\": {\"waveform_ms\": %.1f, ",
+            mode > 0 ? "," : "", epd_update_mode_to_string(mode),
+            output->governor.waveform_time[mode]);
+    render_json_histogram(file, "inks", &stats->modes[mode]);
+    fprintf(file, "}");
+  }
+  fprintf(file, "},\n");
+
+  fprintf(file, " \"input_latency\": {\"dropped\": %llu",
+          (unsigned long long) stats->inputs_dropped);
+  for (int kind = 0; kind < EPD_INPUT_COUNT; kind++) {
+    fprintf(file, ",\n  ");
+    render_json_histogram(file, epd_stats_input_name(kind),
+                          &stats->latency[kind]);
+  }
+  fprintf(file, "},\n");
+
+  struct epd_client *sorted[EPD_CLIENTS_ENTRIES];
+  int count = epd_clients_sorted(&output->clients, sorted,
+                                 EPD_CLIENTS_ENTRIES);
+
+  fprintf(file, " \"clients\": [");
+  for (int i = 0; i < count; i++) {
+    struct epd_client *client = sorted[i];
+
+    fprintf(file, "%s\n  {\"app_id\": \"", i > 0 ? "," : "");
+    write_escaped(file, client->app_id);
+    fprintf(file, "\", \"title\": \"");
+    write_escaped(file, client->title);
+    fprintf(file, "\", \"pid\": %i, \"closed\": %s, \"commits\": %llu, "
+            "\"pixels_changed\": %llu, \"ink_bytes\": %llu, "
+            "\"ink_ms\": %.3f, \"refresh_ms\": %.3f, \"inks\": {",
+            (int) client->pid,
+            client->view == NULL && client != &output->clients.compositor
+            ? "true" : "false", (unsigned long long) client->commits,
+            (unsigned long long) client->pixels,
+            (unsigned long long) client->bytes, client->ink_ns / 1e6,
+            client->refresh_us / 1e3);
+
+    bool first = true;
+    for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+      if (client->inks[mode] > 0) {
+        fprintf(file, "%s\"%s\": %llu", first ? "" : ", ",
+                epd_update_mode_to_string(mode),
+                (unsigned long long) client->inks[mode]);
+        first = false;
+      }
+    }
+    fprintf(file, "}}");
+  }
+  fprintf(file, "]}\n");
+}
+
+static void
+render_records(
+  FILE * file,
+  struct epd_stats *stats,
+  unsigned long long from
+)
+{
+  unsigned long long recorded = epd_stats_recorded(stats);
+  if (recorded > EPD_STATS_RING_SIZE
+      && from < recorded - EPD_STATS_RING_SIZE) {
+    from = recorded - EPD_STATS_RING_SIZE;
+  }
+
+  fprintf(file, "{\"next\": %llu, \"records\": [", recorded);
+
+  bool first = true;
+  for (unsigned long long seq = from; seq < recorded; seq++) {
+    struct epd_stats_record record;
+    if (!epd_stats_read(stats, seq, &record)) {
+      continue;
+    }
+
+    fprintf(file, "%s\n {\"seq\": %llu, \"time_ns\": %llu, "
+            "\"stages_ns\": {", first ? "" : ",", seq,
+            (unsigned long long) record.time);
+    for (int stage = 0; stage < EPD_STAGE_COUNT; stage++) {
+      fprintf(file, "%s\"%s\": %llu", stage > 0 ? ", " : "",
+              epd_stats_stage_name(stage),
+              (unsigned long long) record.stage[stage]);
+    }
+    fprintf(file, "}, \"bytes\": %u, \"pixels_changed\": %u, "
+            "\"inks\": %u, \"mode\": ", record.bytes, record.pixels,
+            record.inks);
+    if (record.mode < EPD_UPD_COUNT) {
+      fprintf(file, "\"%s\"}", epd_update_mode_to_string(record.mode));
+    } else {
+      fprintf(file, "null}");
+    }
+    first = false;
+  }
+  fprintf(file, "]}\n");
+}
+
+static void
+render_reply(
+  struct epd_export_client *client
+)
+{
+  struct epd_output *output = client->export->output;
+
+  /* Only the first line matters */
+  char *newline = strpbrk(client->request, "\r\n");
+  if (newline != NULL) {
+    *newline = '\0';
+  }
+
+  bool http = strncmp(client->request, "GET ", 4) == 0;
+  bool json = http ? strstr(client->request, "json") != NULL
+    : strncmp(client->request, "json", 4) == 0;
+  bool records = strstr(client->request, "records") != NULL;
+
+  unsigned long long from = 0;
+  const char *from_arg = strstr(client->request, "from=");
+  if (from_arg != NULL) {
+    from = strtoull(from_arg + strlen("from="), NULL, 10);
+  }
+
+  char *body = NULL;
+  size_t body_length = 0;
+  FILE *file = open_memstream(&body, &body_length);
+  if (file == NULL) {
+    return;
+  }
+  if (records) {
+    render_records(file, &output->stats, from);
+  } else if (json) {
+    render_json(file, output);
+  } else {
+    render_prometheus(file, output);
+  }
+  fclose(file);
+
+  if (!http) {
+    client->reply = body;
+    client->reply_length = body_length;
+    return;
+  }
+
+  file = open_memstream(&client->reply, &client->reply_length);
+  if (file == NULL) {
+    free(body);
+    return;
+  }
+  fprintf(file, "HTTP/1.0 200 OK\r\nContent-Type: %s\r\n"
+          "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+          json || records ? "application/json"
+          : "text/plain; version=0.0.4; charset=utf-8", body_length);
+  fwrite(body, 1, body_length, file);
+  fclose(file);
+  free(body);
+}
+
+static void
+client_destroy(
+  struct epd_export_client *client
+)
+{
+  wl_event_source_remove(client->source);
+  close(client->fd);
+  free(client->reply);
+  wl_list_remove(&client->link);
+  client->export->clients_count -= 1;
+  free(client);
+}
+
+static int
+handle_client(
+  int fd,
+  uint32_t mask,
+  void *data
+)
+{
+  struct epd_export_client *client = data;
+
+  if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+    client_destroy(client);
+    return 0;
+  }
+
+  if (client->reply == NULL) {
+    size_t room = sizeof(client->request) - 1 - client->request_length;
+    ssize_t count = read(fd, client->request + client->request_length, room);
+
+    if (count < 0 && (errno == EAGAIN || errno == EINTR)) {
+      return 0;
+    }
+    if (count < 0) {
+      client_destroy(client);
+      return 0;
+    }
+
+    client->request_length += count;
+    client->request[client->request_length] = '\0';
+
+    /* Wait for the whole first line, unless that's all we'll get */
+    if (count > 0 && room > (size_t) count
+        && strchr(client->request, '\n') == NULL) {
+      return 0;
+    }
+
+    render_reply(client);
+    if (client->reply == NULL) {
+      client_destroy(client);
+      return 0;
+    }
+    wl_event_source_fd_update(client->source, WL_EVENT_WRITABLE);
+    return 0;
+  }
+
+  /* A reader gone since asking would otherwise SIGPIPE us */
+  ssize_t count = send(fd, client->reply + client->reply_sent,
+                       client->reply_length - client->reply_sent,
+                       MSG_NOSIGNAL);
+
+  if (count < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return 0;
+  }
+  if (count > 0) {
+    client->reply_sent += count;
+  }
+  if (count <= 0 || client->reply_sent == client->reply_length) {
+    client_destroy(client);
+  }
+  return 0;
+}
+
+static int
+handle_connection(
+  int fd,
+  uint32_t mask,
+  void *data
+)
+{
+  struct epd_export *export = data;
+
+  int client_fd = accept(fd, NULL, NULL);
+  if (client_fd < 0) {
+    return 0;
+  }
+
+  if (fcntl(client_fd, F_SETFL, O_NONBLOCK) < 0
+      || fcntl(client_fd, F_SETFD, FD_CLOEXEC) < 0) {
+    close(client_fd);
+    return 0;
+  }
+
+  if (export->clients_count >= EPD_EXPORT_MAX_CLIENTS) {
+    close(client_fd);
+    return 0;
+  }
+
+  struct epd_export_client *client =
+    calloc(1, sizeof(struct epd_export_client));
+  if (client == NULL) {
+    close(client_fd);
+    return 0;
+  }
+
+  client->export = export;
+  client->fd = client_fd;
+  client->source = wl_event_loop_add_fd(export->event_loop, client_fd,
+                                        WL_EVENT_READABLE, handle_client,
+                                        client);
+  if (client->source == NULL) {
+    close(client_fd);
+    free(client);
+    return 0;
+  }
+
+  wl_list_insert(&export->clients, &client->link);
+  export->clients_count += 1;
+  return 0;
+}
+
+void
+epd_export_start(
+  struct epd_export *export
+)
+{
+  if (export->path == NULL || export->source != NULL) {
+    return;
+  }
+
+  struct sockaddr_un address = {.sun_family = AF_UNIX };
+  if (strlen(export->path) >= sizeof(address.sun_path)) {
+    wlr_log(WLR_ERROR, "epd_export: socket path too long: %s",
+            export->path);
+    return;
+  }
+  strcpy(address.sun_path, export->path);
+
+  export->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                      0);
+  if (export->fd < 0) {
+    wlr_log(WLR_ERROR, "epd_export: could not create a socket");
+    return;
+  }
+
+  /* A socket there is left over from an earlier run. Anything else
+     isn't ours to remove, and bind will fail on it. */
+  struct stat existing;
+  if (lstat(export->path, &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+    unlink(export->path);
+  }
+
+  if (bind(export->fd, (struct sockaddr *) &address, sizeof(address)) < 0
+      || listen(export->fd, EPD_EXPORT_MAX_CLIENTS) < 0) {
+    wlr_log(WLR_ERROR, "epd_export: could not listen on %s: %s",
+            export->path, strerror(errno));
+    close(export->fd);
+    export->fd = -1;
+    return;
+  }
+
+  export->source = wl_event_loop_add_fd(export->event_loop, export->fd,
+                                        WL_EVENT_READABLE, handle_connection,
+                                        export);
+  wlr_log(WLR_INFO, "epd_export: serving metrics on %s", export->path);
+}
+
+void
+epd_export_init(
+  struct epd_export *export,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+)
+{
+  memset(export, 0, sizeof(struct epd_export));
+
+  export->output = output;
+  export->event_loop = event_loop;
+  export->fd = -1;
+  wl_list_init(&export->clients);
+
+  const char *path = getenv("EPD_WM_METRICS_SOCKET");
+  if (path != NULL && path[0] != '\0') {
+    export->path = strdup(path);
+  }
+}
+
+void
+epd_export_finish(
+  struct epd_export *export
+)
+{
+  struct epd_export_client *client, *tmp;
+  wl_list_for_each_safe(client, tmp, &export->clients, link) {
+    client_destroy(client);
+  }
+
+  if (export->source != NULL) {
+    wl_event_source_remove(export->source);
+    export->source = NULL;
+    close(export->fd);
+    unlink(export->path);
+  }
+
+  free(export->path);
+  export->path = NULL;
+}
@@ -0,0 +1,58 @@
+#ifndef EPD_EXPORT_H
+#define EPD_EXPORT_H
+
+#include <wayland-server.h>
+
+#define EPD_EXPORT_MAX_CLIENTS 8
+#define EPD_EXPORT_REQUEST_SIZE 256
+
+struct epd_output;
+struct epd_export;
+
+// One connection, from its request to the end of the reply
+struct epd_export_client
+{
+  struct wl_list link;
+  struct epd_export *export;
+  int fd;
+  struct wl_event_source *source;
+
+  char request[EPD_EXPORT_REQUEST_SIZE];
+  size_t request_length;
+
+  char *reply;
+  size_t reply_length;
+  size_t reply_sent;
+};
+
+// Serves the output's metrics on a UNIX socket, in Prometheus text
+// format or JSON, from the event loop.
+struct epd_export
+{
+  struct epd_output *output;
+  struct wl_event_loop *event_loop;
+
+  char *path;                   // NULL when not serving
+  int fd;
+  struct wl_event_source *source;
+
+  struct wl_list clients;
+  int clients_count;
+};
+
+void epd_export_init(
+  struct epd_export *export,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+);
+
+// Start listening, once we're running as the user that will connect
+void epd_export_start(
+  struct epd_export *export
+);
+
+void epd_export_finish(
+  struct epd_export *export
+);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <time.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_governor.h>
+
+#include <utils/env.h>
+#include <utils/time.h>
+
+
+/* Refresh governor
+
+   Frames used to be sent at a fixed 2 Hz, whether the user was typing
+   or had walked away, and whether or not the panel could keep up.
+
+   There are now two profiles. Input (or wlr_idle noticing activity)
+   switches to interactive, which aims for ~10 Hz. After a few seconds
+   without input we go back to reading, at ~1 Hz, where damage is
+   inked with GL16 in one go rather than fast and then cleaned up
+   (see ink_damage). Animation and scrolling can ask for something
+   faster.
+
+   Whatever is asked for, a frame is never sent sooner than the last
+   one could have been sent: the transfer of a typical update, at the
+   measured USB rate, plus a display command. Transfer rates and
+   command times are tracked for every update.
+
+   Waveform times, which the scheduler uses to know what is still
+   running, depend on the panel and its temperature. Typical ones are
+   used unless asked to measure them at start up.
+ */
+
+
+// Rough waveform times for a 9.7" panel at room temperature, in ms.
+// Used until (or unless) calibration replaces them.
+static const int DEFAULT_WAVEFORM_TIMES[EPD_UPD_COUNT] = {
+  [EPD_UPD_RESET] = 2000,
+  [EPD_UPD_DU] = 260,
+  [EPD_UPD_GC16] = 450,
+  [EPD_UPD_GL16] = 450,
+  [EPD_UPD_GLR16] = 450,
+  [EPD_UPD_GLD16] = 450,
+  [EPD_UPD_A2] = 120,
+  [EPD_UPD_DU4] = 290,
+};
+
+#define CALIBRATION_SIZE 8      // pixels square
+
+
+static float
+average(
+  float average,
+  float sample
+)
+{
+  return average == 0 ? sample : 0.875 * average + 0.125 * sample;
+}
+
+void
+epd_governor_transfer(
+  struct epd_governor *governor,
+  unsigned int bytes,
+  float ms
+)
+{
+  if (ms > 0) {
+    governor->transfer_rate = average(governor->transfer_rate, bytes / ms);
+  }
+  governor->update_bytes = average(governor->update_bytes, bytes);
+}
+
+void
+epd_governor_display(
+  struct epd_governor *governor,
+  float ms
+)
+{
+  governor->command_time = average(governor->command_time, ms);
+}
+
+void
+epd_governor_set_profile(
+  struct epd_governor *governor,
+  enum epd_governor_profile profile
+)
+{
+  if (governor->profile != profile) {
+    wlr_log(WLR_INFO, "epd_governor: %s profile",
+            profile == EPD_PROFILE_INTERACTIVE ? "interactive" : "reading");
+  }
+  governor->profile = profile;
+}
+
+int
+epd_governor_waveform_time(
+  struct epd_governor *governor,
+  enum epd_update_mode update_mode
+)
+{
+  return (int) governor->waveform_time[update_mode];
+}
+
+int
+epd_governor_frame_delay(
+  struct epd_governor *governor,
+  int target
+)
+{
+  if (target <= 0) {
+    target = governor->profile == EPD_PROFILE_INTERACTIVE
+      ? EPD_GOVERNOR_INTERACTIVE_DELAY : EPD_GOVERNOR_READING_DELAY;
+  }
+
+  /* How soon another update could be sent. Not inked: waveforms run
+     on after their command, and the scheduler holds back anything
+     that would land on one still running, so only the part that
+     blocks us counts. */
+  float floor = governor->command_time;
+
+  if (governor->transfer_rate > 0) {
+    floor += governor->update_bytes / governor->transfer_rate;
+  }
+
+  return target > floor ? target : (int) floor + 1;
+}
+
+void
+epd_governor_calibrate(
+  struct epd_governor *governor,
+  epd * display,
+  unsigned char *pixels
+)
+{
+  /* Redraw a white square in the corner with each waveform, waiting for
+     it to finish. The content doesn't change, so nothing shows (bar a
+     brief flash for GC16). */
+  unsigned int width = ntohl(display->info.width);
+
+  epd_fast_copy_image_bytes(display, pixels, 0,
+                            CALIBRATION_SIZE + (CALIBRATION_SIZE - 1) * width);
+
+  /* Each waveform is run twice and the second timed, so the time
+     covers exactly one waveform whether the controller waits before
+     or after starting it. GLR16 and GLD16 are GL16 variants. */
+  static const enum epd_update_mode modes[] = {
+    EPD_UPD_A2, EPD_UPD_DU, EPD_UPD_DU4, EPD_UPD_GL16, EPD_UPD_GC16,
+  };
+
+  for (unsigned int i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+    enum epd_update_mode mode = modes[i];
+
+    epd_display_area(display, 0, 0, CALIBRATION_SIZE, CALIBRATION_SIZE,
+                     mode, 1);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (epd_display_area(display, 0, 0, CALIBRATION_SIZE, CALIBRATION_SIZE,
+                         mode, 1) != 0) {
+      wlr_log(WLR_ERROR, "epd_governor: could not time %s",
+              epd_update_mode_to_string(mode));
+      continue;
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    governor->waveform_time[mode] = timespec_diff_ms(&start, &end);
+    wlr_log(WLR_INFO, "epd_governor: %s takes %.0f ms",
+            epd_update_mode_to_string(mode), governor->waveform_time[mode]);
+  }
+
+  governor->waveform_time[EPD_UPD_GLR16] =
+    governor->waveform_time[EPD_UPD_GL16];
+  governor->waveform_time[EPD_UPD_GLD16] =
+    governor->waveform_time[EPD_UPD_GL16];
+}
+
+void
+epd_governor_init(
+  struct epd_governor *governor
+)
+{
+  memset(governor, 0, sizeof(struct epd_governor));
+
+  governor->profile = EPD_PROFILE_INTERACTIVE;
+  governor->idle_timeout =
+    env_get_int("EPD_WM_INTERACTIVE_TIMEOUT", EPD_GOVERNOR_DEFAULT_IDLE);
+
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    governor->waveform_time[mode] = DEFAULT_WAVEFORM_TIMES[mode];
+  }
+}
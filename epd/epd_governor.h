@@ -0,0 +1,77 @@
+#ifndef EPD_GOVERNOR_H
+#define EPD_GOVERNOR_H
+
+#include <stdbool.h>
+
+#include <epd/epd_driver.h>
+
+#define EPD_GOVERNOR_INTERACTIVE_DELAY 100      // ms, ~10 Hz
+#define EPD_GOVERNOR_READING_DELAY 1000         // ms, ~1 Hz
+#define EPD_GOVERNOR_DEFAULT_IDLE 5000  // ms without input before reading
+
+enum epd_governor_profile
+{
+  EPD_PROFILE_READING,          // nothing going on, ~1 Hz
+  EPD_PROFILE_INTERACTIVE,      // the user is doing something, ~10 Hz
+};
+
+// Picks the frame rate from what the user is doing and what the panel
+// has been measured to manage.
+struct epd_governor
+{
+  enum epd_governor_profile profile;
+  int idle_timeout;             // ms without input before reading
+
+  // Measured as we go
+  float transfer_rate;          // bytes per ms over USB
+  float command_time;           // ms per display command
+  float update_bytes;           // bytes in a typical update, lately
+  float waveform_time[EPD_UPD_COUNT];   // ms, see epd_governor_calibrate
+};
+
+void epd_governor_init(
+  struct epd_governor *governor
+);
+
+// Time each waveform on a small, blank corner of the panel. Takes a
+// few seconds, blocking, and only works while nothing else is being
+// displayed.
+// pixels is a full frame of white to send from.
+void epd_governor_calibrate(
+  struct epd_governor *governor,
+  epd * display,
+  unsigned char *pixels
+);
+
+// Record a transfer of bytes that took ms
+void epd_governor_transfer(
+  struct epd_governor *governor,
+  unsigned int bytes,
+  float ms
+);
+
+// Record a display command that took ms
+void epd_governor_display(
+  struct epd_governor *governor,
+  float ms
+);
+
+void epd_governor_set_profile(
+  struct epd_governor *governor,
+  enum epd_governor_profile profile
+);
+
+// ms the waveform behind update_mode takes
+int epd_governor_waveform_time(
+  struct epd_governor *governor,
+  enum epd_update_mode update_mode
+);
+
+// ms until the next frame. target is what the caller would like
+// (e.g. for animation), or 0 to go by the profile.
+int epd_governor_frame_delay(
+  struct epd_governor *governor,
+  int target
+);
+
+#endif
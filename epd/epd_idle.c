@@ -0,0 +1,125 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <time.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_idle.h>
+#include <epd/epd_output.h>
+
+#include <utils/env.h>
+#include <utils/time.h>
+
+
+/* Idle
+
+   An e-paper panel keeps its image without power, so a device left
+   showing a page needn't draw any. Two things used to keep it awake:
+   the frame timer, which fired whether or not anything had changed,
+   and the panel's PMIC, which stayed on from start up.
+
+   The frame timer now stops itself after a frame with nothing to
+   commit (see signal_frame); new damage gets a frame through wlroots
+   and the next commit starts the timer again. This module handles
+   the PMIC: once nothing has been inked for power_timeout, and
+   nothing is queued or still running a waveform, it's switched off.
+
+   Waking it takes a moment, so we don't wait for the first update:
+   any input wakes it straight away, while the client is still
+   drawing its response.
+ */
+
+
+static int
+handle_idle_timer(
+  void *data
+)
+{
+  struct epd_idle *idle = data;
+  struct epd_output *output = idle->output;
+
+  /* Not while anything is queued, running or due a quality pass */
+  struct timespec settled;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if (output->scheduler.jobs_count > 0
+      || output->cleanup.regions_count > 0
+      || !epd_scheduler_settled(&output->scheduler, &settled)
+      || timespec_diff_ms(&now, &settled) > 0) {
+    wl_event_source_timer_update(idle->timer, idle->power_timeout);
+    return 0;
+  }
+
+  if (epd_pmic_off(&output->epd) != 0) {
+    wlr_log(WLR_ERROR, "epd_idle: could not power down the PMIC");
+    return 0;
+  }
+
+  wlr_log(WLR_INFO, "epd_idle: PMIC powered down");
+  idle->powered = false;
+  return 0;
+}
+
+void
+epd_idle_wake(
+  struct epd_idle *idle
+)
+{
+  if (!idle->powered) {
+    if (epd_pmic_on(&idle->output->epd) != 0) {
+      wlr_log(WLR_ERROR, "epd_idle: could not power up the PMIC");
+      return;
+    }
+
+    wlr_log(WLR_INFO, "epd_idle: PMIC powered up");
+    idle->powered = true;
+  }
+
+  if (idle->power_timeout > 0) {
+    wl_event_source_timer_update(idle->timer, idle->power_timeout);
+  }
+}
+
+void
+epd_idle_init(
+  struct epd_idle *idle,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+)
+{
+  memset(idle, 0, sizeof(struct epd_idle));
+
+  idle->output = output;
+  idle->powered = true;         // epd_init leaves it on
+  idle->power_timeout = env_get_int("EPD_WM_POWER_TIMEOUT",
+                                    EPD_IDLE_DEFAULT_POWER_TIMEOUT);
+  idle->timer = wl_event_loop_add_timer(event_loop, handle_idle_timer, idle);
+
+  if (idle->power_timeout > 0) {
+    wl_event_source_timer_update(idle->timer, idle->power_timeout);
+  }
+}
+
+void
+epd_idle_finish(
+  struct epd_idle *idle
+)
+{
+  if (idle->timer) {
+    wl_event_source_remove(idle->timer);
+    idle->timer = NULL;
+  }
+
+  idle->power_timeout = 0;
+  epd_idle_wake(idle);
+}
@@ -0,0 +1,40 @@
+#ifndef EPD_IDLE_H
+#define EPD_IDLE_H
+
+#include <stdbool.h>
+#include <wayland-server.h>
+
+#define EPD_IDLE_DEFAULT_POWER_TIMEOUT 10000    // ms
+
+struct epd_output;
+
+// Powers the panel's PMIC down once nothing has been inked for a while,
+// and back up as soon as there is input (or something to ink).
+struct epd_idle
+{
+  struct epd_output *output;
+  struct wl_event_source *timer;
+
+  int power_timeout;            // ms, <= 0 keeps the PMIC on
+  bool powered;
+};
+
+void epd_idle_init(
+  struct epd_idle *idle,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+);
+
+// Stops the timer and powers the PMIC back up, e.g. for a last reset
+void epd_idle_finish(
+  struct epd_idle *idle
+);
+
+// Make sure the PMIC is on, and start counting down again. Called
+// before every display command and on input, so the PMIC is (or is
+// getting) ready by the time the first update after idle arrives.
+void epd_idle_wake(
+  struct epd_idle *idle
+);
+
+#endif
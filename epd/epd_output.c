@@ -10,20 +10,28 @@
 
 #include <arpa/inet.h>
 #include <assert.h>
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_matrix.h>
 #include <wlr/util/log.h>
 
 #include <epd/epd_driver.h>
 #include <epd/epd_backend.h>
 #include <epd/epd_output.h>
 
+#include <utils/box.h>
+#include <utils/dither.h>
+#include <utils/env.h>
+#include <utils/probes.h>
 #include <utils/time.h>
-#include <utils/pgm.h>
+#include <utils/trace.h>
 #include <hacks/wlr_utils_signal.h>
 
 
@@ -61,6 +69,11 @@
  */
 
 
+// Characters either side of the text cursor inked first when typing,
+// in multiples of the cursor's height
+#define TYPING_MARGIN 4
+
+
 static EGLSurface
 egl_create_surface(
   struct wlr_egl *egl,
@@ -91,10 +104,12 @@ output_set_custom_mode(
   struct epd_output *output = epd_output_from_output(wlr_output);
   struct epd_backend *backend = output->backend;
 
+  /* refresh is in mHz. Asking for one pins the frame rate (as far as
+     the panel can keep up); otherwise the governor picks it. */
+  output->frame_delay = refresh > 0 ? 1000000 / refresh : 0;
   if (refresh <= 0) {
-    refresh = EPD_BACKEND_DEFAULT_REFRESH;
+    refresh = 1000000 / EPD_GOVERNOR_INTERACTIVE_DELAY;
   }
-  output->frame_delay = 1000000 / refresh;
 
   /* We use three pixel buffers (euugh). They each need to be set up
      now. This handles the initial setup (as output_set_custom_mode is
@@ -133,6 +148,26 @@ output_set_custom_mode(
   output->epd_pixels = malloc(pixels_size);
   memset(output->epd_pixels, 255, pixels_size);
 
+  /* Grayscale copy of what the panel should be showing */
+  if (output->target_pixels) {
+    free(output->target_pixels);
+  }
+
+  output->target_pixels = malloc(pixels_size);
+  memset(output->target_pixels, 255, pixels_size);
+
+  /* Any pending quality passes or queued inks refer to the old
+     buffers */
+  output->cleanup.regions_count = 0;
+  epd_scheduler_clear(&output->scheduler);
+  epd_output_check_present(output);
+  wl_signal_emit(&output->events.sent, output);
+
+  epd_animation_resize(&output->animation, width, height);
+  epd_scroll_resize(&output->scroll, width, height);
+  epd_cursor_resize(&output->cursor, width, height);
+  epd_wet_ink_resize(&output->wet_ink, width, height);
+
   wlr_log(WLR_INFO, "Setting mode for epd output: success");
 
   wlr_output_update_custom_mode(&output->wlr_output, width, height, refresh);
@@ -153,6 +188,331 @@ output_attach_render(
   return ret;
 }
 
+static unsigned int
+update_mode_levels(
+  enum epd_update_mode update_mode,
+  unsigned char levels[16]
+)
+{
+  /* The EPD_*_LEVELS tables as plain bytes, for the ditherer */
+  unsigned int count = epd_update_mode_levels(update_mode);
+
+  for (unsigned int i = 0; i < count; i++) {
+    if (count == 2) {
+      levels[i] = EPD_ONE_BIT_LEVELS[i];
+    } else if (count == 4) {
+      levels[i] = EPD_TWO_BIT_LEVELS[i];
+    } else {
+      levels[i] = EPD_FOUR_BIT_LEVELS[i];
+    }
+  }
+
+  return count;
+}
+
+static void
+load_dither_config(
+  struct epd_output *output
+)
+{
+  /* Dithering is picked per waveform with EPD_WM_DITHER_<MODE>, e.g.
+     EPD_WM_DITHER_DU=floyd-steinberg. By default the 1 bit modes get
+     blue noise, DU4 gets Bayer and the 16 level modes aren't
+     dithered. */
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    switch (epd_update_mode_levels(mode)) {
+    case 2:
+      output->dither[mode] = DITHER_BLUE_NOISE;
+      break;
+    case 4:
+      output->dither[mode] = DITHER_BAYER;
+      break;
+    default:
+      output->dither[mode] = DITHER_NONE;
+      break;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "EPD_WM_DITHER_%s",
+             epd_update_mode_to_string(mode));
+
+    const char *value = getenv(name);
+    if (value == NULL) {
+      continue;
+    }
+
+    int method = dither_method_from_string(value);
+    if (method < 0) {
+      wlr_log(WLR_ERROR, "Ignoring %s: unknown dither method '%s'", name,
+              value);
+      continue;
+    }
+
+    output->dither[mode] = method;
+  }
+}
+
+static void
+region_histogram(
+  struct epd_output *output,
+  pixman_box32_t * box,
+  unsigned int histogram[256]
+)
+{
+  unsigned int width = epd_output_get_width(&output->wlr_output);
+
+  memset(histogram, 0, sizeof(unsigned int) * 256);
+
+  for (int y = box->y1; y < box->y2; y++) {
+    const unsigned char *target_row = output->target_pixels + y * width;
+
+    for (int x = box->x1; x < box->x2; x++) {
+      histogram[target_row[x]] += 1;
+    }
+  }
+}
+
+void
+epd_output_ink(
+  struct epd_output *output,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode,
+  unsigned int flags
+)
+{
+  enum epd_priority priority = EPD_PRIORITY_NORMAL;
+  if (flags & EPD_INK_URGENT) {
+    priority = EPD_PRIORITY_URGENT;
+  } else if (flags & EPD_INK_BACKGROUND) {
+    priority = EPD_PRIORITY_BACKGROUND;
+  }
+
+  epd_scheduler_submit(&output->scheduler, box, update_mode, flags,
+                       priority);
+}
+
+int
+epd_output_ink_now(
+  struct epd_output *output,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode,
+  unsigned int flags
+)
+{
+  /* Quantise target_pixels inside box for the given waveform, send
+     them to the display and start refreshing that area. Everything
+     that puts pixels on the panel (commits, quality passes) ends up
+     here, by way of the scheduler. We don't wait for the waveform;
+     the scheduler keeps track of which areas are still busy. */
+  unsigned int width = epd_output_get_width(&output->wlr_output);
+
+  unsigned int x1 = box->x1;
+  unsigned int y1 = box->y1;
+  unsigned int x2 = box->x2;
+  unsigned int y2 = box->y2;
+
+  uint64_t time_dither_start = epd_stats_now();
+
+  enum dither_method method = output->dither[update_mode];
+
+  if ((flags & EPD_INK_ORDERED) && method != DITHER_BAYER
+      && method != DITHER_BLUE_NOISE) {
+    method = DITHER_BLUE_NOISE;
+  }
+
+  if ((flags & EPD_INK_SNAP) || method == DITHER_NONE) {
+    const unsigned char *level = output->tone.level[update_mode];
+
+    for (unsigned int y = y1; y < y2; y++) {
+      const unsigned char *target_row = output->target_pixels + y * width;
+      unsigned char *epd_row = output->epd_pixels + y * width;
+
+      for (unsigned int x = x1; x < x2; x++) {
+        epd_row[x] = level[target_row[x]];
+      }
+    }
+  } else {
+    unsigned char levels[16];
+    unsigned int levels_count = update_mode_levels(update_mode, levels);
+
+    dither_region(method, levels, levels_count,
+                  output->tone.tone[update_mode],
+                  output->target_pixels, output->epd_pixels, width,
+                  x1, y1, x2, y2);
+  }
+
+  /* A pen stroke that hasn't settled stays on top */
+  epd_wet_ink_composite(&output->wet_ink, output->epd_pixels, box,
+                        update_mode);
+
+  wlr_log(WLR_INFO, "epd_ink: sending update to display (mode=%i)",
+          update_mode);
+  uint64_t time_send_pixels_start = epd_stats_now();
+  epd_fast_copy_image_bytes(&output->epd, output->epd_pixels,
+                            x1 + y1 * width, x2 + (y2 - 1) * width);
+  uint64_t time_display_start = epd_stats_now();
+  epd_idle_wake(&output->idle);
+  int status = epd_display_area(&output->epd, x1, y1, x2 - x1, y2 - y1,
+                                update_mode, 0);
+  uint64_t time_display_end = epd_stats_now();
+  wlr_log(WLR_INFO, "epd_ink: display update sent");
+
+  unsigned int bytes = (x2 + (y2 - 1) * width) - (x1 + y1 * width);
+  epd_stats_add(&output->stats, EPD_STAGE_DITHER, time_dither_start,
+                time_send_pixels_start);
+  epd_stats_add(&output->stats, EPD_STAGE_TRANSFER, time_send_pixels_start,
+                time_display_start);
+  epd_stats_add(&output->stats, EPD_STAGE_DISPLAY, time_display_start,
+                time_display_end);
+
+  /* The waveform runs on after the command, for about as long as the
+     governor thinks */
+  trace_flow_display(time_display_start);
+  trace_async(TRACE_PANEL, epd_update_mode_to_string(update_mode),
+              time_display_start, time_display_start
+              + output->governor.waveform_time[update_mode] * 1000000,
+              "\"x\": %u, \"y\": %u, \"width\": %u, \"height\": %u",
+              x1, y1, x2 - x1, y2 - y1);
+  epd_stats_ink(&output->stats, bytes, update_mode,
+                time_display_end - time_dither_start);
+  epd_clients_ink(&output->clients, box, update_mode, bytes,
+                  time_display_end - time_dither_start,
+                  output->governor.waveform_time[update_mode]);
+
+  epd_governor_transfer(&output->governor, bytes,
+                        (time_display_start - time_send_pixels_start) / 1e6);
+  epd_governor_display(&output->governor,
+                       (time_display_end - time_display_start) / 1e6);
+
+  if (flags & EPD_INK_EXACT) {
+    epd_cleanup_settle(&output->cleanup, box);
+  } else {
+    epd_cleanup_track(&output->cleanup, box, update_mode);
+  }
+
+  /* That will have inked over the cursor, if it was there */
+  epd_cursor_damage(&output->cursor, box);
+
+  return status;
+}
+
+static void
+ink_damage(
+  struct epd_output *output,
+  pixman_box32_t * box
+)
+{
+  /* Content that is (nearly) all black and white can go out with the
+     1 bit waveform, whatever the default is. While reading, nobody is
+     waiting on anything else: it goes out with the quality waveform
+     straight away, rather than fast now and again once it settles. */
+  bool reading = output->governor.profile == EPD_PROFILE_READING;
+  enum epd_update_mode update_mode =
+    reading ? output->cleanup.mode : output->update_mode;
+  unsigned int ink_flags = 0;
+
+  unsigned int histogram[256];
+  region_histogram(output, box, histogram);
+
+  switch (epd_tone_classify(&output->tone, histogram, EPD_UPD_DU,
+                            output->cleanup.mode)) {
+  case EPD_TONE_EXACT:
+    update_mode = EPD_UPD_DU;
+    ink_flags = EPD_INK_SNAP | EPD_INK_EXACT;
+    break;
+  case EPD_TONE_BIMODAL:
+    if (!reading) {
+      update_mode = EPD_UPD_DU;
+      ink_flags = EPD_INK_SNAP;
+    }
+    break;
+  case EPD_TONE_GREY:
+    break;
+  }
+
+  epd_output_ink(output, box, update_mode, ink_flags);
+}
+
+static bool
+ink_animation(
+  struct epd_output *output,
+  pixman_box32_t * box
+)
+{
+  /* Each group of animated tiles goes out with A2. The other changed
+     tiles are inked as usual, unless they overlap a group: then they
+     go with it, rather than two waveforms fighting over them. */
+  pixman_box32_t animated[EPD_ANIMATION_MAX_GROUPS];
+  pixman_box32_t still;
+
+  int animated_count =
+    epd_animation_update(&output->animation, box, animated, &still);
+  if (animated_count == 0) {
+    return false;
+  }
+
+  for (int i = 0; i < animated_count; i++) {
+    if (still.x1 < still.x2 && box_intersects(&animated[i], &still)) {
+      animated[i] = box_union(&animated[i], &still);
+      still.x1 = still.x2 = 0;
+    }
+    epd_output_ink(output, &animated[i], EPD_UPD_A2, EPD_INK_ORDERED);
+  }
+
+  if (still.x1 < still.x2) {
+    ink_damage(output, &still);
+  }
+  return true;
+}
+
+static bool
+ink_typing(
+  struct epd_output *output,
+  pixman_box32_t * box
+)
+{
+  /* Right after a key press, the damage around the text cursor is the
+     key's echo. Ink that with DU ahead of everything else and queue
+     the rest of the damage as usual. */
+  if (!output->has_text_cursor
+      || !epd_scheduler_recent_input(&output->scheduler)) {
+    return false;
+  }
+
+  pixman_box32_t *cursor = &output->text_cursor;
+  int line = cursor->y2 - cursor->y1;
+
+  pixman_region32_t damage;
+  pixman_region32_init_rect(&damage, box->x1, box->y1, box->x2 - box->x1,
+                            box->y2 - box->y1);
+
+  pixman_region32_t typing;
+  pixman_region32_init_rect(&typing,
+                            cursor->x1 - line * TYPING_MARGIN,
+                            cursor->y1 - line / 2,
+                            cursor->x2 - cursor->x1
+                            + 2 * line * TYPING_MARGIN, 2 * line);
+  pixman_region32_intersect(&typing, &typing, &damage);
+
+  bool typed = pixman_region32_not_empty(&typing);
+  if (typed) {
+    epd_output_ink(output, pixman_region32_extents(&typing), EPD_UPD_DU,
+                   EPD_INK_SNAP | EPD_INK_URGENT);
+
+    pixman_region32_subtract(&damage, &damage, &typing);
+
+    int rects_count;
+    pixman_box32_t *rects = pixman_region32_rectangles(&damage, &rects_count);
+    for (int i = 0; i < rects_count; i++) {
+      ink_damage(output, &rects[i]);
+    }
+  }
+
+  pixman_region32_fini(&typing);
+  pixman_region32_fini(&damage);
+  return typed;
+}
+
 static bool
 output_commit(
   struct wlr_output *wlr_output
@@ -168,11 +528,18 @@ output_commit(
      implementation.
    */
 
-  struct timespec time_commit_start;
-  clock_gettime(CLOCK_REALTIME, &time_commit_start);
-
   wlr_log(WLR_INFO, "epd_commit: output_commit");
   struct epd_output *output = epd_output_from_output(wlr_output);
+  epd_stats_begin(&output->stats);
+  uint64_t time_commit_start = epd_stats_now();
+  output->frame_committed = true;
+
+  /* Damage after a quiet spell: carry on with frames from here */
+  if (output->frames_stopped) {
+    output->frames_stopped = false;
+    wl_event_source_timer_update(output->frame_timer,
+                                 epd_output_frame_delay(output));
+  }
 
   unsigned int width = epd_output_get_width(wlr_output);
   unsigned int height = epd_output_get_height(wlr_output);
@@ -194,6 +561,7 @@ output_commit(
   unsigned int dy = damage->extents.y1;
   unsigned int dwidth = damage->extents.x2 - damage->extents.x1;
   unsigned int dheight = damage->extents.y2 - damage->extents.y1;
+  PROBE4(commit_start, dx, dy, dwidth, dheight);
 
   if (dwidth == 0 || dheight == 0) {
     wlr_log(WLR_INFO, "epd_commit: no damage so finishing early");
@@ -215,8 +583,7 @@ output_commit(
 
   // Always pull in the whole buffer, to avoid the bug in
   // https://github.com/swaywm/wlroots/pull/1809
-  struct timespec time_read_pixels_start;
-  clock_gettime(CLOCK_REALTIME, &time_read_pixels_start);
+  uint64_t time_read_pixels_start = epd_stats_now();
 
   int read_pixels_success =
     wlr_renderer_read_pixels(renderer, WL_SHM_FORMAT_XRGB8888, NULL,
@@ -224,8 +591,8 @@ output_commit(
                              width, height, 0, 0, 0, 0,
                              shadow_pixels);
 
-  struct timespec time_read_pixels_end;
-  clock_gettime(CLOCK_REALTIME, &time_read_pixels_end);
+  epd_stats_add(&output->stats, EPD_STAGE_READ_PIXELS,
+                time_read_pixels_start, epd_stats_now());
 
   if (!read_pixels_success) {
     wlr_log(WLR_INFO,
@@ -234,10 +601,18 @@ output_commit(
   }
 
   /* Now transfer the damaged ARGB pixels into the greyscale buffer */
-  struct timespec time_damage_start;
-  clock_gettime(CLOCK_REALTIME, &time_damage_start);
-
-  wlr_log(WLR_INFO, "epd_commit: copying shadow pixels to epd buffer");
+  uint64_t time_damage_start = epd_stats_now();
+
+  /* Remember what the damaged area looked like, to spot scrolling */
+  pixman_box32_t damage_box = {
+    .x1 = dx,
+    .y1 = dy,
+    .x2 = dx + dwidth,
+    .y2 = dy + dheight,
+  };
+  epd_scroll_before(&output->scroll, output->target_pixels, &damage_box);
+
+  wlr_log(WLR_INFO, "epd_commit: copying shadow pixels to target buffer");
   unsigned int location;
 
   /* These help us with manual damage tracking */
@@ -245,41 +620,32 @@ output_commit(
   unsigned int dxmax = dx;
   unsigned int dymin = dy + dheight;
   unsigned int dymax = dy;
+  bool damaged = false;
+  unsigned int changed = 0;
 
-  int update_mode = EPD_UPD_DU4;
   unsigned char r, g, b;
   unsigned char new_value;
 
-  for (unsigned int x = dx; x < dx + dwidth; x++) {
-    for (unsigned int y = dy; y < dy + dheight; y++) {
+  for (unsigned int y = dy; y < dy + dheight; y++) {
+    for (unsigned int x = dx; x < dx + dwidth; x++) {
       location = x + width * y;
 
       /* Each pixel in pixman/egl buffers is 32 bits consisting of 4
-         bytes, each representing the a, r, g, b components. Extract r,
+         bytes, each representing the x, r, g, b components. Extract r,
          g, b and average to get our grayscale value.
        */
-      r = *(&shadow_pixels[location] + 1);
-      g = *(&shadow_pixels[location] + 2);
-      b = *(&shadow_pixels[location] + 3);
+      r = (shadow_pixels[location] >> 16) & 0xFF;
+      g = (shadow_pixels[location] >> 8) & 0xFF;
+      b = shadow_pixels[location] & 0xFF;
 
       new_value = (r + g + b) / 3;
 
-      // EPD_ONE_BIT_MODES
-      if (update_mode == EPD_UPD_DU || update_mode == EPD_UPD_A2) {
-        new_value = pgm_filter_one_bit_pixel(new_value);
-      }
-      // EPD_TWO_BIT_MODES
-      if (update_mode == EPD_UPD_DU4) {
-        new_value = pgm_filter_two_bit_pixel(new_value);
-      }
-      // EPD_FOUR_BIT_MODES
-      if (update_mode == EPD_UPD_GC16 || update_mode == EPD_UPD_GL16
-          || update_mode == EPD_UPD_GLR16 || update_mode == EPD_UPD_GLD16) {
-        new_value = pgm_filter_four_bit_pixel(new_value);
-      }
-
       /* Update damage tracking if this pixel is damaged */
-      if (new_value != output->epd_pixels[location]) {
+      if (new_value != output->target_pixels[location]) {
+        damaged = true;
+        changed += 1;
+        epd_animation_mark(&output->animation, x, y);
+
         if (x < dxmin)
           dxmin = x;
 
@@ -293,84 +659,292 @@ output_commit(
           dymax = y;
       }
 
-      output->epd_pixels[location] = new_value;
+      output->target_pixels[location] = new_value;
     }
   }
-  struct timespec time_damage_end;
-  clock_gettime(CLOCK_REALTIME, &time_damage_end);
-
-  /* If these values haven't changed, there is no damage: */
+  epd_stats_add(&output->stats, EPD_STAGE_CONVERT, time_damage_start,
+                epd_stats_now());
+  epd_stats_pixels(&output->stats, changed);
 
-  if (dxmin == dx + dwidth || dxmax == dx || dymin == dy + dheight
-      || dymax == dy) {
+  if (!damaged) {
     wlr_log(WLR_INFO,
             "epd_commit: calculated damage suggests no changes, no damage so finishing early");
     goto complete;
   }
 
+  /* Whatever input came before this is (partly) what changed */
+  trace_flow_commit(epd_stats_now());
+  epd_stats_input_commit(&output->stats);
+
   /* Update damage info with our new information */
-  dx = dxmin;
-  dy = dymin;
-  dwidth = dxmax - dxmin + 1;
-  dheight = dymax - dymin + 1;
+  pixman_box32_t ink_box = {
+    .x1 = dxmin,
+    .y1 = dymin,
+    .x2 = dxmax + 1,
+    .y2 = dymax + 1,
+  };
+  epd_clients_commit(&output->clients, &ink_box, changed);
 
   wlr_log(WLR_INFO,
           "epd_commit: calculated damage dx=%u, dy=%u, dwidth=%u, dheight=%u",
-          dx, dy, dwidth, dheight);
+          dxmin, dymin, dxmax - dxmin + 1, dymax - dymin + 1);
+  PROBE5(commit_changed, dxmin, dymin, dxmax - dxmin + 1, dymax - dymin + 1,
+         changed);
+
+  /* Queue the damage for inking. Parts of the screen that are
+     animating go out with A2, the rest as usual. */
+  uint64_t time_ink_start = epd_stats_now();
+
+  pixman_box32_t held_box;
+  int shift_x;
+  int shift_y;
+
+  enum epd_blink_result blink =
+    epd_blink_check(&output->blink, output->target_pixels, width, &ink_box,
+                    &held_box);
+
+  /* A caret that was held on, and is off by now */
+  if (held_box.x1 < held_box.x2) {
+    ink_damage(output, &held_box);
+  }
+
+  switch (blink) {
+  case EPD_BLINK_HOLD:
+    wlr_log(WLR_INFO, "epd_commit: holding blinking region, not inking");
+    epd_animation_discard(&output->animation);
+    goto complete;
+  case EPD_BLINK_TOGGLE:
+    epd_animation_discard(&output->animation);
+    ink_damage(output, &ink_box);
+    break;
+  case EPD_BLINK_CHANGE:
+    if (ink_typing(output, &ink_box)) {
+      epd_animation_discard(&output->animation);
+    } else if (epd_scroll_detect(&output->scroll, output->target_pixels,
+                                 &damage_box, &shift_x, &shift_y)) {
+      wlr_log(WLR_INFO, "epd_commit: scrolled by x=%i, y=%i", shift_x,
+              shift_y);
+      epd_animation_discard(&output->animation);
+      epd_output_ink(output, &ink_box, EPD_UPD_A2, EPD_INK_ORDERED);
+      epd_scroll_track(&output->scroll, &ink_box);
+    } else if (!ink_animation(output, &ink_box)) {
+      ink_damage(output, &ink_box);
+    }
+    break;
+  }
 
-  /* Send pixels, then display on the epd */
-  wlr_log(WLR_INFO, "epd_commit: sending update to display");
-  struct timespec time_send_pixels_start;
-  clock_gettime(CLOCK_REALTIME, &time_send_pixels_start);
-  epd_fast_copy_image_bytes(&output->epd, output->epd_pixels, dx + dy * width,
-                            (dx + dwidth) + (dy + dheight) * width);
-  struct timespec time_display_start;
-  clock_gettime(CLOCK_REALTIME, &time_display_start);
-  epd_display_area(&output->epd, dx, dy, dwidth, dheight, update_mode, 1);
-  struct timespec time_display_end;
-  clock_gettime(CLOCK_REALTIME, &time_display_end);
-  wlr_log(WLR_INFO, "epd_commit: display update sent");
-
-  wlr_log(WLR_INFO, "epd_commit: timing report");
-
-  /* Timing report */
-  struct timespec time_commit;
-  timespec_diff(&time_commit_start, &time_display_end, &time_commit);
-  wlr_log(WLR_INFO, "epd_commit: time_commit = %llis %llims",
-          (long long) time_commit.tv_sec, time_commit.tv_nsec / 1000000);
-
-  struct timespec time_read_pixels;
-  timespec_diff(&time_read_pixels_start, &time_read_pixels_end,
-                &time_read_pixels);
-  wlr_log(WLR_INFO, "epd_commit: time_read_pixels = %llis %llims",
-          (long long) time_read_pixels.tv_sec,
-          time_read_pixels.tv_nsec / 1000000);
-
-  struct timespec time_damage;
-  timespec_diff(&time_damage_start, &time_damage_end, &time_damage);
-  wlr_log(WLR_INFO, "epd_commit: time_damage = %llis %llims",
-          (long long) time_damage.tv_sec, time_damage.tv_nsec / 1000000);
-
-  struct timespec time_send_pixels;
-  timespec_diff(&time_send_pixels_start, &time_display_start,
-                &time_send_pixels);
-  wlr_log(WLR_INFO, "epd_commit: time_send_pixels = %llis %llims",
-          (long long) time_send_pixels.tv_sec,
-          time_send_pixels.tv_nsec / 1000000);
-
-  struct timespec time_display;
-  timespec_diff(&time_display_start, &time_display_end, &time_display);
-  wlr_log(WLR_INFO, "epd_commit: time_display = %llis %llims",
-          (long long) time_display.tv_sec, time_display.tv_nsec / 1000000);
+  epd_stats_add(&output->stats, EPD_STAGE_QUEUE, time_ink_start,
+                epd_stats_now());
 
   goto complete;
 
 complete:
   wlr_log(WLR_INFO, "epd_commit: commit complete - success");
-  wlr_output_send_present(wlr_output, NULL);
+  /* Whatever damage hasn't been put down to a change by now changed
+     nothing */
+  epd_clients_commit(&output->clients, NULL, 0);
+  if (epd_stats_commit(&output->stats)) {
+    epd_clients_report(&output->clients);
+  }
+  PROBE1(commit_done, epd_stats_now() - time_commit_start);
+  trace_slice(TRACE_COMPOSITOR, "commit", time_commit_start, epd_stats_now(),
+              NULL);
+
+  /* The frame isn't on the panel yet: it's presented once everything
+     inked for it has gone out and its waveforms have run. */
+  clock_gettime(CLOCK_MONOTONIC, &output->present_commit);
+  output->present_pending = true;
+  epd_output_check_present(output);
   return true;
 }
 
+static int
+handle_present_timer(
+  void *data
+)
+{
+  struct epd_output *output = data;
+
+  if (!output->present_pending) {
+    return 0;
+  }
+
+  /* Still sending: the scheduler checks back after each band */
+  struct timespec when;
+  if (!epd_scheduler_settled(&output->scheduler, &when)) {
+    return 0;
+  }
+
+  /* Nothing inked since the commit: it changed nothing on the panel */
+  if (timespec_diff_ms(&when, &output->present_commit) > 0) {
+    when = output->present_commit;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long long left = timespec_diff_ms(&now, &when);
+  if (left > 0) {
+    wl_event_source_timer_update(output->present_timer, (int) left);
+    return 0;
+  }
+
+  /* The waveform times are measured, but the completion itself is
+     estimated, so no HW_COMPLETION. The rate varies: refresh 0. */
+  struct wlr_output_event_present event = {
+    .output = &output->wlr_output,
+    .when = &when,
+    .seq = ++output->present_seq,
+    .refresh = 0,
+    .flags = 0,
+  };
+
+  output->present_pending = false;
+  epd_stats_input_shown(&output->stats,
+                        (uint64_t) when.tv_sec * 1000000000 + when.tv_nsec);
+  wlr_output_send_present(&output->wlr_output, &event);
+  trace_instant(TRACE_PANEL, "present", "\"seq\": %u", event.seq);
+  return 0;
+}
+
+void
+epd_output_check_present(
+  struct epd_output *output
+)
+{
+  if (output->present_pending && output->present_timer) {
+    wl_event_source_timer_update(output->present_timer, 1);
+  }
+}
+
+bool
+epd_output_client_waiting(
+  struct epd_output *output,
+  const void *view
+)
+{
+  pixman_region32_t *pending =
+    epd_clients_pending(&output->clients, view);
+  if (pending == NULL) {
+    return false;
+  }
+
+  int rects_count;
+  pixman_box32_t *rects = pixman_region32_rectangles(pending, &rects_count);
+  for (int i = 0; i < rects_count; i++) {
+    if (epd_scheduler_queued(&output->scheduler, &rects[i])) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+epd_output_notify_input(
+  struct epd_output *output,
+  pixman_box32_t * hint
+)
+{
+  epd_blink_release(&output->blink);
+  epd_scheduler_input(&output->scheduler, hint);
+  epd_output_set_idle(output, false);
+}
+
+void
+epd_output_set_idle(
+  struct epd_output *output,
+  bool idle
+)
+{
+  enum epd_governor_profile profile =
+    idle ? EPD_PROFILE_READING : EPD_PROFILE_INTERACTIVE;
+
+  /* Any input at all after a while (wlr_idle sees pointer motion
+     too): get the PMIC going while the client draws its response */
+  if (!idle) {
+    epd_idle_wake(&output->idle);
+  }
+
+  if (output->governor.profile == profile) {
+    return;
+  }
+  epd_governor_set_profile(&output->governor, profile);
+
+  /* Don't sit out the rest of a slow reading frame */
+  if (!idle && output->frame_timer) {
+    wl_event_source_timer_update(output->frame_timer,
+                                 epd_output_frame_delay(output));
+  }
+}
+
+void
+epd_output_client_commit(
+  struct epd_output *output,
+  struct wl_client *client,
+  pixman_box32_t * box
+)
+{
+  epd_debounce_commit(&output->debounce, client, box);
+}
+
+void
+epd_output_client_damage(
+  struct epd_output *output,
+  const void *view,
+  const char *app_id,
+  const char *title,
+  pid_t pid,
+  pixman_region32_t * damage
+)
+{
+  epd_clients_damage(&output->clients, view, app_id, title, pid, damage);
+}
+
+void
+epd_output_client_gone(
+  struct epd_output *output,
+  const void *view
+)
+{
+  epd_clients_forget(&output->clients, view);
+}
+
+void
+epd_output_set_text_cursor(
+  struct epd_output *output,
+  pixman_box32_t * cursor
+)
+{
+  output->has_text_cursor = cursor != NULL;
+  if (cursor) {
+    output->text_cursor = *cursor;
+  }
+}
+
+static int
+handle_tone_reload(
+  int signal,
+  void *data
+)
+{
+  /* Re-read the tone curves and redraw everything with them, so the
+     effect of a calibration change is visible straight away. */
+  struct epd_output *output = data;
+
+  epd_tone_load(&output->tone);
+
+  pixman_box32_t whole = {
+    .x1 = 0,
+    .y1 = 0,
+    .x2 = epd_output_get_width(&output->wlr_output),
+    .y2 = epd_output_get_height(&output->wlr_output),
+  };
+  epd_output_ink(output, &whole, output->cleanup.mode, EPD_INK_BACKGROUND);
+
+  return 0;
+}
+
 static void
 output_destroy(
   struct wlr_output *wlr_output
@@ -378,22 +952,57 @@ output_destroy(
 {
   struct epd_output *output = epd_output_from_output(wlr_output);
 
+  epd_stats_report(&output->stats);
+  if (output->stats.interval > 0) {
+    epd_clients_report(&output->clients);
+  }
+  epd_export_finish(&output->export);
+  epd_clients_finish(&output->clients);
+
+  epd_cleanup_finish(&output->cleanup);
+  epd_idle_finish(&output->idle);
+  epd_animation_finish(&output->animation);
+  epd_scroll_finish(&output->scroll);
+  epd_cursor_finish(&output->cursor);
+  epd_wet_ink_finish(&output->wet_ink);
+  epd_scheduler_finish(&output->scheduler);
+  wl_event_source_remove(output->tone_reload);
+
   free(output->epd_pixels);
+  free(output->target_pixels);
+  dither_finish();
   epd_reset(&output->epd);
   epd_pmic_off(&output->epd);
-  close(output->epd.fd);
+  epd_finish(&output->epd);
 
   wl_list_remove(&output->link);
 
   wl_event_source_remove(output->frame_timer);
+  wl_event_source_remove(output->present_timer);
 
   pixman_image_unref(&output->shadow_surface);
 
   wlr_egl_destroy_surface(&output->backend->egl, output->egl_surface);
+  wlr_egl_destroy_surface(&output->backend->egl, output->cursor_surface);
 
   free(output);
 }
 
+int
+epd_output_frame_delay(
+  struct epd_output *output
+)
+{
+  /* Keep up with anything that is animating or scrolling; otherwise
+     go by the mode, or failing that by the governor's profile. */
+  int target = output->frame_delay;
+
+  if (epd_animation_active(&output->animation) || output->scroll.scrolling) {
+    target = output->animation.frame_delay;
+  }
+  return epd_governor_frame_delay(&output->governor, target);
+}
+
 static int
 signal_frame(
   void *data
@@ -401,18 +1010,120 @@ signal_frame(
 {
   /*
      This function schedules: the output should update its frames
-     every output->frame_delay <units> (I don't know what units it is
-     in).
+     every epd_output_frame_delay ms.
    */
   wlr_log(WLR_INFO, "epd_output: signal_frame");
   struct epd_output *output = data;
+  uint64_t time_frame_start = epd_stats_now();
+
+  output->frame_committed = false;
+  PROBE0(frame_start);
   wlr_output_send_frame(&output->wlr_output);
-  wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+  PROBE1(frame_done, output->frame_committed);
+  trace_slice(TRACE_COMPOSITOR, "frame", time_frame_start, epd_stats_now(),
+              "\"committed\": %s", output->frame_committed ? "true" : "false");
+
+  /* Nothing was drawn: stop until there is. New damage gets one frame
+     out of wlroots by itself, but wlroots then waits for us to send
+     the next, so output_commit starts the timer again. */
+  if (!output->frame_committed
+      && !epd_animation_active(&output->animation)
+      && !output->scroll.scrolling) {
+    wlr_log(WLR_INFO, "epd_output: idle, frames stopped");
+    output->frames_stopped = true;
+    return 0;
+  }
+
+  output->frames_stopped = false;
+
+  wl_event_source_timer_update(output->frame_timer,
+                               epd_output_frame_delay(output));
   return 0;
 }
 
+static bool
+output_set_cursor(
+  struct wlr_output *wlr_output,
+  struct wlr_texture *texture,
+  int32_t scale,
+  enum wl_output_transform transform,
+  int32_t hotspot_x,
+  int32_t hotspot_y,
+  bool update_texture
+)
+{
+  /* Returning false leaves the cursor to wlroots, which draws it into
+     every frame in software */
+  struct epd_output *output = epd_output_from_output(wlr_output);
+  struct epd_backend *backend = output->backend;
+
+  if (output->cursor.interval <= 0 || output->cursor_surface == EGL_NO_SURFACE
+      || transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+    return false;
+  }
+
+  if (!update_texture) {
+    epd_cursor_set_hotspot(&output->cursor, hotspot_x, hotspot_y);
+    return true;
+  }
+
+  if (texture == NULL) {
+    epd_cursor_hide(&output->cursor);
+    return true;
+  }
+
+  int width, height;
+  wlr_texture_get_size(texture, &width, &height);
+  if (width > EPD_CURSOR_MAX_SIZE || height > EPD_CURSOR_MAX_SIZE) {
+    return false;
+  }
+
+  /* Draw the sprite on its own surface and read it back. The next
+     frame makes the output's surface current again. */
+  if (!wlr_egl_make_current(&backend->egl, output->cursor_surface, NULL)) {
+    return false;
+  }
+
+  float projection[9];
+  wlr_matrix_projection(projection, width, height,
+                        WL_OUTPUT_TRANSFORM_NORMAL);
+
+  wlr_renderer_begin(backend->renderer, width, height);
+  wlr_renderer_clear(backend->renderer, (float[]) { 0.0, 0.0, 0.0, 0.0 });
+  wlr_render_texture(backend->renderer, texture, projection, 0, 0, 1.0);
+
+  uint32_t pixels[EPD_CURSOR_MAX_SIZE * EPD_CURSOR_MAX_SIZE];
+  bool read_pixels_success =
+    wlr_renderer_read_pixels(backend->renderer, WL_SHM_FORMAT_ARGB8888, NULL,
+                             width * 4, width, height, 0, 0, 0, 0, pixels);
+  wlr_renderer_end(backend->renderer);
+
+  if (!read_pixels_success) {
+    wlr_log(WLR_ERROR, "epd_cursor: could not read back the cursor image");
+    return false;
+  }
+
+  epd_cursor_set_image(&output->cursor, pixels, width, height, hotspot_x,
+                       hotspot_y);
+  return true;
+}
+
+static bool
+output_move_cursor(
+  struct wlr_output *wlr_output,
+  int x,
+  int y
+)
+{
+  struct epd_output *output = epd_output_from_output(wlr_output);
+  epd_cursor_move(&output->cursor, x, y);
+  return true;
+}
+
 static const struct wlr_output_impl output_impl = {
   .set_custom_mode = output_set_custom_mode,
+  .set_cursor = output_set_cursor,
+  .move_cursor = output_move_cursor,
   .destroy = output_destroy,
   .attach_render = output_attach_render,
   .commit = output_commit,
@@ -477,6 +1188,7 @@ epd_backend_add_output(
 
   wlr_output_init(&output->wlr_output, &backend->backend, &output_impl,
                   backend->display);
+  wl_signal_init(&output->events.sent);
   struct wlr_output *wlr_output = &output->wlr_output;
 
   /* Initialise the epd and steal its config info */
@@ -490,10 +1202,32 @@ epd_backend_add_output(
   wlr_log(WLR_INFO, "Clear the epd display");
   epd_reset(&output->epd);
 
+  epd_governor_init(&output->governor);
+  epd_stats_init(&output->stats);
+  epd_clients_init(&output->clients);
+
+  struct wl_event_loop *ev = wl_display_get_event_loop(backend->display);
+  epd_animation_init(&output->animation, output, ev);
+  epd_blink_init(&output->blink);
+  epd_scroll_init(&output->scroll, output, ev);
+  epd_cursor_init(&output->cursor, output, ev);
+  epd_wet_ink_init(&output->wet_ink, output, ev);
+  epd_idle_init(&output->idle, output, ev);
+  epd_scheduler_init(&output->scheduler, output, ev);
+  epd_debounce_init(&output->debounce);
+  epd_export_init(&output->export, output, ev);
+
   /* This sets up all our buffers as needed by the video mode */
   wlr_log(WLR_INFO, "Set custom mode");
   output_set_custom_mode(wlr_output, width, height, 0);
 
+  /* Measure the waveforms while the panel is blank and ours alone.
+     epd_pixels is still all white. */
+  if (env_get_int("EPD_WM_CALIBRATE", 0)) {
+    epd_governor_calibrate(&output->governor, &output->epd,
+                           output->epd_pixels);
+  }
+
   /* Metadata */
   strncpy(wlr_output->make, "epd-todo", sizeof(wlr_output->make));
   strncpy(wlr_output->model, "epd-todo", sizeof(wlr_output->model));
@@ -512,21 +1246,50 @@ epd_backend_add_output(
   wlr_renderer_clear(backend->renderer, (float[]) { 1.0, 1.0, 1.0, 1.0 });
   wlr_renderer_end(backend->renderer);
 
+  /* A little surface to read cursor sprites back from */
+  output->cursor_surface = egl_create_surface(&backend->egl,
+                                              EPD_CURSOR_MAX_SIZE,
+                                              EPD_CURSOR_MAX_SIZE);
+
   /* Here we add an item to the wayland event loop: our signal_frame
-     function will be run every output->frame_delay (which is actually
-     EPD_BACKEND_DEFAULT_REFRESH).
+     function will be run every epd_output_frame_delay ms.
    */
 
-  wlr_log(WLR_INFO,
-          "Hook up timer to send frames at EPD_BACKEND_DEFAULT_REFRESH");
-  struct wl_event_loop *ev = wl_display_get_event_loop(backend->display);
+  wlr_log(WLR_INFO, "Hook up timer to send frames");
   output->frame_timer = wl_event_loop_add_timer(ev, signal_frame, output);
+  output->present_timer =
+    wl_event_loop_add_timer(ev, handle_present_timer, output);
+
+  /* Two-phase refresh: with a quality pass to follow, the first ink
+     can use the fastest waveform we have. Without one, stick to DU4
+     as a compromise between speed and the number of grey levels. */
+  epd_cleanup_init(&output->cleanup, output, ev);
+  output->update_mode = output->cleanup.delay > 0 ? EPD_UPD_DU : EPD_UPD_DU4;
+
+  const char *update_mode = getenv("EPD_WM_UPDATE_MODE");
+  if (update_mode != NULL) {
+    int mode = epd_update_mode_from_string(update_mode);
+
+    if (mode < 0) {
+      wlr_log(WLR_ERROR, "Ignoring EPD_WM_UPDATE_MODE: unknown mode '%s'",
+              update_mode);
+    } else {
+      output->update_mode = mode;
+    }
+  }
+
+  load_dither_config(output);
+
+  epd_tone_init(&output->tone, getenv("EPD_WM_TONE_FILE"));
+  output->tone_reload =
+    wl_event_loop_add_signal(ev, SIGHUP, handle_tone_reload, output);
 
   wl_list_insert(&backend->outputs, &output->link);
 
   /* Start up */
   if (backend->started) {
-    wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+    wl_event_source_timer_update(output->frame_timer,
+                                 epd_output_frame_delay(output));
     wlr_output_update_enabled(wlr_output, true);
     wlr_signal_emit_safe(&backend->backend.events.new_output, wlr_output);
   }
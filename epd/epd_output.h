@@ -4,8 +4,24 @@
 #include <pixman.h>
 #include <wlr/backend/interface.h>
 
+#include <epd/epd_animation.h>
 #include <epd/epd_backend.h>
+#include <epd/epd_blink.h>
+#include <epd/epd_cleanup.h>
+#include <epd/epd_clients.h>
+#include <epd/epd_cursor.h>
+#include <epd/epd_debounce.h>
 #include <epd/epd_driver.h>
+#include <epd/epd_export.h>
+#include <epd/epd_governor.h>
+#include <epd/epd_idle.h>
+#include <epd/epd_scheduler.h>
+#include <epd/epd_scroll.h>
+#include <epd/epd_stats.h>
+#include <epd/epd_tone.h>
+#include <epd/epd_wet_ink.h>
+
+#include <utils/dither.h>
 
 struct epd_output
 {
@@ -15,7 +31,20 @@ struct epd_output
   struct wl_list link;
 
   struct wl_event_source *frame_timer;
-  int frame_delay;              // ms
+  int frame_delay;              // ms, from the mode; 0 = governor's choice
+  bool frame_committed;         // since the last frame was sent
+  bool frames_stopped;          // frame_timer not armed, see signal_frame
+
+  // The last commit is presented once its waveforms have run
+  struct wl_event_source *present_timer;
+  bool present_pending;
+  struct timespec present_commit;       // CLOCK_MONOTONIC
+  unsigned int present_seq;
+
+  struct
+  {
+    struct wl_signal sent;      // a band went out, see client_waiting
+  } events;
 
   // Represents actual, physical display device.
   epd epd;
@@ -32,6 +61,67 @@ struct epd_output
   // from shadow_surface. These are the raw bytes sent to the epd.
   // In grayscale, one byte per pixel.
   unsigned char *epd_pixels;
+
+  // The unquantised grayscale value of every pixel in the last frame
+  // we looked at. Damage is worked out against this rather than
+  // epd_pixels, since the same content is quantised differently
+  // depending on which waveform last inked it.
+  unsigned char *target_pixels;
+
+  // Waveform used when damage is first inked. With the two-phase
+  // policy enabled this is a fast one, and `cleanup` follows up with a
+  // quality pass.
+  enum epd_update_mode update_mode;
+  struct epd_cleanup cleanup;
+
+  // Finds parts of the screen that keep changing and inks them with A2
+  struct epd_animation animation;
+
+  // Holds a blinking caret on instead of inking every blink
+  struct epd_blink blink;
+
+  // Inks scrolling content with A2 until it settles
+  struct epd_scroll scroll;
+
+  // Everything inked goes through here, see epd_output_ink
+  struct epd_scheduler scheduler;
+
+  // Learns each client's commit cadence, to hold back slow updates
+  struct epd_debounce debounce;
+
+  // Picks the frame rate, see epd_output_frame_delay
+  struct epd_governor governor;
+
+  // Time spent in each stage, reported every so many commits
+  struct epd_stats stats;
+
+  // What each window has cost, reported along with stats
+  struct epd_clients clients;
+
+  // Serves stats over EPD_WM_METRICS_SOCKET
+  struct epd_export export;
+
+  // Powers the PMIC down when nothing is being inked
+  struct epd_idle idle;
+
+  // The pointer, inked separately from frames
+  struct epd_cursor cursor;
+  void *cursor_surface;         // for reading sprites back
+
+  // Pen and touch strokes, inked ahead of the client
+  struct epd_wet_ink wet_ink;
+
+  // The focused client's text cursor, from text-input-v3
+  bool has_text_cursor;
+  pixman_box32_t text_cursor;
+
+  // How target_pixels are quantised for each waveform, indexed by
+  // epd_update_mode. See utils/dither.h.
+  enum dither_method dither[EPD_UPD_COUNT];
+
+  // Per waveform tone curves, reloaded on SIGHUP
+  struct epd_tone tone;
+  struct wl_event_source *tone_reload;
 };
 
 bool output_is_epd(
@@ -51,6 +141,102 @@ unsigned int epd_output_get_height(
   struct wlr_output *wlr_output
 );
 
+// Flags for epd_output_ink
+enum epd_ink_flags
+{
+  // Quantise with the plain level table, never dither
+  EPD_INK_SNAP = 1 << 0,
+  // The waveform reproduces the content exactly, no quality pass needed
+  EPD_INK_EXACT = 1 << 1,
+  // Use an ordered dither, so a moving image doesn't crawl
+  EPD_INK_ORDERED = 1 << 2,
+  // Nobody is waiting for it (quality passes, redraws)
+  EPD_INK_BACKGROUND = 1 << 3,
+  // Ahead of everything else (typing)
+  EPD_INK_URGENT = 1 << 4,
+};
+
+// Queue box to be inked from target_pixels with update_mode. It is sent
+// by the scheduler, possibly in bands and behind more urgent work.
+void epd_output_ink(
+  struct epd_output *output,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode,
+  unsigned int flags
+);
+
+// Quantise, send and display box straight away. For the scheduler.
+int epd_output_ink_now(
+  struct epd_output *output,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode,
+  unsigned int flags
+);
+
+// Called on user input (key presses, clicks, touches). hint is where
+// on the screen it happened, if that's known.
+void epd_output_notify_input(
+  struct epd_output *output,
+  pixman_box32_t * hint
+);
+
+// A client committed new content, covering box (in buffer coordinates)
+void epd_output_client_commit(
+  struct epd_output *output,
+  struct wl_client *client,
+  pixman_box32_t * box
+);
+
+// The window identified by view damaged the output (in buffer
+// coordinates), for epd_clients
+void epd_output_client_damage(
+  struct epd_output *output,
+  const void *view,
+  const char *app_id,
+  const char *title,
+  pid_t pid,
+  pixman_region32_t * damage
+);
+
+// The window identified by view has closed
+void epd_output_client_gone(
+  struct epd_output *output,
+  const void *view
+);
+
+// The user has gone idle (or come back). Switches the governor between
+// its reading and interactive profiles.
+void epd_output_set_idle(
+  struct epd_output *output,
+  bool idle
+);
+
+// ms until the next frame should be sent
+int epd_output_frame_delay(
+  struct epd_output *output
+);
+
+// Send the pending present event if its inks have finished. The
+// scheduler calls this after each band.
+void epd_output_check_present(
+  struct epd_output *output
+);
+
+// Whether what the window identified by view last drew is still queued
+// to be sent. Until it has gone, anything more it drew would only be
+// merged or thrown away, so it shouldn't be asked for another frame.
+// events.sent is emitted each time some of the queue goes.
+bool epd_output_client_waiting(
+  struct epd_output *output,
+  const void *view
+);
+
+// Where the focused client's text cursor is, or NULL if unknown
+void epd_output_set_text_cursor(
+  struct epd_output *output,
+  pixman_box32_t * cursor
+);
+
 struct wlr_output *epd_backend_add_output(
   struct wlr_backend *wlr_backend,
   char epd_path[],
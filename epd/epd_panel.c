@@ -0,0 +1,385 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_panel.h>
+
+#include <utils/env.h>
+#include <utils/pgm.h>
+#include <utils/time.h>
+
+
+/* Panel simulator
+
+   The emulator's image buffer says what the controller was asked to
+   show, which is not what a reader would see. This models the part in
+   between, roughly:
+
+   - Each mode's waveform runs for its frame count (as GET_SYS reports
+     them) times `frame_time`. An update holds one of the controller's
+     `luts_count` LUT engines for that long, and cannot start while an
+     update overlapping it is still being driven.
+
+   - The panel is a level per pixel plus a residual on top: the ghost.
+     Driving a pixel keeps part of its old residual and leaves part of
+     the step it just made behind as new residual. GC16 and RESET leave
+     nothing; A2 leaves the most.
+
+   - 16 level modes drive every pixel of the area. DU, DU4 and A2 only
+     drive pixels whose level changes, so they never clear a ghost on
+     pixels they leave alone.
+
+   The numbers in GHOST_KEEP and GHOST_LEAK are not measured, they only
+   order the modes the way they look on a real panel. What the model
+   is for is comparing policies against each other: how much ghost a
+   run leaves, and how long updates wait for their turn.
+
+   Changes are applied when the update is issued, and frames written to
+   `pgm_dir` show the panel once every issued update has completed.
+ */
+
+
+static const unsigned int DEFAULT_FRAME_COUNTS[EPD_UPD_COUNT] = {
+  [EPD_UPD_RESET] = 200,
+  [EPD_UPD_DU] = 26,
+  [EPD_UPD_GC16] = 45,
+  [EPD_UPD_GL16] = 45,
+  [EPD_UPD_GLR16] = 45,
+  [EPD_UPD_GLD16] = 45,
+  [EPD_UPD_A2] = 12,
+  [EPD_UPD_DU4] = 29,
+};
+
+// Share of the old residual a driven pixel keeps
+static const float GHOST_KEEP[EPD_UPD_COUNT] = {
+  [EPD_UPD_RESET] = 0.0f,
+  [EPD_UPD_DU] = 0.8f,
+  [EPD_UPD_GC16] = 0.0f,
+  [EPD_UPD_GL16] = 0.5f,
+  [EPD_UPD_GLR16] = 0.3f,
+  [EPD_UPD_GLD16] = 0.3f,
+  [EPD_UPD_A2] = 1.0f,
+  [EPD_UPD_DU4] = 0.7f,
+};
+
+// Share of a pixel's step left behind as residual
+static const float GHOST_LEAK[EPD_UPD_COUNT] = {
+  [EPD_UPD_RESET] = 0.0f,
+  [EPD_UPD_DU] = 0.06f,
+  [EPD_UPD_GC16] = 0.0f,
+  [EPD_UPD_GL16] = 0.02f,
+  [EPD_UPD_GLR16] = 0.01f,
+  [EPD_UPD_GLD16] = 0.01f,
+  [EPD_UPD_A2] = 0.12f,
+  [EPD_UPD_DU4] = 0.04f,
+};
+
+
+static bool
+later(
+  struct timespec *a,
+  struct timespec *b
+)
+{
+  return a->tv_sec > b->tv_sec
+    || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+static bool
+overlaps(
+  struct epd_panel_update *update,
+  unsigned int x,
+  unsigned int y,
+  unsigned int width,
+  unsigned int height
+)
+{
+  return update->x < x + width && x < update->x + update->width
+    && update->y < y + height && y < update->y + update->height;
+}
+
+static unsigned char
+quantise(
+  unsigned char value,
+  unsigned int levels
+)
+{
+  /* The image buffer holds levels out of 240 (see EPD_*_LEVELS),
+     the panel is modelled out of 255 */
+  unsigned int level = value * levels / 256;
+  return level * 255 / (levels - 1);
+}
+
+static unsigned char
+shown(
+  struct epd_panel *panel,
+  unsigned int i
+)
+{
+  float value = panel->base[i] + panel->residual[i];
+  return value < 0 ? 0 : value > 255 ? 255 : (unsigned char) lroundf(value);
+}
+
+static struct epd_panel_update *
+take_lut(
+  struct epd_panel *panel,
+  unsigned int x,
+  unsigned int y,
+  unsigned int width,
+  unsigned int height,
+  struct timespec *now,
+  struct timespec *start
+)
+{
+  *start = *now;
+
+  /* Whatever overlaps has to finish first */
+  for (int i = 0; i < panel->luts_count; i++) {
+    struct epd_panel_update *update = &panel->luts[i];
+
+    if (update->active && !later(&update->end, now)) {
+      update->active = false;
+    }
+    if (update->active && overlaps(update, x, y, width, height)
+        && later(&update->end, start)) {
+      *start = update->end;
+    }
+  }
+
+  /* Then wait for a LUT, if they're all taken by then */
+  struct epd_panel_update *earliest = NULL;
+  for (int i = 0; i < panel->luts_count; i++) {
+    struct epd_panel_update *update = &panel->luts[i];
+
+    if (!update->active || !later(&update->end, start)) {
+      return update;
+    }
+    if (earliest == NULL || later(&earliest->end, &update->end)) {
+      earliest = update;
+    }
+  }
+
+  *start = earliest->end;
+  return earliest;
+}
+
+static void
+drive(
+  struct epd_panel *panel,
+  const unsigned char *image,
+  unsigned int x,
+  unsigned int y,
+  unsigned int width,
+  unsigned int height,
+  enum epd_update_mode mode
+)
+{
+  unsigned int levels = epd_update_mode_levels(mode);
+  bool whole_area = levels == 16;
+
+  for (unsigned int row = y; row < y + height; row++) {
+    for (unsigned int column = x; column < x + width; column++) {
+      unsigned int i = row * panel->width + column;
+      unsigned char target =
+        mode == EPD_UPD_RESET ? 255 : quantise(image[i], levels);
+
+      if (!whole_area && target == panel->base[i]) {
+        continue;
+      }
+
+      panel->residual[i] = panel->residual[i] * GHOST_KEEP[mode]
+        + GHOST_LEAK[mode] * ((int) panel->base[i] - target);
+      panel->base[i] = target;
+    }
+  }
+}
+
+static void
+save_frame(
+  struct epd_panel *panel
+)
+{
+  unsigned int size = panel->width * panel->height;
+  unsigned char *pixels = malloc(size);
+  if (pixels == NULL) {
+    return;
+  }
+
+  for (unsigned int i = 0; i < size; i++) {
+    pixels[i] = shown(panel, i);
+  }
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/frame-%06u.pgm", panel->pgm_dir,
+           panel->frames_saved);
+
+  pgm frame = {
+    .width = panel->width,
+    .height = panel->height,
+    .bytes_per_pixel = 1,
+    .pixels = pixels,
+  };
+
+  if (pgm_save(&frame, path) < 0) {
+    wlr_log(WLR_ERROR, "epd_panel: could not write %s, not saving frames",
+            path);
+    panel->pgm_dir = NULL;
+  } else {
+    panel->frames_saved += 1;
+  }
+
+  free(pixels);
+}
+
+void
+epd_panel_display(
+  struct epd_panel *panel,
+  const unsigned char *image,
+  unsigned int x,
+  unsigned int y,
+  unsigned int width,
+  unsigned int height,
+  enum epd_update_mode mode,
+  struct timespec *start,
+  struct timespec *end
+)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  struct epd_panel_update *lut =
+    take_lut(panel, x, y, width, height, &now, start);
+
+  *end = *start;
+  timespec_add_ms(end, (long long) panel->frame_counts[mode]
+                  * panel->frame_time);
+
+  lut->active = true;
+  lut->x = x;
+  lut->y = y;
+  lut->width = width;
+  lut->height = height;
+  lut->mode = mode;
+  lut->start = *start;
+  lut->end = *end;
+
+  drive(panel, image, x, y, width, height, mode);
+
+  long long latency = timespec_diff_ms(&now, end);
+  panel->updates[mode] += 1;
+  panel->latency_total += latency;
+  panel->queued_total += timespec_diff_ms(&now, start);
+  if (latency > panel->latency_max) {
+    panel->latency_max = latency;
+  }
+
+  if (panel->pgm_dir != NULL) {
+    save_frame(panel);
+  }
+}
+
+void
+epd_panel_report(
+  struct epd_panel *panel
+)
+{
+  unsigned long long updates = 0;
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    if (panel->updates[mode] > 0) {
+      wlr_log(WLR_INFO, "epd_panel: %llu %s updates", panel->updates[mode],
+              epd_update_mode_to_string(mode));
+    }
+    updates += panel->updates[mode];
+  }
+
+  unsigned int size = panel->width * panel->height;
+  double ghost_total = 0;
+  unsigned int ghosted = 0;
+  for (unsigned int i = 0; i < size; i++) {
+    float ghost = fabsf(panel->residual[i]);
+    ghost_total += ghost;
+    ghosted += ghost >= EPD_PANEL_GHOST_VISIBLE;
+  }
+
+  wlr_log(WLR_INFO,
+          "epd_panel: latency %.0f ms mean, %.0f ms max, %.0f ms queued; "
+          "ghost %.2f mean, %.2f%% of pixels visible",
+          updates ? panel->latency_total / updates : 0,
+          panel->latency_max,
+          updates ? panel->queued_total / updates : 0,
+          size ? ghost_total / size : 0,
+          size ? 100.0 * ghosted / size : 0);
+}
+
+int
+epd_panel_init(
+  struct epd_panel *panel,
+  unsigned int width,
+  unsigned int height
+)
+{
+  memset(panel, 0, sizeof(struct epd_panel));
+
+  panel->width = width;
+  panel->height = height;
+  panel->frame_time = env_get_int("EPD_WM_EMULATOR_FRAME_TIME",
+                                  EPD_PANEL_DEFAULT_FRAME_TIME);
+  panel->luts_count = env_get_int("EPD_WM_EMULATOR_LUTS",
+                                  EPD_PANEL_DEFAULT_LUTS);
+  panel->pgm_dir = getenv("EPD_WM_EMULATOR_PGM_DIR");
+  memcpy(panel->frame_counts, DEFAULT_FRAME_COUNTS,
+         sizeof(DEFAULT_FRAME_COUNTS));
+
+  if (panel->frame_time < 0) {
+    panel->frame_time = 0;
+  }
+  if (panel->luts_count < 1) {
+    panel->luts_count = 1;
+  }
+  if (panel->luts_count > EPD_PANEL_MAX_LUTS) {
+    panel->luts_count = EPD_PANEL_MAX_LUTS;
+  }
+  if (panel->pgm_dir != NULL && panel->pgm_dir[0] == '\0') {
+    panel->pgm_dir = NULL;
+  }
+
+  panel->base = malloc(width * height);
+  panel->residual = calloc(width * height, sizeof(float));
+  if (panel->base == NULL || panel->residual == NULL) {
+    epd_panel_finish(panel);
+    return -1;
+  }
+  memset(panel->base, 255, width * height);
+
+  wlr_log(WLR_INFO, "epd_panel: %i ms frames, %i LUTs%s%s",
+          panel->frame_time, panel->luts_count,
+          panel->pgm_dir ? ", saving frames to " : "",
+          panel->pgm_dir ? panel->pgm_dir : "");
+  return 0;
+}
+
+void
+epd_panel_finish(
+  struct epd_panel *panel
+)
+{
+  free(panel->base);
+  free(panel->residual);
+  panel->base = NULL;
+  panel->residual = NULL;
+}
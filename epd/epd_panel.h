@@ -0,0 +1,78 @@
+#ifndef EPD_PANEL_H
+#define EPD_PANEL_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#include <epd/epd_driver.h>
+
+#define EPD_PANEL_DEFAULT_FRAME_TIME 10 // ms per waveform frame
+#define EPD_PANEL_DEFAULT_LUTS 16
+#define EPD_PANEL_MAX_LUTS 64
+#define EPD_PANEL_GHOST_VISIBLE 8       // residual, in grey levels of 255
+
+// One update being driven by a LUT engine
+struct epd_panel_update
+{
+  bool active;
+  unsigned int x, y, width, height;
+  enum epd_update_mode mode;
+  struct timespec start, end;
+};
+
+// What the panel physically shows, as opposed to what the controller's
+// image buffer holds: waveforms take time, only so many run at once,
+// and each leaves a little of the previous image behind.
+struct epd_panel
+{
+  unsigned int width, height;
+
+  int frame_time;               // ms per waveform frame
+  unsigned int frame_counts[EPD_UPD_COUNT];
+
+  int luts_count;
+  struct epd_panel_update luts[EPD_PANEL_MAX_LUTS];
+
+  unsigned char *base;          // level each pixel was last driven to
+  float *residual;              // ghost left on top of base
+
+  const char *pgm_dir;          // frames are written here, if set
+  unsigned int frames_saved;
+
+  // Running totals, for epd_panel_report
+  unsigned long long updates[EPD_UPD_COUNT];
+  double latency_total, latency_max;    // ms, command to waveform end
+  double queued_total;          // ms spent waiting for a LUT
+};
+
+int epd_panel_init(
+  struct epd_panel *panel,
+  unsigned int width,
+  unsigned int height
+);
+
+void epd_panel_finish(
+  struct epd_panel *panel
+);
+
+// Start driving image (width x height of the panel) to the panel in
+// the given area. start and end are set to when the waveform starts
+// (once a LUT is free and nothing overlapping is in flight) and ends.
+void epd_panel_display(
+  struct epd_panel *panel,
+  const unsigned char *image,
+  unsigned int x,
+  unsigned int y,
+  unsigned int width,
+  unsigned int height,
+  enum epd_update_mode mode,
+  struct timespec *start,
+  struct timespec *end
+);
+
+// Log latency and ghosting figures so far
+void epd_panel_report(
+  struct epd_panel *panel
+);
+
+#endif
@@ -0,0 +1,516 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <time.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_output.h>
+#include <epd/epd_scheduler.h>
+
+#include <utils/box.h>
+#include <utils/env.h>
+#include <utils/time.h>
+
+
+/* Update scheduler
+
+   Sending a full screen update means transferring ~1MB over USB and
+   then waiting out a waveform, during which nothing else could get to
+   the display. A key press arriving then had to wait for all of it.
+
+   Instead, inks are queued here. Big ones are cut into horizontal
+   bands, and we send one band per trip around the event loop, always
+   picking the most urgent band queued. So a keystroke's damage only
+   waits for the band in flight, whatever else is being redrawn.
+
+   Bands are displayed without waiting for the waveform to finish, so
+   the controller runs them side by side. We keep an estimate of when
+   each waveform will be done and hold back any band that overlaps one
+   still running, since changing the image buffer under a running
+   waveform corrupts it.
+ */
+
+
+static void
+remove_job(
+  struct epd_scheduler *scheduler,
+  int index
+)
+{
+  /* Shuffle down rather than swap, to keep the queue in order */
+  scheduler->jobs_count -= 1;
+  memmove(&scheduler->jobs[index], &scheduler->jobs[index + 1],
+          sizeof(struct epd_job) * (scheduler->jobs_count - index));
+}
+
+static long long
+busy_remaining(
+  struct epd_scheduler *scheduler,
+  pixman_box32_t * box,
+  struct timespec *now
+)
+{
+  /* ms until nothing under box is running a waveform, 0 if free */
+  long long remaining = 0;
+
+  int i = 0;
+  while (i < scheduler->busy_count) {
+    struct epd_busy *busy = &scheduler->busy[i];
+    long long left = -timespec_diff_ms(&busy->until, now);
+
+    if (left <= 0) {
+      scheduler->busy_count -= 1;
+      scheduler->busy[i] = scheduler->busy[scheduler->busy_count];
+      continue;
+    }
+
+    if (box_intersects(box, &busy->box) && left > remaining) {
+      remaining = left;
+    }
+    i += 1;
+  }
+
+  return remaining;
+}
+
+static void
+mark_busy(
+  struct epd_scheduler *scheduler,
+  struct epd_job *job,
+  struct timespec *now
+)
+{
+  /* When full, drop the entry finishing soonest */
+  if (scheduler->busy_count == EPD_SCHEDULER_MAX_BUSY) {
+    int soonest = 0;
+    for (int i = 1; i < scheduler->busy_count; i++) {
+      if (timespec_diff_ms(&scheduler->busy[i].until,
+                           &scheduler->busy[soonest].until) > 0) {
+        soonest = i;
+      }
+    }
+    scheduler->busy_count -= 1;
+    scheduler->busy[soonest] = scheduler->busy[scheduler->busy_count];
+  }
+
+  struct epd_busy *busy = &scheduler->busy[scheduler->busy_count];
+  busy->box = job->box;
+  busy->until = *now;
+  timespec_add_ms(&busy->until,
+                  epd_governor_waveform_time(&scheduler->output->governor,
+                                             job->update_mode));
+  scheduler->busy_count += 1;
+
+  if (job->priority > EPD_PRIORITY_BACKGROUND
+      && timespec_diff_ms(&scheduler->settled, &busy->until) > 0) {
+    scheduler->settled = busy->until;
+  }
+}
+
+static int
+handle_scheduler_timer(
+  void *data
+)
+{
+  struct epd_scheduler *scheduler = data;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  /* Most urgent band that is free to go, oldest first. If everything
+     is waiting on a waveform or being debounced, come back when the
+     first is ready. */
+  int best = -1;
+  long long wait = -1;
+
+  for (int i = 0; i < scheduler->jobs_count; i++) {
+    struct epd_job *job = &scheduler->jobs[i];
+
+    if (best >= 0 && job->priority <= scheduler->jobs[best].priority) {
+      continue;
+    }
+
+    long long remaining = -timespec_diff_ms(&job->not_before, &now);
+    if (remaining <= 0) {
+      remaining = busy_remaining(scheduler, &job->box, &now);
+    }
+
+    if (remaining > 0) {
+      if (wait < 0 || remaining < wait) {
+        wait = remaining;
+      }
+      continue;
+    }
+
+    best = i;
+  }
+
+  if (best < 0) {
+    if (wait > 0) {
+      wl_event_source_timer_update(scheduler->timer, (int) wait);
+    }
+    return 0;
+  }
+
+  struct epd_job job = scheduler->jobs[best];
+  remove_job(scheduler, best);
+
+  epd_output_ink_now(scheduler->output, &job.box, job.update_mode,
+                     job.flags);
+  mark_busy(scheduler, &job, &now);
+
+  if (scheduler->merged_count > 0) {
+    wlr_log(WLR_INFO, "epd_scheduler: %u updates merged before sending",
+            scheduler->merged_count);
+    scheduler->merged_count = 0;
+  }
+
+  /* Go back to the event loop before the next band, so anything more
+     urgent that turns up in the meantime gets a look in. */
+  if (scheduler->jobs_count > 0) {
+    wl_event_source_timer_update(scheduler->timer, 1);
+  }
+
+  epd_output_check_present(scheduler->output);
+  wl_signal_emit(&scheduler->output->events.sent, scheduler->output);
+  return 0;
+}
+
+static bool
+is_urgent(
+  struct epd_scheduler *scheduler,
+  pixman_box32_t * box
+)
+{
+  if (scheduler->has_hint && box_intersects(box, &scheduler->hint)) {
+    return true;
+  }
+
+  /* Small damage straight after a key press is most likely the
+     key's echo. */
+  return scheduler->band_height > 0
+    && box->y2 - box->y1 <= scheduler->band_height
+    && epd_scheduler_recent_input(scheduler);
+}
+
+static long long
+job_cost(
+  struct epd_scheduler *scheduler,
+  pixman_box32_t * box
+)
+{
+  /* What sending box costs, in bytes. The transfer covers every byte
+     from its first pixel to its last, so whole rows in between, and
+     each update has a fixed cost on top (the display command and its
+     round trip). */
+  long long width = epd_output_get_width(&scheduler->output->wlr_output);
+
+  return EPD_SCHEDULER_UPDATE_COST
+    + (box->y2 - box->y1 - 1) * width + (box->x2 - box->x1);
+}
+
+static bool
+can_merge(
+  struct epd_scheduler *scheduler,
+  struct epd_job *job,
+  struct epd_job *queued,
+  pixman_box32_t * merged
+)
+{
+  if (job->update_mode != queued->update_mode
+      || job->flags != queued->flags) {
+    return false;
+  }
+
+  pixman_box32_t *a = &job->box;
+  pixman_box32_t *b = &queued->box;
+  *merged = box_union(a, b);
+
+  /* Don't undo the banding */
+  if (scheduler->band_height > 0 && job->priority != EPD_PRIORITY_URGENT
+      && merged->y2 - merged->y1 > scheduler->band_height) {
+    return false;
+  }
+
+  return job_cost(scheduler, merged)
+    <= job_cost(scheduler, a) + job_cost(scheduler, b);
+}
+
+static void
+queue_job(
+  struct epd_scheduler *scheduler,
+  struct epd_job *job
+)
+{
+  /* Queued jobs haven't been quantised or sent yet, and will pick up
+     whatever target_pixels holds when they are. So new damage can be
+     folded into them, and the in-between states are never sent. A
+     queued job entirely under the new one would only be inked again,
+     so drop it, as long as the new one inks it the same way (the same
+     mode, and at least the same flags: a typed character's DU mustn't
+     turn into a GL16 that loses its snapping). Otherwise merge the
+     two when one bigger update is cheaper than two. The merged job
+     takes the place of the oldest one in it, so merging never pushes
+     work back. */
+  int position = scheduler->jobs_count;
+
+  int i = 0;
+  while (i < scheduler->jobs_count) {
+    struct epd_job *queued = &scheduler->jobs[i];
+    pixman_box32_t merged;
+
+    if (box_contains(&job->box, &queued->box)
+        && job->update_mode == queued->update_mode
+        && (job->flags & queued->flags) == queued->flags) {
+      merged = job->box;
+    } else if (!can_merge(scheduler, job, queued, &merged)) {
+      i += 1;
+      continue;
+    }
+
+    job->box = merged;
+    if (queued->priority > job->priority) {
+      job->priority = queued->priority;
+    }
+    if (job->update_mode == queued->update_mode
+        && timespec_diff_ms(&job->not_before, &queued->not_before) > 0) {
+      job->not_before = queued->not_before;
+    }
+    if (timespec_diff_ms(&queued->queued, &job->queued) > 0) {
+      job->queued = queued->queued;
+    }
+    if (i < position) {
+      position = i;
+    }
+
+    remove_job(scheduler, i);
+    scheduler->merged_count += 1;
+
+    /* The grown box may now cover or merge with earlier jobs */
+    i = 0;
+  }
+
+  /* Each merge can push not_before back another debounce window, so a
+     client that never stops committing would starve its slow update.
+     Nothing waits longer than debounce max from when it was queued. */
+  int max = scheduler->output->debounce.max;
+  if (max > 0) {
+    struct timespec latest = job->queued;
+    timespec_add_ms(&latest, max);
+    if (timespec_diff_ms(&latest, &job->not_before) > 0) {
+      job->not_before = latest;
+    }
+  }
+
+  /* Out of room: the oldest job goes out straight away */
+  if (scheduler->jobs_count == EPD_SCHEDULER_MAX_JOBS) {
+    struct epd_job oldest = scheduler->jobs[0];
+    remove_job(scheduler, 0);
+    position = position > 0 ? position - 1 : 0;
+
+    wlr_log(WLR_INFO, "epd_scheduler: queue full, inking oldest job now");
+    epd_output_ink_now(scheduler->output, &oldest.box, oldest.update_mode,
+                       oldest.flags);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    mark_busy(scheduler, &oldest, &now);
+  }
+
+  if (position > scheduler->jobs_count) {
+    position = scheduler->jobs_count;
+  }
+
+  memmove(&scheduler->jobs[position + 1], &scheduler->jobs[position],
+          sizeof(struct epd_job) * (scheduler->jobs_count - position));
+  scheduler->jobs[position] = *job;
+  scheduler->jobs_count += 1;
+}
+
+void
+epd_scheduler_submit(
+  struct epd_scheduler *scheduler,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode,
+  unsigned int flags,
+  enum epd_priority priority
+)
+{
+  if (priority < EPD_PRIORITY_URGENT && is_urgent(scheduler, box)) {
+    priority = EPD_PRIORITY_URGENT;
+  }
+
+  int band_height = scheduler->band_height;
+  if (band_height <= 0 || priority == EPD_PRIORITY_URGENT) {
+    band_height = box->y2 - box->y1;
+  }
+
+  /* Slow waveforms wait for whoever is drawing here to finish */
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  struct timespec not_before = now;
+
+  if (priority != EPD_PRIORITY_URGENT
+      && epd_update_mode_levels(update_mode) == 16) {
+    timespec_add_ms(&not_before,
+                    epd_debounce_window(&scheduler->output->debounce, box));
+  }
+
+  for (int y = box->y1; y < box->y2; y += band_height) {
+    struct epd_job job = {
+      .box = {
+        .x1 = box->x1,
+        .y1 = y,
+        .x2 = box->x2,
+        .y2 = y + band_height < box->y2 ? y + band_height : box->y2,
+      },
+      .update_mode = update_mode,
+      .flags = flags,
+      .priority = priority,
+      .not_before = not_before,
+      .queued = now,
+    };
+    queue_job(scheduler, &job);
+  }
+
+  wl_event_source_timer_update(scheduler->timer, 1);
+}
+
+bool
+epd_scheduler_recent_input(
+  struct epd_scheduler *scheduler
+)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return timespec_diff_ms(&scheduler->last_input, &now)
+    < EPD_SCHEDULER_INPUT_WINDOW;
+}
+
+void
+epd_scheduler_input(
+  struct epd_scheduler *scheduler,
+  pixman_box32_t * hint
+)
+{
+  clock_gettime(CLOCK_MONOTONIC, &scheduler->last_input);
+
+  if (hint == NULL) {
+    return;
+  }
+
+  scheduler->has_hint = true;
+  scheduler->hint.x1 = hint->x1 - EPD_SCHEDULER_HINT_MARGIN;
+  scheduler->hint.y1 = hint->y1 - EPD_SCHEDULER_HINT_MARGIN;
+  scheduler->hint.x2 = hint->x2 + EPD_SCHEDULER_HINT_MARGIN;
+  scheduler->hint.y2 = hint->y2 + EPD_SCHEDULER_HINT_MARGIN;
+}
+
+bool
+epd_scheduler_settled(
+  struct epd_scheduler *scheduler,
+  struct timespec *when
+)
+{
+  for (int i = 0; i < scheduler->jobs_count; i++) {
+    if (scheduler->jobs[i].priority > EPD_PRIORITY_BACKGROUND) {
+      return false;
+    }
+  }
+
+  *when = scheduler->settled;
+  return true;
+}
+
+bool
+epd_scheduler_queued(
+  struct epd_scheduler *scheduler,
+  const pixman_box32_t * box
+)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (int i = 0; i < scheduler->jobs_count; i++) {
+    struct epd_job *job = &scheduler->jobs[i];
+
+    if (job->priority > EPD_PRIORITY_BACKGROUND
+        && timespec_diff_ms(&job->not_before, &now) >= 0
+        && box_intersects(&job->box, box)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+epd_scheduler_busy(
+  struct epd_scheduler *scheduler,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode
+)
+{
+  /* Only so queued jobs keep off it: it doesn't hold back presenting
+     frames, as foreground work would */
+  struct epd_job job = {
+    .box = *box,
+    .update_mode = update_mode,
+    .priority = EPD_PRIORITY_BACKGROUND,
+  };
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  mark_busy(scheduler, &job, &now);
+}
+
+void
+epd_scheduler_clear(
+  struct epd_scheduler *scheduler
+)
+{
+  scheduler->jobs_count = 0;
+  scheduler->busy_count = 0;
+  scheduler->has_hint = false;
+}
+
+void
+epd_scheduler_init(
+  struct epd_scheduler *scheduler,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+)
+{
+  memset(scheduler, 0, sizeof(struct epd_scheduler));
+
+  scheduler->output = output;
+  scheduler->band_height = env_get_int("EPD_WM_BAND_HEIGHT",
+                                       EPD_SCHEDULER_DEFAULT_BAND_HEIGHT);
+  scheduler->timer =
+    wl_event_loop_add_timer(event_loop, handle_scheduler_timer, scheduler);
+
+  wlr_log(WLR_INFO, "epd_scheduler: %i row bands", scheduler->band_height);
+}
+
+void
+epd_scheduler_finish(
+  struct epd_scheduler *scheduler
+)
+{
+  if (scheduler->timer) {
+    wl_event_source_remove(scheduler->timer);
+    scheduler->timer = NULL;
+  }
+
+  epd_scheduler_clear(scheduler);
+}
@@ -0,0 +1,131 @@
+#ifndef EPD_SCHEDULER_H
+#define EPD_SCHEDULER_H
+
+#include <pixman.h>
+#include <stdbool.h>
+#include <time.h>
+#include <wayland-server.h>
+
+#include <epd/epd_driver.h>
+
+#define EPD_SCHEDULER_MAX_JOBS 64
+#define EPD_SCHEDULER_MAX_BUSY 16
+#define EPD_SCHEDULER_DEFAULT_BAND_HEIGHT 128   // rows
+#define EPD_SCHEDULER_INPUT_WINDOW 250  // ms after input that damage is urgent
+#define EPD_SCHEDULER_HINT_MARGIN 64    // pixels around a hint
+#define EPD_SCHEDULER_UPDATE_COST 65536 // bytes an extra update is worth
+
+struct epd_output;
+
+enum epd_priority
+{
+  EPD_PRIORITY_BACKGROUND,      // quality passes, redraws
+  EPD_PRIORITY_NORMAL,          // new content
+  EPD_PRIORITY_URGENT,          // the user is waiting on it
+};
+
+// A band (or all) of an update waiting to be sent to the display
+struct epd_job
+{
+  pixman_box32_t box;
+  enum epd_update_mode update_mode;
+  unsigned int flags;           // epd_ink_flags
+  enum epd_priority priority;
+  struct timespec not_before;   // CLOCK_MONOTONIC, see epd_debounce
+  struct timespec queued;       // CLOCK_MONOTONIC, of its oldest part
+};
+
+// Part of the panel a waveform is still running on
+struct epd_busy
+{
+  pixman_box32_t box;
+  struct timespec until;        // CLOCK_MONOTONIC, estimated
+};
+
+// Queues inks and sends them a band at a time, most urgent first, going
+// back to the event loop between bands so that input (and the damage
+// it causes) can get in ahead of a big background update. Damage
+// arriving while a job waits is merged into it.
+struct epd_scheduler
+{
+  struct epd_output *output;
+  struct wl_event_source *timer;
+
+  int band_height;              // rows per band, <= 0 sends updates whole
+
+  int jobs_count;
+  struct epd_job jobs[EPD_SCHEDULER_MAX_JOBS];  // oldest first
+  unsigned int merged_count;    // jobs folded into others since last send
+
+  int busy_count;
+  struct epd_busy busy[EPD_SCHEDULER_MAX_BUSY];
+
+  // When the last foreground (not background priority) ink finishes
+  struct timespec settled;      // CLOCK_MONOTONIC, estimated
+
+  // Where the user is looking: around the last click/touch and the
+  // text cursor. Damage touching it, or any small damage just after a
+  // key press, is urgent.
+  bool has_hint;
+  pixman_box32_t hint;
+  struct timespec last_input;   // CLOCK_MONOTONIC
+};
+
+void epd_scheduler_init(
+  struct epd_scheduler *scheduler,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+);
+
+void epd_scheduler_finish(
+  struct epd_scheduler *scheduler
+);
+
+void epd_scheduler_submit(
+  struct epd_scheduler *scheduler,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode,
+  unsigned int flags,
+  enum epd_priority priority
+);
+
+// Note that something inked outside the queue (the cursor, wet ink)
+// is running update_mode's waveform on box, so that queued jobs wait
+// for it
+void epd_scheduler_busy(
+  struct epd_scheduler *scheduler,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode
+);
+
+// Forget queued work, e.g. because the buffers it refers to are gone
+void epd_scheduler_clear(
+  struct epd_scheduler *scheduler
+);
+
+// Note input, optionally with where on screen it happened
+void epd_scheduler_input(
+  struct epd_scheduler *scheduler,
+  pixman_box32_t * hint
+);
+
+// Whether everything but background work has been sent, and if so
+// when its waveforms finish (possibly in the past)
+bool epd_scheduler_settled(
+  struct epd_scheduler *scheduler,
+  struct timespec *when
+);
+
+// Whether a foreground job touching box is waiting to be sent. Jobs
+// still being debounced don't count: they're waiting for more damage.
+bool epd_scheduler_queued(
+  struct epd_scheduler *scheduler,
+  const pixman_box32_t * box
+);
+
+// Whether there was input in the last EPD_SCHEDULER_INPUT_WINDOW ms
+bool epd_scheduler_recent_input(
+  struct epd_scheduler *scheduler
+);
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_output.h>
+#include <epd/epd_scroll.h>
+
+#include <utils/box.h>
+#include <utils/env.h>
+
+
+/* Scroll detection
+
+   Scrolling changes nearly every pixel in a window, so each step is a
+   big update, and with a 16 level (or even DU4) waveform the panel
+   falls well behind. We hash every row and every column of the damaged
+   area before and after a commit. If most rows of the new frame turn
+   up in the old one shifted by the same amount, the content scrolled.
+
+   A scroll is inked with A2 and frames are sent as fast as the panel
+   takes them. Once nothing has scrolled for `settle` ms the whole
+   scrolled area is left to the quality pass.
+
+   Rows (and columns) of a single colour match anywhere, so they're
+   hashed as 0 and never count as a match.
+ */
+
+
+#define FNV_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+
+static void
+hash_lines(
+  struct epd_scroll *scroll,
+  const unsigned char *pixels,
+  pixman_box32_t * box,
+  uint32_t *rows,
+  uint32_t *columns
+)
+{
+  const unsigned char *first_row = pixels + box->y1 * scroll->width;
+  bool *varied = scroll->varied;
+
+  for (int x = box->x1; x < box->x2; x++) {
+    columns[x] = FNV_BASIS;
+    varied[x] = false;
+  }
+
+  for (int y = box->y1; y < box->y2; y++) {
+    const unsigned char *row = pixels + y * scroll->width;
+    uint32_t hash = FNV_BASIS;
+    bool flat = true;
+
+    for (int x = box->x1; x < box->x2; x++) {
+      unsigned char value = row[x];
+
+      hash = (hash ^ value) * FNV_PRIME;
+      columns[x] = (columns[x] ^ value) * FNV_PRIME;
+
+      flat &= value == row[box->x1];
+      varied[x] |= value != first_row[x];
+    }
+
+    rows[y] = flat ? 0 : hash;
+  }
+
+  for (int x = box->x1; x < box->x2; x++) {
+    if (!varied[x]) {
+      columns[x] = 0;
+    }
+  }
+}
+
+static int
+count_matches(
+  const uint32_t *old_lines,
+  const uint32_t *new_lines,
+  int start,
+  int end,
+  int shift,
+  int *lines
+)
+{
+  /* Line i of the new frame should be line i - shift of the old one */
+  int matches = 0;
+  *lines = 0;
+
+  for (int i = start; i < end; i++) {
+    int j = i - shift;
+
+    if (j < start || j >= end || new_lines[i] == 0) {
+      continue;
+    }
+
+    *lines += 1;
+    if (new_lines[i] == old_lines[j]) {
+      matches += 1;
+    }
+  }
+
+  return matches;
+}
+
+static bool
+find_shift(
+  const uint32_t *old_lines,
+  const uint32_t *new_lines,
+  int start,
+  int end,
+  int *shift
+)
+{
+  int lines;
+  int best = 0;
+  int best_matches = count_matches(old_lines, new_lines, start, end, 0,
+                                   &lines);
+
+  /* Shifts leaving fewer than EPD_SCROLL_MIN_LINES in view can't win */
+  int range = end - start - EPD_SCROLL_MIN_LINES;
+
+  for (int candidate = -range; candidate <= range; candidate++) {
+    if (candidate == 0) {
+      continue;
+    }
+
+    int matches = count_matches(old_lines, new_lines, start, end, candidate,
+                                &lines);
+
+    /* Most of the lines that could have moved into view must have */
+    if (matches > best_matches && matches >= EPD_SCROLL_MIN_LINES
+        && matches * 2 >= lines) {
+      best = candidate;
+      best_matches = matches;
+    }
+  }
+
+  *shift = best;
+  return best != 0;
+}
+
+bool
+epd_scroll_detect(
+  struct epd_scroll *scroll,
+  const unsigned char *pixels,
+  pixman_box32_t * box,
+  int *shift_x,
+  int *shift_y
+)
+{
+  if (scroll->settle <= 0
+      || box->y2 - box->y1 < 2 * EPD_SCROLL_MIN_LINES
+      || box->x2 - box->x1 < 2 * EPD_SCROLL_MIN_LINES) {
+    return false;
+  }
+
+  hash_lines(scroll, pixels, box, scroll->new_rows, scroll->new_columns);
+
+  *shift_x = 0;
+  *shift_y = 0;
+
+  if (find_shift(scroll->old_rows, scroll->new_rows, box->y1, box->y2,
+                 shift_y)) {
+    return true;
+  }
+
+  return find_shift(scroll->old_columns, scroll->new_columns, box->x1,
+                    box->x2, shift_x);
+}
+
+void
+epd_scroll_before(
+  struct epd_scroll *scroll,
+  const unsigned char *pixels,
+  pixman_box32_t * box
+)
+{
+  if (scroll->settle <= 0
+      || box->y2 - box->y1 < 2 * EPD_SCROLL_MIN_LINES
+      || box->x2 - box->x1 < 2 * EPD_SCROLL_MIN_LINES) {
+    return;
+  }
+
+  hash_lines(scroll, pixels, box, scroll->old_rows, scroll->old_columns);
+}
+
+static int
+handle_scroll_timer(
+  void *data
+)
+{
+  struct epd_scroll *scroll = data;
+  struct epd_output *output = scroll->output;
+
+  wlr_log(WLR_INFO,
+          "epd_scroll: settled x=%i, y=%i, width=%i, height=%i",
+          scroll->box.x1, scroll->box.y1, scroll->box.x2 - scroll->box.x1,
+          scroll->box.y2 - scroll->box.y1);
+
+  scroll->scrolling = false;
+
+  /* The quality pass normally takes care of this, but may be off */
+  if (output->cleanup.delay <= 0) {
+    epd_output_ink(output, &scroll->box, output->cleanup.mode,
+                   EPD_INK_BACKGROUND);
+  }
+
+  return 0;
+}
+
+void
+epd_scroll_track(
+  struct epd_scroll *scroll,
+  pixman_box32_t * box
+)
+{
+  if (!scroll->scrolling) {
+    scroll->scrolling = true;
+    scroll->box = *box;
+  } else {
+    scroll->box = box_union(&scroll->box, box);
+  }
+
+  wl_event_source_timer_update(scroll->timer, scroll->settle);
+}
+
+void
+epd_scroll_resize(
+  struct epd_scroll *scroll,
+  unsigned int width,
+  unsigned int height
+)
+{
+  free(scroll->old_rows);
+  free(scroll->new_rows);
+  free(scroll->old_columns);
+  free(scroll->new_columns);
+  free(scroll->varied);
+
+  scroll->width = width;
+  scroll->height = height;
+  scroll->old_rows = calloc(height, sizeof(uint32_t));
+  scroll->new_rows = calloc(height, sizeof(uint32_t));
+  scroll->old_columns = calloc(width, sizeof(uint32_t));
+  scroll->new_columns = calloc(width, sizeof(uint32_t));
+  scroll->varied = calloc(width, sizeof(bool));
+  scroll->scrolling = false;
+}
+
+void
+epd_scroll_init(
+  struct epd_scroll *scroll,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+)
+{
+  memset(scroll, 0, sizeof(struct epd_scroll));
+
+  scroll->output = output;
+  scroll->settle =
+    env_get_int("EPD_WM_SCROLL_SETTLE", EPD_SCROLL_DEFAULT_SETTLE);
+  scroll->timer =
+    wl_event_loop_add_timer(event_loop, handle_scroll_timer, scroll);
+
+  wlr_log(WLR_INFO, "epd_scroll: scrolls settle after %i ms",
+          scroll->settle);
+}
+
+void
+epd_scroll_finish(
+  struct epd_scroll *scroll
+)
+{
+  if (scroll->timer) {
+    wl_event_source_remove(scroll->timer);
+    scroll->timer = NULL;
+  }
+
+  free(scroll->old_rows);
+  free(scroll->new_rows);
+  free(scroll->old_columns);
+  free(scroll->new_columns);
+  free(scroll->varied);
+  scroll->old_rows = scroll->new_rows = NULL;
+  scroll->old_columns = scroll->new_columns = NULL;
+  scroll->varied = NULL;
+}
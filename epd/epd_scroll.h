@@ -0,0 +1,80 @@
+#ifndef EPD_SCROLL_H
+#define EPD_SCROLL_H
+
+#include <pixman.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <wayland-server.h>
+
+#define EPD_SCROLL_DEFAULT_SETTLE 500   // ms
+#define EPD_SCROLL_MIN_LINES 8          // matching rows/columns needed
+
+struct epd_output;
+
+// Spots scrolling by matching rows (or columns) of the new frame
+// against shifted rows of the old one. While scrolling, damage is
+// inked with A2 and once it stops the scrolled area gets one quality
+// refresh.
+struct epd_scroll
+{
+  struct epd_output *output;
+  struct wl_event_source *timer;
+
+  int settle;                   // ms without scrolling before it's over
+
+  // Hashes of each row and column of the damaged area, before and
+  // after converting a commit. Indexed by absolute y and x.
+  uint32_t *old_rows;
+  uint32_t *new_rows;
+  uint32_t *old_columns;
+  uint32_t *new_columns;
+  bool *varied;                 // scratch, columns that aren't one colour
+  unsigned int width;
+  unsigned int height;
+
+  bool scrolling;
+  pixman_box32_t box;           // everything scrolled since it started
+};
+
+void epd_scroll_init(
+  struct epd_scroll *scroll,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+);
+
+void epd_scroll_resize(
+  struct epd_scroll *scroll,
+  unsigned int width,
+  unsigned int height
+);
+
+void epd_scroll_finish(
+  struct epd_scroll *scroll
+);
+
+// Hash the damaged area of the previous frame, before it is
+// overwritten.
+void epd_scroll_before(
+  struct epd_scroll *scroll,
+  const unsigned char *pixels,
+  pixman_box32_t * box
+);
+
+// Hash the same area of the new frame and compare. Returns true if
+// the content of box moved by (*shift_x, *shift_y) pixels.
+bool epd_scroll_detect(
+  struct epd_scroll *scroll,
+  const unsigned char *pixels,
+  pixman_box32_t * box,
+  int *shift_x,
+  int *shift_y
+);
+
+// Note that box was inked as part of a scroll
+void epd_scroll_track(
+  struct epd_scroll *scroll,
+  pixman_box32_t * box
+);
+
+#endif
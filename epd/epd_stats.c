@@ -0,0 +1,451 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <string.h>
+
+#include <epd/epd_stats.h>
+
+#include <utils/env.h>
+#include <utils/trace.h>
+
+
+/* Commit metrics
+
+   Each commit gets a record: how long each stage took, in ns off
+   CLOCK_MONOTONIC, how many pixels changed, and what was inked for it
+   (bytes, count and mode). Inks go out later, from the scheduler, so
+   a record stays open and collects them until the next commit starts.
+
+   Records go into a ring of the last EPD_STATS_RING_SIZE commits,
+   which the metrics export serves (see epd_export.c). Only the
+   compositor thread writes to it. head counts the records closed so
+   far, and works as the sequence number of a seqlock: a slot is only
+   written after head has moved past the record it held, and
+   epd_stats_read checks head again after copying one out, throwing
+   the copy away if the writer could have got to it. Readers never
+   hold up the writer, and the writer never waits for them.
+
+   Stages also show up in the timeline, when tracing (see trace.c).
+
+   Closed records are also added to a histogram per stage, with
+   log-linear buckets in the style of HdrHistogram: a few KB each,
+   and percentiles to within ~6% however long the run. That's what
+   the reports print, every `interval` commits and on exit, to stdout
+   so they are there whatever the log level.
+
+   Input latency is followed the same way people notice it: from a key
+   press (or click, scroll or touch) to when the refresh showing what
+   it did has finished on the panel. An input waits for the first
+   commit after it that changed any pixels, then for that commit to be
+   presented, which is when everything inked for it has gone out and
+   its waveforms have run (see handle_present_timer). Inputs that
+   change nothing would otherwise be pinned on whatever changes next,
+   a clock ticking say, so they're dropped after
+   EPD_STATS_INPUT_TIMEOUT.
+ */
+
+
+static const char *STAGE_NAMES[EPD_STAGE_COUNT] = {
+  [EPD_STAGE_READ_PIXELS] = "read_pixels",
+  [EPD_STAGE_CONVERT] = "convert",
+  [EPD_STAGE_QUEUE] = "queue",
+  [EPD_STAGE_DITHER] = "dither",
+  [EPD_STAGE_TRANSFER] = "transfer",
+  [EPD_STAGE_DISPLAY] = "display",
+};
+
+static const char *INPUT_NAMES[EPD_INPUT_COUNT] = {
+  [EPD_INPUT_KEY] = "key",
+  [EPD_INPUT_POINTER] = "pointer",
+};
+
+
+static unsigned int
+bucket_index(
+  uint64_t value
+)
+{
+  if (value < EPD_STATS_SUB_BUCKETS) {
+    return value;
+  }
+
+  /* 16 buckets per power of two, from 16 up */
+  int exponent = 63 - __builtin_clzll(value);
+  unsigned int index = (exponent - 3) * EPD_STATS_SUB_BUCKETS
+    + ((value >> (exponent - 4)) & (EPD_STATS_SUB_BUCKETS - 1));
+
+  return index < EPD_STATS_BUCKETS ? index : EPD_STATS_BUCKETS - 1;
+}
+
+static uint64_t
+bucket_limit(
+  unsigned int index
+)
+{
+  /* The largest value that goes in bucket index */
+  if (index < EPD_STATS_SUB_BUCKETS) {
+    return index;
+  }
+
+  int exponent = index / EPD_STATS_SUB_BUCKETS + 3;
+  uint64_t sub = index % EPD_STATS_SUB_BUCKETS;
+  return ((EPD_STATS_SUB_BUCKETS + sub + 1) << (exponent - 4)) - 1;
+}
+
+static void
+histogram_add(
+  struct epd_stats_histogram *histogram,
+  uint64_t value
+)
+{
+  histogram->count += 1;
+  histogram->total += value;
+  histogram->buckets[bucket_index(value)] += 1;
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+}
+
+uint64_t
+epd_stats_percentile(
+  struct epd_stats_histogram *histogram,
+  double fraction
+)
+{
+  uint64_t wanted = fraction * histogram->count;
+  uint64_t seen = 0;
+
+  for (unsigned int i = 0; i < EPD_STATS_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen > wanted) {
+      uint64_t limit = bucket_limit(i);
+      return limit < histogram->max ? limit : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+uint64_t
+epd_stats_count_below(
+  struct epd_stats_histogram *histogram,
+  uint64_t limit
+)
+{
+  uint64_t count = 0;
+
+  for (unsigned int i = 0; i < EPD_STATS_BUCKETS; i++) {
+    if (bucket_limit(i) > limit) {
+      break;
+    }
+    count += histogram->buckets[i];
+  }
+  return count;
+}
+
+const char *
+epd_stats_stage_name(
+  enum epd_stage stage
+)
+{
+  return STAGE_NAMES[stage];
+}
+
+const char *
+epd_stats_input_name(
+  enum epd_input kind
+)
+{
+  return INPUT_NAMES[kind];
+}
+
+uint64_t
+epd_stats_now(
+  void
+)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static struct epd_stats_record *
+current(
+  struct epd_stats *stats
+)
+{
+  unsigned long long head =
+    atomic_load_explicit(&stats->head, memory_order_relaxed);
+  return &stats->records[head % EPD_STATS_RING_SIZE];
+}
+
+static void
+close_record(
+  struct epd_stats *stats
+)
+{
+  struct epd_stats_record *record = current(stats);
+  uint64_t total = 0;
+
+  for (int stage = 0; stage < EPD_STAGE_COUNT; stage++) {
+    histogram_add(&stats->stages[stage], record->stage[stage]);
+    total += record->stage[stage];
+  }
+  histogram_add(&stats->commit, total);
+
+  stats->bytes += record->bytes;
+  stats->pixels += record->pixels;
+  stats->inks += record->inks;
+  if (record->pixels == 0) {
+    stats->skipped += 1;
+  }
+
+  /* Publish it, and free up the slot of the oldest record for the next
+     one. The fence keeps what is written to that slot from being seen
+     before head has moved on, so readers copying it out can tell. */
+  atomic_fetch_add_explicit(&stats->head, 1, memory_order_release);
+  atomic_thread_fence(memory_order_release);
+  stats->recording = false;
+}
+
+void
+epd_stats_begin(
+  struct epd_stats *stats
+)
+{
+  if (stats->recording) {
+    close_record(stats);
+  }
+
+  struct epd_stats_record *record = current(stats);
+  memset(record, 0, sizeof(struct epd_stats_record));
+  record->time = epd_stats_now();
+  record->mode = EPD_STATS_NO_MODE;
+  stats->recording = true;
+}
+
+void
+epd_stats_add(
+  struct epd_stats *stats,
+  enum epd_stage stage,
+  uint64_t start,
+  uint64_t end
+)
+{
+  if (stats->recording) {
+    current(stats)->stage[stage] += end - start;
+  }
+
+  trace_slice(stage >= EPD_STAGE_TRANSFER ? TRACE_USB : TRACE_COMPOSITOR,
+              STAGE_NAMES[stage], start, end, NULL);
+}
+
+void
+epd_stats_pixels(
+  struct epd_stats *stats,
+  unsigned int pixels
+)
+{
+  if (stats->recording) {
+    current(stats)->pixels += pixels;
+  }
+}
+
+void
+epd_stats_ink(
+  struct epd_stats *stats,
+  unsigned int bytes,
+  unsigned int update_mode,
+  uint64_t ns
+)
+{
+  if (update_mode < EPD_UPD_COUNT) {
+    histogram_add(&stats->modes[update_mode], ns);
+  }
+
+  if (stats->recording) {
+    struct epd_stats_record *record = current(stats);
+    record->bytes += bytes;
+    record->inks += 1;
+    record->mode = update_mode;
+  }
+}
+
+void
+epd_stats_input(
+  struct epd_stats *stats,
+  enum epd_input kind
+)
+{
+  if (stats->inputs_count == EPD_STATS_MAX_INPUTS) {
+    stats->inputs_dropped += 1;
+    return;
+  }
+
+  struct epd_stats_input *input = &stats->inputs[stats->inputs_count++];
+  input->time = epd_stats_now();
+  input->kind = kind;
+}
+
+void
+epd_stats_input_commit(
+  struct epd_stats *stats
+)
+{
+  /* Whatever came too long before this didn't do anything visible */
+  uint64_t now = epd_stats_now();
+  int kept = stats->inputs_committed;
+
+  for (int i = stats->inputs_committed; i < stats->inputs_count; i++) {
+    if (now - stats->inputs[i].time > EPD_STATS_INPUT_TIMEOUT) {
+      stats->inputs_dropped += 1;
+    } else {
+      stats->inputs[kept++] = stats->inputs[i];
+    }
+  }
+  stats->inputs_count = kept;
+  stats->inputs_committed = kept;
+}
+
+void
+epd_stats_input_shown(
+  struct epd_stats *stats,
+  uint64_t when
+)
+{
+  int shown = stats->inputs_committed;
+  if (shown == 0) {
+    return;
+  }
+
+  for (int i = 0; i < shown; i++) {
+    struct epd_stats_input *input = &stats->inputs[i];
+    histogram_add(&stats->latency[input->kind],
+                  when > input->time ? when - input->time : 0);
+  }
+
+  memmove(stats->inputs, stats->inputs + shown,
+          (stats->inputs_count - shown) * sizeof(struct epd_stats_input));
+  stats->inputs_count -= shown;
+  stats->inputs_committed = 0;
+}
+
+bool
+epd_stats_commit(
+  struct epd_stats *stats
+)
+{
+  unsigned long long head = atomic_load(&stats->head) + 1;
+
+  if (stats->interval > 0
+      && head - stats->reported >= (unsigned long long) stats->interval) {
+    epd_stats_report(stats);
+    return true;
+  }
+  return false;
+}
+
+unsigned long long
+epd_stats_recorded(
+  struct epd_stats *stats
+)
+{
+  return atomic_load_explicit(&stats->head, memory_order_acquire);
+}
+
+bool
+epd_stats_read(
+  struct epd_stats *stats,
+  unsigned long long seq,
+  struct epd_stats_record *record
+)
+{
+  unsigned long long head =
+    atomic_load_explicit(&stats->head, memory_order_acquire);
+  if (seq >= head || seq + EPD_STATS_RING_SIZE <= head) {
+    return false;
+  }
+
+  memcpy(record, &stats->records[seq % EPD_STATS_RING_SIZE],
+         sizeof(struct epd_stats_record));
+
+  /* The writer may have come round to it while we copied */
+  atomic_thread_fence(memory_order_acquire);
+  head = atomic_load_explicit(&stats->head, memory_order_relaxed);
+  return seq + EPD_STATS_RING_SIZE > head;
+}
+
+static void
+print_histogram(
+  const char *name,
+  struct epd_stats_histogram *histogram
+)
+{
+  printf("epd_stats:   %-12s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", name,
+         histogram->count ? histogram->total / 1e6 / histogram->count : 0,
+         epd_stats_percentile(histogram, 0.5) / 1e6,
+         epd_stats_percentile(histogram, 0.9) / 1e6,
+         epd_stats_percentile(histogram, 0.99) / 1e6,
+         epd_stats_percentile(histogram, 0.999) / 1e6,
+         histogram->max / 1e6);
+}
+
+void
+epd_stats_report(
+  struct epd_stats *stats
+)
+{
+  unsigned long long head = atomic_load(&stats->head);
+  stats->reported = head + 1;
+
+  if (stats->interval <= 0 || stats->commit.count == 0) {
+    return;
+  }
+
+  printf("epd_stats: %llu commits (%llu changed nothing), %llu inks, "
+         "%llu bytes, %llu pixels changed\n",
+         (unsigned long long) stats->commit.count,
+         (unsigned long long) stats->skipped,
+         (unsigned long long) stats->inks,
+         (unsigned long long) stats->bytes,
+         (unsigned long long) stats->pixels);
+  printf("epd_stats:   %-12s %8s %8s %8s %8s %8s %8s (ms)\n", "stage",
+         "mean", "p50", "p90", "p99", "p99.9", "max");
+
+  for (int stage = 0; stage < EPD_STAGE_COUNT; stage++) {
+    print_histogram(STAGE_NAMES[stage], &stats->stages[stage]);
+  }
+  print_histogram("commit", &stats->commit);
+
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    if (stats->modes[mode].count > 0) {
+      print_histogram(epd_update_mode_to_string(mode), &stats->modes[mode]);
+    }
+  }
+
+  for (int kind = 0; kind < EPD_INPUT_COUNT; kind++) {
+    if (stats->latency[kind].count > 0) {
+      char name[32];
+      snprintf(name, sizeof(name), "%s->ink", INPUT_NAMES[kind]);
+      print_histogram(name, &stats->latency[kind]);
+    }
+  }
+  fflush(stdout);
+}
+
+void
+epd_stats_init(
+  struct epd_stats *stats
+)
+{
+  memset(stats, 0, sizeof(struct epd_stats));
+  atomic_init(&stats->head, 0);
+  stats->interval = env_get_int("EPD_WM_STATS", 0);
+}
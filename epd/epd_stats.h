@@ -0,0 +1,201 @@
+#ifndef EPD_STATS_H
+#define EPD_STATS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <epd/epd_driver.h>
+
+#define EPD_STATS_RING_SIZE 1024        // commits kept, a power of two
+#define EPD_STATS_SUB_BUCKETS 16        // per power of two, ~6% precision
+#define EPD_STATS_BUCKETS (EPD_STATS_SUB_BUCKETS * 38)  // up to ~36 minutes
+#define EPD_STATS_NO_MODE 0xff
+#define EPD_STATS_MAX_INPUTS 64         // waiting to be shown at once
+#define EPD_STATS_INPUT_TIMEOUT 5000000000ull   // ns before giving up
+
+// The stages a frame goes through, from the renderer to the panel
+enum epd_stage
+{
+  EPD_STAGE_READ_PIXELS,        // wlr_renderer_read_pixels
+  EPD_STAGE_CONVERT,            // to grey, and finding what changed
+  EPD_STAGE_QUEUE,              // deciding how to ink it
+  EPD_STAGE_DITHER,             // to the panel's levels (epd_output_ink_now)
+  EPD_STAGE_TRANSFER,           // pixels to the controller
+  EPD_STAGE_DISPLAY,            // display command
+  EPD_STAGE_COUNT,
+};
+
+// Kinds of input followed to the panel
+enum epd_input
+{
+  EPD_INPUT_KEY,
+  EPD_INPUT_POINTER,            // buttons, scrolling and touch
+  EPD_INPUT_COUNT,
+};
+
+// An input waiting for the refresh that shows what it did
+struct epd_stats_input
+{
+  uint64_t time;                // ns, CLOCK_MONOTONIC
+  enum epd_input kind;
+};
+
+// What one commit cost, including the inks sent for it (everything
+// up to the next commit)
+struct epd_stats_record
+{
+  uint64_t time;                // ns, CLOCK_MONOTONIC, when it started
+  uint64_t stage[EPD_STAGE_COUNT];      // ns
+  uint32_t bytes;               // sent to the controller
+  uint32_t pixels;              // that changed
+  uint32_t inks;
+  uint8_t mode;                 // of the last ink, or EPD_STATS_NO_MODE
+};
+
+// Counts of values in log-linear buckets, like HdrHistogram: exact up
+// to EPD_STATS_SUB_BUCKETS, then within ~6%
+struct epd_stats_histogram
+{
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint32_t buckets[EPD_STATS_BUCKETS];
+};
+
+struct epd_stats
+{
+  int interval;                 // commits between reports, <= 0 for none
+  unsigned long long reported;  // commits at the last report
+
+  // The last EPD_STATS_RING_SIZE commits. records[head % size] is the
+  // one being filled in, the ones before it are complete.
+  struct epd_stats_record records[EPD_STATS_RING_SIZE];
+  _Atomic unsigned long long head;
+  bool recording;
+
+  // Since startup, per stage and for whole commits
+  struct epd_stats_histogram stages[EPD_STAGE_COUNT];
+  struct epd_stats_histogram commit;
+  uint64_t bytes, pixels, inks;
+  uint64_t skipped;             // commits that changed no pixels
+
+  // Time from dithering to the display command, per ink
+  struct epd_stats_histogram modes[EPD_UPD_COUNT];
+
+  // Inputs not shown yet, oldest first. The first inputs_committed
+  // have been followed by a commit that changed something.
+  struct epd_stats_input inputs[EPD_STATS_MAX_INPUTS];
+  int inputs_count;
+  int inputs_committed;
+  uint64_t inputs_dropped;      // too many at once, or nothing changed
+
+  // Time from input to the end of the refresh showing it
+  struct epd_stats_histogram latency[EPD_INPUT_COUNT];
+};
+
+void epd_stats_init(
+  struct epd_stats *stats
+);
+
+// ns on CLOCK_MONOTONIC
+uint64_t epd_stats_now(
+  void
+);
+
+// Start recording a commit, which finishes the last one
+void epd_stats_begin(
+  struct epd_stats *stats
+);
+
+// Record that stage ran from start to end (epd_stats_now), for the
+// current commit
+void epd_stats_add(
+  struct epd_stats *stats,
+  enum epd_stage stage,
+  uint64_t start,
+  uint64_t end
+);
+
+// Record pixels changed by the current commit
+void epd_stats_pixels(
+  struct epd_stats *stats,
+  unsigned int pixels
+);
+
+// Record an ink of bytes with update_mode, which took ns
+void epd_stats_ink(
+  struct epd_stats *stats,
+  unsigned int bytes,
+  unsigned int update_mode,
+  uint64_t ns
+);
+
+// Note an input of kind, just now
+void epd_stats_input(
+  struct epd_stats *stats,
+  enum epd_input kind
+);
+
+// The current commit changed something: whatever input came before
+// it is shown once it is
+void epd_stats_input_commit(
+  struct epd_stats *stats
+);
+
+// What was committed finished showing on the panel at `when` (ns)
+void epd_stats_input_shown(
+  struct epd_stats *stats,
+  uint64_t when
+);
+
+// The current commit has done its part; inks still count towards it
+// until the next one begins. Reports every `interval` commits, and
+// returns true when it just did.
+bool epd_stats_commit(
+  struct epd_stats *stats
+);
+
+// The number of complete records so far, one more than the last one's
+// seq
+unsigned long long epd_stats_recorded(
+  struct epd_stats *stats
+);
+
+// Copy out complete record number seq (counting from 0 at startup).
+// False if it isn't complete yet, or has been overwritten.
+bool epd_stats_read(
+  struct epd_stats *stats,
+  unsigned long long seq,
+  struct epd_stats_record *record
+);
+
+// Value below which a fraction of the histogram's values lie
+uint64_t epd_stats_percentile(
+  struct epd_stats_histogram *histogram,
+  double fraction
+);
+
+// Number of values up to limit (give or take a bucket)
+uint64_t epd_stats_count_below(
+  struct epd_stats_histogram *histogram,
+  uint64_t limit
+);
+
+// Name of a stage ("read_pixels", "dither", ...)
+const char *epd_stats_stage_name(
+  enum epd_stage stage
+);
+
+// Name of an input kind ("key", "pointer")
+const char *epd_stats_input_name(
+  enum epd_input kind
+);
+
+// Print percentiles for each stage
+void epd_stats_report(
+  struct epd_stats *stats
+);
+
+#endif
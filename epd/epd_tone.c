@@ -0,0 +1,274 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_driver.h>
+#include <epd/epd_tone.h>
+
+#include <utils/env.h>
+#include <utils/pgm.h>
+
+
+/* Tone curves
+
+   Every pixel we send goes grey -> tone curve -> level for the
+   waveform. Rather than evaluate that per pixel, we compile it into a
+   256 entry table per waveform up front, so the conversion loop is a
+   single lookup. The old per pixel filters (pgm_filter_*_pixel) are
+   still what decides the level thresholds, they just run 256 times
+   per waveform instead of once per pixel.
+
+   Panels differ, so the curves can be calibrated from a text file
+   (EPD_WM_TONE_FILE) which is re-read on SIGHUP. Each line is
+
+       <mode> <black point> <white point> <contrast> <gamma>
+
+   where <mode> is a waveform name (DU, GL16, ...) or * for all of
+   them. Later lines win, and # starts a comment. For example:
+
+       *    0   255  1.0  1.0
+       DU   40  200  1.2  1.0
+ */
+
+
+/* Adaptive snapping
+
+   Anti-aliased text on a white background is "almost" black and
+   white: a couple of percent of its pixels are grey, the rest sit at
+   the extremes. A fixed quantiser sends that through DU4 or GL16 (or
+   dithers the edges), when snapping the few grey pixels to black or
+   white would let it go out with the 1 bit DU waveform, at a tiny
+   cost in quality.
+
+   So before inking we look at the region's histogram:
+     - EXACT: every value present quantises to the same level for the
+       fast 1 bit mode as for the quality 16 level mode, so the fast
+       ink is already the final result.
+     - BIMODAL: all but snap_tolerance per mille of the pixels are
+       within snap_margin of black or white. Snap it.
+     - GREY: anything else.
+ */
+
+
+static const struct epd_tone_curve default_curve = {
+  .black_point = 0,
+  .white_point = 255,
+  .contrast = 1.0f,
+  .gamma = 1.0f,
+};
+
+
+static unsigned char
+curve_apply(
+  struct epd_tone_curve *curve,
+  unsigned int value
+)
+{
+  float x;
+
+  if (value <= curve->black_point) {
+    x = 0.0f;
+  } else if (value >= curve->white_point) {
+    x = 1.0f;
+  } else {
+    x = (float) (value - curve->black_point)
+      / (curve->white_point - curve->black_point);
+  }
+
+  x = (x - 0.5f) * curve->contrast + 0.5f;
+
+  if (x < 0.0f) {
+    x = 0.0f;
+  }
+  if (x > 1.0f) {
+    x = 1.0f;
+  }
+
+  x = powf(x, curve->gamma);
+
+  return (unsigned char) lroundf(x * 255.0f);
+}
+
+static unsigned char
+level_snap(
+  enum epd_update_mode update_mode,
+  unsigned char value
+)
+{
+  switch (epd_update_mode_levels(update_mode)) {
+  case 2:
+    return pgm_filter_one_bit_pixel(value);
+  case 4:
+    return pgm_filter_two_bit_pixel(value);
+  default:
+    return pgm_filter_four_bit_pixel(value);
+  }
+}
+
+void
+epd_tone_compile(
+  struct epd_tone *tone
+)
+{
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    for (unsigned int value = 0; value < 256; value++) {
+      tone->tone[mode][value] = curve_apply(&tone->curves[mode], value);
+      tone->level[mode][value] = level_snap(mode, tone->tone[mode][value]);
+    }
+  }
+}
+
+enum epd_tone_content
+epd_tone_classify(
+  struct epd_tone *tone,
+  unsigned int histogram[256],
+  enum epd_update_mode fast_mode,
+  enum epd_update_mode quality_mode
+)
+{
+  unsigned long total = 0;
+  unsigned long middle = 0;
+  bool exact = true;
+
+  for (unsigned int value = 0; value < 256; value++) {
+    if (histogram[value] == 0) {
+      continue;
+    }
+
+    total += histogram[value];
+
+    /* The panel only looks at the top four bits of each byte */
+    if ((tone->level[fast_mode][value] >> 4)
+        != (tone->level[quality_mode][value] >> 4)) {
+      exact = false;
+    }
+
+    unsigned char toned = tone->tone[fast_mode][value];
+    if (toned > tone->snap_margin && toned < 255 - tone->snap_margin) {
+      middle += histogram[value];
+    }
+  }
+
+  if (total == 0 || exact) {
+    return EPD_TONE_EXACT;
+  }
+
+  if (middle * 1000 <= total * tone->snap_tolerance) {
+    return EPD_TONE_BIMODAL;
+  }
+
+  return EPD_TONE_GREY;
+}
+
+static int
+parse_mode(
+  const char *name
+)
+{
+  if (strcmp(name, "*") == 0) {
+    return EPD_UPD_COUNT;
+  }
+
+  return epd_update_mode_from_string(name);
+}
+
+int
+epd_tone_load(
+  struct epd_tone *tone
+)
+{
+  /* Start again from the defaults, so deleting a line from the file
+     and reloading undoes it. */
+  for (int mode = 0; mode < EPD_UPD_COUNT; mode++) {
+    tone->curves[mode] = default_curve;
+  }
+
+  if (tone->path == NULL) {
+    epd_tone_compile(tone);
+    return 0;
+  }
+
+  FILE *file = fopen(tone->path, "r");
+  if (file == NULL) {
+    wlr_log(WLR_ERROR, "epd_tone: cannot open %s, using default curves",
+            tone->path);
+    epd_tone_compile(tone);
+    return -1;
+  }
+
+  char line[256];
+  unsigned int line_number = 0;
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line_number += 1;
+
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+
+    char name[16];
+    unsigned int black_point, white_point;
+    float contrast, gamma;
+
+    int fields = sscanf(line, "%15s %u %u %f %f", name, &black_point,
+                        &white_point, &contrast, &gamma);
+    if (fields <= 0) {
+      continue;                 // blank line
+    }
+
+    int mode = parse_mode(name);
+    if (fields != 5 || mode < 0 || black_point >= white_point
+        || white_point > 255 || contrast <= 0.0f || gamma <= 0.0f) {
+      wlr_log(WLR_ERROR, "epd_tone: %s:%u: ignoring invalid curve",
+              tone->path, line_number);
+      continue;
+    }
+
+    struct epd_tone_curve curve = {
+      .black_point = black_point,
+      .white_point = white_point,
+      .contrast = contrast,
+      .gamma = gamma,
+    };
+
+    for (int i = 0; i < EPD_UPD_COUNT; i++) {
+      if (mode == EPD_UPD_COUNT || mode == i) {
+        tone->curves[i] = curve;
+      }
+    }
+  }
+
+  fclose(file);
+
+  epd_tone_compile(tone);
+  wlr_log(WLR_INFO, "epd_tone: loaded curves from %s", tone->path);
+  return 0;
+}
+
+void
+epd_tone_init(
+  struct epd_tone *tone,
+  const char *path
+)
+{
+  memset(tone, 0, sizeof(struct epd_tone));
+  tone->path = path;
+  tone->snap_margin =
+    env_get_int("EPD_WM_SNAP_MARGIN", EPD_TONE_DEFAULT_SNAP_MARGIN);
+  tone->snap_tolerance =
+    env_get_int("EPD_WM_SNAP_TOLERANCE", EPD_TONE_DEFAULT_SNAP_TOLERANCE);
+  epd_tone_load(tone);
+}
@@ -0,0 +1,68 @@
+#ifndef EPD_TONE_H
+#define EPD_TONE_H
+
+#include <epd/epd_driver.h>
+
+// Shape of the grey ramp for one waveform. Values are applied in the
+// order listed: black/white points, then contrast, then gamma.
+struct epd_tone_curve
+{
+  unsigned char black_point;    // input at or below this is black
+  unsigned char white_point;    // input at or above this is white
+  float contrast;               // around mid grey, 1.0 is unchanged
+  float gamma;                  // output = input ^ gamma, 1.0 is linear
+};
+
+#define EPD_TONE_DEFAULT_SNAP_MARGIN 48     // grey levels
+#define EPD_TONE_DEFAULT_SNAP_TOLERANCE 20  // per mille
+
+// What a region's histogram says about how it can be inked
+enum epd_tone_content
+{
+  EPD_TONE_GREY,                // needs the grey levels
+  EPD_TONE_BIMODAL,             // nearly all near black or white
+  EPD_TONE_EXACT,               // 1 bit looks identical to 16 levels
+};
+
+struct epd_tone
+{
+  struct epd_tone_curve curves[EPD_UPD_COUNT];
+
+  // Compiled tables, indexed by [epd_update_mode][grey]. `tone` is the
+  // curve on its own (what the ditherer works from) and `level` is
+  // the curve snapped to the waveform's levels (what we send when
+  // not dithering).
+  unsigned char tone[EPD_UPD_COUNT][256];
+  unsigned char level[EPD_UPD_COUNT][256];
+
+  // Optional calibration file, see epd_tone_load
+  const char *path;
+
+  // Adaptive snapping: a region counts as bimodal when no more than
+  // snap_tolerance per mille of its pixels are further than
+  // snap_margin from black or white (after the tone curve).
+  unsigned int snap_margin;
+  unsigned int snap_tolerance;
+};
+
+void epd_tone_init(
+  struct epd_tone *tone,
+  const char *path
+);
+
+int epd_tone_load(
+  struct epd_tone *tone
+);
+
+void epd_tone_compile(
+  struct epd_tone *tone
+);
+
+enum epd_tone_content epd_tone_classify(
+  struct epd_tone *tone,
+  unsigned int histogram[256],
+  enum epd_update_mode fast_mode,
+  enum epd_update_mode quality_mode
+);
+
+#endif
@@ -0,0 +1,313 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <wlr/util/log.h>
+
+#include <epd/epd_output.h>
+#include <epd/epd_wet_ink.h>
+
+#include <utils/box.h>
+#include <utils/env.h>
+
+
+/* Wet ink
+
+   Writing with a pen on the panel, each bit of stroke has to go to the
+   client, be drawn, read back, converted and inked before it shows:
+   easily half a second behind the pen.
+
+   With wet ink on, we draw the stroke ourselves as the touch events
+   come in: a black line along the primary touch point, composited onto
+   a copy of epd_pixels around each new segment and inked with A2. The
+   client still gets the events and draws the stroke for real.
+
+   Until the stroke settles, the client's frames are inked with it
+   still on top (see epd_wet_ink_composite), or a frame lagging behind
+   the pen would wipe out the tip of the stroke. `settle` ms after the
+   pen lifts the two are reconciled: the stroke is dropped and its
+   bounding box inked from target_pixels, with whatever the client
+   drew there by then.
+
+   This is off by default. Outside of drawing apps a drag would leave
+   a line behind until it settles.
+ */
+
+
+static void
+mark_point(
+  struct epd_wet_ink *ink,
+  int x,
+  int y,
+  pixman_box32_t * bounds
+)
+{
+  unsigned int width = epd_output_get_width(&ink->output->wlr_output);
+  int half = ink->width / 2;
+
+  for (int py = y - half; py < y - half + ink->width; py++) {
+    if (py < bounds->y1 || py >= bounds->y2) {
+      continue;
+    }
+
+    for (int px = x - half; px < x - half + ink->width; px++) {
+      if (px >= bounds->x1 && px < bounds->x2) {
+        ink->mask[py * width + px] = 1;
+      }
+    }
+  }
+}
+
+static void
+draw_segment(
+  struct epd_wet_ink *ink,
+  int x0,
+  int y0,
+  int x1,
+  int y1
+)
+{
+  struct epd_output *output = ink->output;
+  int width = epd_output_get_width(&output->wlr_output);
+  int height = epd_output_get_height(&output->wlr_output);
+  int half = ink->width / 2;
+
+  pixman_box32_t box = {
+    .x1 = (x0 < x1 ? x0 : x1) - half,
+    .y1 = (y0 < y1 ? y0 : y1) - half,
+    .x2 = (x0 > x1 ? x0 : x1) - half + ink->width,
+    .y2 = (y0 > y1 ? y0 : y1) - half + ink->width,
+  };
+
+  box.x1 = box.x1 < 0 ? 0 : box.x1;
+  box.y1 = box.y1 < 0 ? 0 : box.y1;
+  box.x2 = box.x2 > width ? width : box.x2;
+  box.y2 = box.y2 > height ? height : box.y2;
+
+  if (box.x1 >= box.x2 || box.y1 >= box.y2) {
+    return;
+  }
+
+  /* Bresenham */
+  int dx = abs(x1 - x0);
+  int dy = -abs(y1 - y0);
+  int step_x = x0 < x1 ? 1 : -1;
+  int step_y = y0 < y1 ? 1 : -1;
+  int error = dx + dy;
+
+  while (true) {
+    mark_point(ink, x0, y0, &box);
+
+    if (x0 == x1 && y0 == y1) {
+      break;
+    }
+
+    int error2 = 2 * error;
+    if (error2 >= dy) {
+      error += dy;
+      x0 += step_x;
+    }
+    if (error2 <= dx) {
+      error += dx;
+      y0 += step_y;
+    }
+  }
+
+  /* Earlier segments crossing this box are wet too */
+  unsigned char black = output->tone.level[EPD_UPD_A2][0];
+
+  for (int y = box.y1; y < box.y2; y++) {
+    for (int x = box.x1; x < box.x2; x++) {
+      int i = y * width + x;
+      ink->frame[i] = ink->mask[i] ? black : output->epd_pixels[i];
+    }
+  }
+
+  epd_transfer_image_region(&output->epd, box.x1, box.y1,
+                            box.x2 - box.x1, box.y2 - box.y1, ink->frame);
+  epd_idle_wake(&output->idle);
+  epd_display_area(&output->epd, box.x1, box.y1, box.x2 - box.x1,
+                   box.y2 - box.y1, EPD_UPD_A2, 0);
+  epd_scheduler_busy(&output->scheduler, &box, EPD_UPD_A2);
+  epd_cursor_damage(&output->cursor, &box);
+
+  if (!ink->wet) {
+    ink->wet_box = box;
+    ink->wet = true;
+  } else {
+    ink->wet_box = box_union(&ink->wet_box, &box);
+  }
+}
+
+static int
+handle_settle_timer(
+  void *data
+)
+{
+  struct epd_wet_ink *ink = data;
+  struct epd_output *output = ink->output;
+
+  if (ink->down || !ink->wet) {
+    return 0;
+  }
+
+  /* Put back whatever the client has drawn there by now */
+  unsigned int width = epd_output_get_width(&output->wlr_output);
+  for (int y = ink->wet_box.y1; y < ink->wet_box.y2; y++) {
+    memset(ink->mask + y * width + ink->wet_box.x1, 0,
+           ink->wet_box.x2 - ink->wet_box.x1);
+  }
+
+  ink->wet = false;
+  epd_output_ink(output, &ink->wet_box, output->update_mode,
+                 EPD_INK_BACKGROUND);
+  return 0;
+}
+
+void
+epd_wet_ink_down(
+  struct epd_wet_ink *ink,
+  int x,
+  int y
+)
+{
+  if (!ink->enabled || ink->mask == NULL) {
+    return;
+  }
+
+  ink->down = true;
+  ink->last_x = x;
+  ink->last_y = y;
+  draw_segment(ink, x, y, x, y);
+}
+
+void
+epd_wet_ink_motion(
+  struct epd_wet_ink *ink,
+  int x,
+  int y
+)
+{
+  if (!ink->down || (x == ink->last_x && y == ink->last_y)) {
+    return;
+  }
+
+  draw_segment(ink, ink->last_x, ink->last_y, x, y);
+  ink->last_x = x;
+  ink->last_y = y;
+}
+
+void
+epd_wet_ink_up(
+  struct epd_wet_ink *ink
+)
+{
+  if (!ink->down) {
+    return;
+  }
+
+  ink->down = false;
+  wl_event_source_timer_update(ink->timer, ink->settle);
+}
+
+void
+epd_wet_ink_composite(
+  struct epd_wet_ink *ink,
+  unsigned char *pixels,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode
+)
+{
+  if (!ink->wet || !box_intersects(box, &ink->wet_box)) {
+    return;
+  }
+
+  unsigned int width = epd_output_get_width(&ink->output->wlr_output);
+  unsigned char black = ink->output->tone.level[update_mode][0];
+
+  int x1 = box->x1 > ink->wet_box.x1 ? box->x1 : ink->wet_box.x1;
+  int y1 = box->y1 > ink->wet_box.y1 ? box->y1 : ink->wet_box.y1;
+  int x2 = box->x2 < ink->wet_box.x2 ? box->x2 : ink->wet_box.x2;
+  int y2 = box->y2 < ink->wet_box.y2 ? box->y2 : ink->wet_box.y2;
+
+  for (int y = y1; y < y2; y++) {
+    for (int x = x1; x < x2; x++) {
+      if (ink->mask[y * width + x]) {
+        pixels[y * width + x] = black;
+      }
+    }
+  }
+}
+
+void
+epd_wet_ink_resize(
+  struct epd_wet_ink *ink,
+  unsigned int width,
+  unsigned int height
+)
+{
+  if (!ink->enabled) {
+    return;
+  }
+
+  free(ink->mask);
+  free(ink->frame);
+  ink->mask = calloc(width * height, 1);
+  ink->frame = malloc(width * height);
+  ink->wet = false;
+  ink->down = false;
+}
+
+void
+epd_wet_ink_init(
+  struct epd_wet_ink *ink,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+)
+{
+  memset(ink, 0, sizeof(struct epd_wet_ink));
+
+  ink->output = output;
+  ink->enabled = env_get_int("EPD_WM_WET_INK", 0) != 0;
+  ink->width = env_get_int("EPD_WM_WET_INK_WIDTH", EPD_WET_INK_DEFAULT_WIDTH);
+  ink->settle = env_get_int("EPD_WM_WET_INK_SETTLE",
+                            EPD_WET_INK_DEFAULT_SETTLE);
+  ink->timer = wl_event_loop_add_timer(event_loop, handle_settle_timer, ink);
+
+  if (ink->width < 1) {
+    ink->width = 1;
+  }
+  if (ink->settle < 1) {
+    ink->settle = 1;
+  }
+
+  if (ink->enabled) {
+    wlr_log(WLR_INFO, "epd_wet_ink: drawing strokes %i pixels wide",
+            ink->width);
+  }
+}
+
+void
+epd_wet_ink_finish(
+  struct epd_wet_ink *ink
+)
+{
+  if (ink->timer) {
+    wl_event_source_remove(ink->timer);
+    ink->timer = NULL;
+  }
+
+  free(ink->mask);
+  free(ink->frame);
+  ink->mask = NULL;
+  ink->frame = NULL;
+}
@@ -0,0 +1,81 @@
+#ifndef EPD_WET_INK_H
+#define EPD_WET_INK_H
+
+#include <pixman.h>
+#include <stdbool.h>
+#include <wayland-server.h>
+
+#include <epd/epd_driver.h>
+
+#define EPD_WET_INK_DEFAULT_WIDTH 3     // pixels
+#define EPD_WET_INK_DEFAULT_SETTLE 1000 // ms
+
+struct epd_output;
+
+// Draws touch and pen strokes on the panel straight from input events,
+// ahead of the client, until the client's own frames catch up.
+struct epd_wet_ink
+{
+  struct epd_output *output;
+  struct wl_event_source *timer;
+
+  bool enabled;
+  int width;                    // stroke width, pixels
+  int settle;                   // ms after the stroke before reconciling
+
+  bool down;
+  int last_x, last_y;
+
+  // Pixels drawn that aren't (yet) in epd_pixels
+  bool wet;
+  pixman_box32_t wet_box;
+  unsigned char *mask;          // 1 per wet pixel, output sized
+
+  // epd_pixels with the stroke on top, only valid around the stroke
+  unsigned char *frame;
+};
+
+void epd_wet_ink_init(
+  struct epd_wet_ink *ink,
+  struct epd_output *output,
+  struct wl_event_loop *event_loop
+);
+
+void epd_wet_ink_resize(
+  struct epd_wet_ink *ink,
+  unsigned int width,
+  unsigned int height
+);
+
+void epd_wet_ink_finish(
+  struct epd_wet_ink *ink
+);
+
+// The primary touch point went down, moved, or lifted, in buffer
+// coordinates
+void epd_wet_ink_down(
+  struct epd_wet_ink *ink,
+  int x,
+  int y
+);
+
+void epd_wet_ink_motion(
+  struct epd_wet_ink *ink,
+  int x,
+  int y
+);
+
+void epd_wet_ink_up(
+  struct epd_wet_ink *ink
+);
+
+// Put the wet stroke back on top of pixels (epd_pixels, just
+// quantised for update_mode) within box, before they're inked
+void epd_wet_ink_composite(
+  struct epd_wet_ink *ink,
+  unsigned char *pixels,
+  pixman_box32_t * box,
+  enum epd_update_mode update_mode
+);
+
+#endif
@@ -29,6 +29,11 @@
 #include <wlr/types/wlr_idle_inhibit_v1.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_server_decoration.h>
+#include <wlr/types/wlr_text_input_v3.h>
+#include <wlr/types/wlr_virtual_keyboard_v1.h>
+#ifdef EPD_WM_HAS_VIRTUAL_POINTER
+#include <wlr/types/wlr_virtual_pointer_v1.h>
+#endif
 #include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/types/wlr_xdg_decoration_v1.h>
 #include <wlr/types/wlr_xdg_shell.h>
@@ -39,6 +44,7 @@
 #include "wm/output.h"
 #include "wm/seat.h"
 #include "wm/server.h"
+#include "wm/text_input_v3.h"
 #include "wm/view.h"
 #include "wm/xdg_shell.h"
 #include "wm/xwayland.h"
@@ -48,6 +54,8 @@
 
 #include "hacks/wlr_backend_multi.h"
 
+#include "utils/trace.h"
+
 static bool
 spawn_primary_client(
   char *argv[],
@@ -120,6 +128,8 @@ usage(
   fprintf(file, "Usage: %s [OPTIONS] [--] APPLICATION\n"
           "\n"
           " -d\t Don't draw client side decorations, when possible\n"
+          " -H\t Run headless: no session, no input devices, and\n"
+          "\t EPD_WM_DEVICE defaults to null\n"
           " -r\t Rotate the output 90 degrees clockwise, specify up to three times\n"
 #ifdef DEBUG
           " -D\t Turn on damage tracking debugging\n"
@@ -138,14 +148,17 @@ parse_args(
 {
   int c;
 #ifdef DEBUG
-  while ((c = getopt(argc, argv, "drDh")) != -1) {
+  while ((c = getopt(argc, argv, "dHrDh")) != -1) {
 #else
-  while ((c = getopt(argc, argv, "drh")) != -1) {
+  while ((c = getopt(argc, argv, "dHrh")) != -1) {
 #endif
     switch (c) {
     case 'd':
       server->xdg_decoration = true;
       break;
+    case 'H':
+      server->headless = true;
+      break;
     case 'r':
       server->output_transform++;
       if (server->output_transform > WL_OUTPUT_TRANSFORM_270) {
@@ -208,11 +221,26 @@ main(
   wlr_log_init(WLR_ERROR, NULL);
 #endif
 
+  /* Headless runs are for benchmarking the compositor: no display
+     unless asked for, and stage timings every so many commits */
+  if (server.headless) {
+    setenv("EPD_WM_DEVICE", "null", false);
+    setenv("EPD_WM_STATS", "100", false);
+  }
+
+  const char *trace_path = getenv("EPD_WM_TRACE");
+  if (trace_path != NULL && strcmp(trace_path, "") != 0
+      && trace_init(trace_path) != 0) {
+    wlr_log_errno(WLR_ERROR, "Cannot write a trace to %s", trace_path);
+  }
+
   if (getenv("EPD_WM_DEVICE") == NULL
       || strcmp(getenv("EPD_WM_DEVICE"), "") == 0
-      || strncmp("/dev/sg", getenv("EPD_WM_DEVICE"), 7) != 0) {
+      || (strncmp("/dev/sg", getenv("EPD_WM_DEVICE"), 7) != 0
+          && strcmp("emulator", getenv("EPD_WM_DEVICE")) != 0
+          && strcmp("null", getenv("EPD_WM_DEVICE")) != 0)) {
     wlr_log(WLR_ERROR,
-            "Set the EPD_WM_DEVICE environment variable to the location of the displays SCSI generic device. It should be of the form /dev/sgN (e.g. /dev/sg1). Please triple check this is the correct device beforehand. Otherwise this software might do bad things to your hard drive, for example.");
+            "Set the EPD_WM_DEVICE environment variable to the location of the displays SCSI generic device. It should be of the form /dev/sgN (e.g. /dev/sg1). Please triple check this is the correct device beforehand. Otherwise this software might do bad things to your hard drive, for example. Use EPD_WM_DEVICE=emulator (or null) to run without a display.");
   }
 
   char sg_device[1024] = { 0 };
@@ -283,29 +311,35 @@ main(
     goto end;
   }
 
-  wlr_log(WLR_INFO, "Adding a session to multi-backend");
-  multi->session = wlr_session_create(server.wl_display);
-  if (!multi->session) {
-    wlr_log(WLR_ERROR, "Failed to start a DRM session");
-    wlr_backend_destroy(backend);
-    ret = 1;
-    goto end;
-  }
-  wlr_log(WLR_INFO, "Adding a session to multi-backend: success");
-
-  wlr_log(WLR_INFO, "Adding libinput backend to multi-backend");
-  struct wlr_backend *libinput_backend =
-    wlr_libinput_backend_create(server.wl_display, multi->session);
-  if (!libinput_backend) {
-    // We need input events: if this fails, exit.
-    wlr_log(WLR_ERROR, "Failed to start libinput backend");
-    wlr_session_destroy(multi->session);
-    wlr_backend_destroy(backend);
-    ret = 1;
-    goto end;
+  /* Headless, there are no devices of our own to take over: clients
+     (or a virtual keyboard, or nothing at all) drive what's shown. */
+  if (server.headless) {
+    wlr_log(WLR_INFO, "Running headless, without a session or input");
+  } else {
+    wlr_log(WLR_INFO, "Adding a session to multi-backend");
+    multi->session = wlr_session_create(server.wl_display);
+    if (!multi->session) {
+      wlr_log(WLR_ERROR, "Failed to start a DRM session");
+      wlr_backend_destroy(backend);
+      ret = 1;
+      goto end;
+    }
+    wlr_log(WLR_INFO, "Adding a session to multi-backend: success");
+
+    wlr_log(WLR_INFO, "Adding libinput backend to multi-backend");
+    struct wlr_backend *libinput_backend =
+      wlr_libinput_backend_create(server.wl_display, multi->session);
+    if (!libinput_backend) {
+      // We need input events: if this fails, exit.
+      wlr_log(WLR_ERROR, "Failed to start libinput backend");
+      wlr_session_destroy(multi->session);
+      wlr_backend_destroy(backend);
+      ret = 1;
+      goto end;
+    }
+    wlr_multi_backend_add(backend, libinput_backend);
+    wlr_log(WLR_INFO, "Adding libinput backend to multi-backend: success");
   }
-  wlr_multi_backend_add(backend, libinput_backend);
-  wlr_log(WLR_INFO, "Adding libinput backend to multi-backend: success");
 
   wlr_log(WLR_INFO, "Adding epd backend to multi-backend");
   struct wlr_backend *epd_backend =
@@ -399,6 +433,16 @@ main(
     goto end;
   }
 
+#ifdef EPD_WM_HAS_PRESENTATION
+  server.presentation =
+    wlr_presentation_create(server.wl_display, server.backend);
+  if (!server.presentation) {
+    wlr_log(WLR_ERROR, "Unable to create the presentation interface");
+    ret = 1;
+    goto end;
+  }
+#endif
+
   /* 6. Now we are setting up desktop environment/shell type stuff:
      - Users
      - Idle/suspend/...
@@ -421,6 +465,46 @@ main(
                 &server.new_idle_inhibitor_v1);
   wl_list_init(&server.inhibitors);
 
+  /* We don't do input methods, but text-input-v3 tells us where the
+     focused client's text cursor is, so typing can be inked first. */
+  wl_list_init(&server.text_inputs);
+  server.text_input_v3 = wlr_text_input_manager_v3_create(server.wl_display);
+  if (!server.text_input_v3) {
+    wlr_log(WLR_ERROR, "Cannot create the text input manager");
+    ret = 1;
+    goto end;
+  }
+  server.new_text_input_v3.notify = handle_text_input_v3_new;
+  wl_signal_add(&server.text_input_v3->events.text_input,
+                &server.new_text_input_v3);
+
+  /* Virtual keyboards and pointers let a script type and click, so
+     latency can be measured the same way every time (see
+     contrib/typing-benchmark) */
+  struct wlr_virtual_keyboard_manager_v1 *virtual_keyboard_v1 =
+    wlr_virtual_keyboard_manager_v1_create(server.wl_display);
+  if (!virtual_keyboard_v1) {
+    wlr_log(WLR_ERROR, "Cannot create the virtual keyboard manager");
+    ret = 1;
+    goto end;
+  }
+  server.new_virtual_keyboard_v1.notify = handle_virtual_keyboard_v1_new;
+  wl_signal_add(&virtual_keyboard_v1->events.new_virtual_keyboard,
+                &server.new_virtual_keyboard_v1);
+
+#ifdef EPD_WM_HAS_VIRTUAL_POINTER
+  struct wlr_virtual_pointer_manager_v1 *virtual_pointer_v1 =
+    wlr_virtual_pointer_manager_v1_create(server.wl_display);
+  if (!virtual_pointer_v1) {
+    wlr_log(WLR_ERROR, "Cannot create the virtual pointer manager");
+    ret = 1;
+    goto end;
+  }
+  server.new_virtual_pointer_v1.notify = handle_virtual_pointer_v1_new;
+  wl_signal_add(&virtual_pointer_v1->events.new_virtual_pointer,
+                &server.new_virtual_pointer_v1);
+#endif
+
   /* TODO: What is this xdg shell for? My guess is that it implements
      the xdg specification for us. */
   xdg_shell = wlr_xdg_shell_create(server.wl_display);
@@ -551,5 +635,6 @@ end:
   /* This function is not null-safe, but we only ever get here
      with a proper wl_display. */
   wl_display_destroy(server.wl_display);
+  trace_finish();
   return ret;
 }
@@ -0,0 +1,74 @@
+#ifndef EPD_UTILS_BOX_H
+#define EPD_UTILS_BOX_H
+
+
+#include <pixman.h>
+#include <stdbool.h>
+
+
+/* Box arithmetic
+
+   Damage, inks, busy areas and the rest are all pixman boxes: x1 and
+   y1 inclusive, x2 and y2 exclusive. These are small enough, and used
+   in inner enough loops, to live here as inlines.
+ */
+
+
+static inline bool
+box_intersects(
+  const pixman_box32_t * a,
+  const pixman_box32_t * b
+)
+{
+  return a->x1 < b->x2 && b->x1 < a->x2 && a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+
+static inline bool
+box_contains(
+  const pixman_box32_t * outer,
+  const pixman_box32_t * inner
+)
+{
+  return outer->x1 <= inner->x1 && outer->y1 <= inner->y1
+    && outer->x2 >= inner->x2 && outer->y2 >= inner->y2;
+}
+
+
+static inline bool
+box_equal(
+  const pixman_box32_t * a,
+  const pixman_box32_t * b
+)
+{
+  return a->x1 == b->x1 && a->y1 == b->y1 && a->x2 == b->x2 && a->y2 == b->y2;
+}
+
+
+// The smallest box covering both
+static inline pixman_box32_t
+box_union(
+  const pixman_box32_t * a,
+  const pixman_box32_t * b
+)
+{
+  pixman_box32_t result = {
+    .x1 = a->x1 < b->x1 ? a->x1 : b->x1,
+    .y1 = a->y1 < b->y1 ? a->y1 : b->y1,
+    .x2 = a->x2 > b->x2 ? a->x2 : b->x2,
+    .y2 = a->y2 > b->y2 ? a->y2 : b->y2,
+  };
+  return result;
+}
+
+
+static inline long long
+box_area(
+  const pixman_box32_t * box
+)
+{
+  return (long long) (box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+
+#endif
@@ -0,0 +1,562 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/dither.h>
+
+
+/* Dithering
+
+   The 1 and 2 bit waveforms are the fast ones, but plain thresholds
+   (see pgm_filter_one_bit_pixel) turn anti-aliasing and images into
+   blobs. Dithering trades spatial resolution for apparent grey levels.
+
+   Ordered dithering compares each pixel against a threshold taken
+   from a small matrix tiled across the screen. Since the threshold
+   only depends on the pixel's absolute position, re-dithering any
+   sub-rectangle gives the same result: partial updates don't shimmer
+   at their edges. We have two matrices: Bayer (cheap, regular
+   cross-hatch) and blue noise (no visible pattern, generated once at
+   startup).
+
+   For N levels a pixel v gets level index
+
+       sum over k = 1..N-1 of [ v > ((k - 1) * 255 + t) / (N - 1) ]
+
+   where t in [0, 254] is the matrix threshold. The right hand side
+   only depends on k and position, so we precompute one "plane" of
+   thresholds per k. The inner loop is then N-1 byte compares per
+   pixel, which we do 16 pixels at a time.
+
+   Floyd-Steinberg error diffusion looks best for images but it is
+   inherently not tile stable: the error carried into a pixel depends
+   on where the rectangle started.
+ */
+
+
+#define DITHER_BAYER_SIZE 16
+#define DITHER_BLUE_NOISE_SIZE 64
+#define DITHER_MAX_LEVELS 16
+
+#define DITHER_VEC_SIZE 16
+
+typedef unsigned char dither_vec __attribute__((vector_size(DITHER_VEC_SIZE)));
+
+
+struct dither_planes
+{
+  unsigned int size;            // the matrix is size x size
+  unsigned int levels_count;
+
+  // (levels_count - 1) planes of size rows. Each row is stored twice
+  // over so a DITHER_VEC_SIZE run starting anywhere in it never wraps.
+  unsigned char *thresholds;
+};
+
+static struct dither_planes *bayer_planes[DITHER_MAX_LEVELS + 1];
+static struct dither_planes *blue_noise_planes[DITHER_MAX_LEVELS + 1];
+static unsigned char *blue_noise_matrix;
+
+
+int
+dither_method_from_string(
+  const char *name
+)
+{
+  if (strcmp(name, "none") == 0) {
+    return DITHER_NONE;
+  }
+  if (strcmp(name, "bayer") == 0) {
+    return DITHER_BAYER;
+  }
+  if (strcmp(name, "blue-noise") == 0) {
+    return DITHER_BLUE_NOISE;
+  }
+  if (strcmp(name, "floyd-steinberg") == 0) {
+    return DITHER_FLOYD_STEINBERG;
+  }
+  return -1;
+}
+
+const char *
+dither_method_to_string(
+  enum dither_method method
+)
+{
+  switch (method) {
+  case DITHER_BAYER:
+    return "bayer";
+  case DITHER_BLUE_NOISE:
+    return "blue-noise";
+  case DITHER_FLOYD_STEINBERG:
+    return "floyd-steinberg";
+  default:
+    return "none";
+  }
+}
+
+
+/* Threshold matrices ---------------------------------------------------------
+*/
+
+static unsigned int
+bayer_value(
+  unsigned int x,
+  unsigned int y,
+  unsigned int size
+)
+{
+  static const unsigned int base[2][2] = { {0, 2}, {3, 1} };
+
+  if (size == 1) {
+    return 0;
+  }
+
+  unsigned int half = size / 2;
+  return 4 * bayer_value(x % half, y % half, half) + base[y / half][x / half];
+}
+
+static unsigned char *
+blue_noise_generate(
+  unsigned int size
+)
+{
+  /* Void-and-cluster (Ulichney 1993). Every cell has an "energy": the
+     sum of a gaussian centred on each set cell. The tightest cluster
+     is the set cell with the highest energy, the largest void is the
+     empty cell with the lowest. Ranks are handed out by removing
+     clusters from, then adding voids to, an initial random pattern,
+     which spreads consecutive thresholds as far apart as possible.
+
+     This runs once, the first time blue noise is asked for.
+   */
+  unsigned int count = size * size;
+
+  float *gaussian = malloc(sizeof(float) * count);
+  float *energy = calloc(count, sizeof(float));
+  unsigned char *pattern = calloc(count, 1);
+  unsigned char *initial = calloc(count, 1);
+  unsigned int *rank = malloc(sizeof(unsigned int) * count);
+
+  /* Toroidal gaussian, sigma = 1.5 */
+  for (unsigned int y = 0; y < size; y++) {
+    for (unsigned int x = 0; x < size; x++) {
+      int dx = x < size / 2 ? (int) x : (int) x - (int) size;
+      int dy = y < size / 2 ? (int) y : (int) y - (int) size;
+      gaussian[x + y * size] = expf(-(dx * dx + dy * dy) / (2 * 1.5f * 1.5f));
+    }
+  }
+
+#define TOGGLE(cell, sign)                                                \
+  do {                                                                    \
+    unsigned int cx = (cell) % size, cy = (cell) / size;                  \
+    for (unsigned int py = 0; py < size; py++) {                          \
+      for (unsigned int px = 0; px < size; px++) {                        \
+        unsigned int gx = (px - cx + size) % size;                        \
+        unsigned int gy = (py - cy + size) % size;                        \
+        energy[px + py * size] += (sign) * gaussian[gx + gy * size];      \
+      }                                                                   \
+    }                                                                     \
+  } while (0)
+
+  /* Pick extremes among cells whose pattern value equals `set` */
+#define EXTREME(set, want_max, out)                                       \
+  do {                                                                    \
+    int found = -1;                                                       \
+    for (unsigned int i = 0; i < count; i++) {                            \
+      if (pattern[i] != (set)) {                                          \
+        continue;                                                         \
+      }                                                                   \
+      if (found < 0                                                       \
+          || ((want_max) ? energy[i] > energy[found]                      \
+              : energy[i] < energy[found])) {                             \
+        found = i;                                                        \
+      }                                                                   \
+    }                                                                     \
+    (out) = found;                                                        \
+  } while (0)
+
+  /* Initial pattern: ~10% of cells, from a fixed seed so the matrix
+     (and so the screen) is the same every run. */
+  unsigned int seed = 0x2545F491;
+  unsigned int ones = 0;
+  for (unsigned int i = 0; i < count / 10; i++) {
+    seed = seed * 1103515245 + 12345;
+    unsigned int cell = (seed >> 8) % count;
+    if (!pattern[cell]) {
+      pattern[cell] = 1;
+      TOGGLE(cell, 1.0f);
+      ones++;
+    }
+  }
+
+  /* Relax: move the tightest cluster into the largest void until that
+     stops changing anything. */
+  for (unsigned int iteration = 0; iteration < count; iteration++) {
+    int cluster, void_;
+    EXTREME(1, 1, cluster);
+    pattern[cluster] = 0;
+    TOGGLE(cluster, -1.0f);
+    EXTREME(0, 0, void_);
+    pattern[void_] = 1;
+    TOGGLE(void_, 1.0f);
+    if (void_ == cluster) {
+      break;
+    }
+  }
+  memcpy(initial, pattern, count);
+  float *initial_energy = malloc(sizeof(float) * count);
+  memcpy(initial_energy, energy, sizeof(float) * count);
+
+  /* Phase 1: rank the initial cells, tightest cluster last */
+  for (int r = ones - 1; r >= 0; r--) {
+    int cluster;
+    EXTREME(1, 1, cluster);
+    pattern[cluster] = 0;
+    TOGGLE(cluster, -1.0f);
+    rank[cluster] = r;
+  }
+
+  /* Phase 2: fill the largest voids. Past half way "largest void
+     among the empty cells" is the same as "tightest cluster of empty
+     cells", so this covers the usual third phase too. */
+  memcpy(pattern, initial, count);
+  memcpy(energy, initial_energy, sizeof(float) * count);
+  for (unsigned int r = ones; r < count; r++) {
+    int void_;
+    EXTREME(0, 0, void_);
+    pattern[void_] = 1;
+    TOGGLE(void_, 1.0f);
+    rank[void_] = r;
+  }
+
+#undef TOGGLE
+#undef EXTREME
+
+  unsigned char *matrix = malloc(count);
+  for (unsigned int i = 0; i < count; i++) {
+    matrix[i] = rank[i] * 255 / count;
+  }
+
+  free(gaussian);
+  free(energy);
+  free(initial_energy);
+  free(pattern);
+  free(initial);
+  free(rank);
+
+  return matrix;
+}
+
+static struct dither_planes *
+planes_create(
+  enum dither_method method,
+  unsigned int levels_count
+)
+{
+  unsigned int size;
+
+  if (method == DITHER_BAYER) {
+    size = DITHER_BAYER_SIZE;
+  } else {
+    size = DITHER_BLUE_NOISE_SIZE;
+    if (!blue_noise_matrix) {
+      blue_noise_matrix = blue_noise_generate(size);
+    }
+  }
+
+  struct dither_planes *planes = malloc(sizeof(struct dither_planes));
+  planes->size = size;
+  planes->levels_count = levels_count;
+  planes->thresholds = malloc((levels_count - 1) * size * 2 * size);
+
+  for (unsigned int k = 1; k < levels_count; k++) {
+    for (unsigned int y = 0; y < size; y++) {
+      unsigned char *row =
+        planes->thresholds + ((k - 1) * size + y) * 2 * size;
+
+      for (unsigned int x = 0; x < size; x++) {
+        /* t in [0, 254], so v = 255 always lands on the top level */
+        unsigned int t;
+        if (method == DITHER_BAYER) {
+          t = bayer_value(x, y, size) * 255 / (size * size);
+        } else {
+          t = blue_noise_matrix[x + y * size] * 254 / 255;
+        }
+
+        row[x] = row[x + size] = ((k - 1) * 255 + t) / (levels_count - 1);
+      }
+    }
+  }
+
+  return planes;
+}
+
+static struct dither_planes *
+planes_get(
+  enum dither_method method,
+  unsigned int levels_count
+)
+{
+  struct dither_planes **cache =
+    method == DITHER_BAYER ? bayer_planes : blue_noise_planes;
+
+  if (!cache[levels_count]) {
+    cache[levels_count] = planes_create(method, levels_count);
+  }
+
+  return cache[levels_count];
+}
+
+
+/* Quantisers -----------------------------------------------------------------
+*/
+
+static void
+dither_ordered(
+  struct dither_planes *planes,
+  const unsigned char *levels,
+  const unsigned char *tone,
+  const unsigned char *src,
+  unsigned char *dst,
+  unsigned int stride,
+  unsigned int x1,
+  unsigned int y1,
+  unsigned int x2,
+  unsigned int y2
+)
+{
+  unsigned int size = planes->size;
+  unsigned int planes_count = planes->levels_count - 1;
+
+  /* The EPD level tables are evenly spaced, which lets the vector
+     path turn a level index straight into a pixel value. */
+  unsigned char low = levels[0];
+  unsigned char step = (levels[planes_count] - levels[0]) / planes_count;
+  bool even = true;
+  for (unsigned int k = 0; k <= planes_count; k++) {
+    if (levels[k] != low + k * step) {
+      even = false;
+    }
+  }
+
+  /* Tone mapping is a table lookup, which doesn't vectorise, so do
+     it a row at a time into a scratch buffer first. The buffer is
+     indexed with absolute x, like src. */
+  unsigned char *toned = NULL;
+  if (tone) {
+    toned = malloc(x2);
+  }
+
+  for (unsigned int y = y1; y < y2; y++) {
+    const unsigned char *src_row = src + y * stride;
+    unsigned char *dst_row = dst + y * stride;
+    const unsigned char *plane_row =
+      planes->thresholds + (y % size) * 2 * size;
+
+    if (toned) {
+      for (unsigned int x = x1; x < x2; x++) {
+        toned[x] = tone[src_row[x]];
+      }
+      src_row = toned;
+    }
+
+    unsigned int x = x1;
+
+    if (even) {
+      for (; x + DITHER_VEC_SIZE <= x2; x += DITHER_VEC_SIZE) {
+        dither_vec value, threshold;
+        dither_vec index = { 0 };
+
+        memcpy(&value, src_row + x, DITHER_VEC_SIZE);
+
+        for (unsigned int k = 0; k < planes_count; k++) {
+          memcpy(&threshold,
+                 plane_row + k * size * 2 * size + x % size,
+                 DITHER_VEC_SIZE);
+          /* Comparisons give -1 (all bits set) for true */
+          index -= (dither_vec) (value > threshold);
+        }
+
+        dither_vec out = index * step + low;
+        memcpy(dst_row + x, &out, DITHER_VEC_SIZE);
+      }
+    }
+
+    for (; x < x2; x++) {
+      unsigned int index = 0;
+      for (unsigned int k = 0; k < planes_count; k++) {
+        index += src_row[x] > plane_row[k * size * 2 * size + x % size];
+      }
+      dst_row[x] = levels[index];
+    }
+  }
+
+  free(toned);
+}
+
+static unsigned char
+nearest_level(
+  const unsigned char *levels,
+  unsigned int levels_count,
+  int value,
+  int *error
+)
+{
+  unsigned int best = 0;
+  for (unsigned int k = 1; k < levels_count; k++) {
+    if (abs(value - levels[k]) < abs(value - levels[best])) {
+      best = k;
+    }
+  }
+
+  *error = value - levels[best];
+  return levels[best];
+}
+
+static void
+dither_floyd_steinberg(
+  const unsigned char *levels,
+  unsigned int levels_count,
+  const unsigned char *tone,
+  const unsigned char *src,
+  unsigned char *dst,
+  unsigned int stride,
+  unsigned int x1,
+  unsigned int y1,
+  unsigned int x2,
+  unsigned int y2
+)
+{
+  /* Levels are device values (white is 240, not 255), so stretch the
+     input onto the same range before diffusing any error. */
+  unsigned int width = x2 - x1;
+  int low = levels[0];
+  int high = levels[levels_count - 1];
+
+  // One spare entry either side so the kernel needs no edge checks
+  int *error_row = calloc(width + 2, sizeof(int));
+  int *error_next = calloc(width + 2, sizeof(int));
+
+  for (unsigned int y = y1; y < y2; y++) {
+    const unsigned char *src_row = src + y * stride;
+    unsigned char *dst_row = dst + y * stride;
+
+    for (unsigned int i = 0; i < width; i++) {
+      unsigned char grey = tone ? tone[src_row[x1 + i]] : src_row[x1 + i];
+      int value = low + grey * (high - low) / 255;
+      value += error_row[i + 1] / 16;
+
+      int error;
+      dst_row[x1 + i] = nearest_level(levels, levels_count, value, &error);
+
+      error_row[i + 2] += error * 7;
+      error_next[i] += error * 3;
+      error_next[i + 1] += error * 5;
+      error_next[i + 2] += error * 1;
+    }
+
+    int *swap = error_row;
+    error_row = error_next;
+    error_next = swap;
+    memset(error_next, 0, (width + 2) * sizeof(int));
+  }
+
+  free(error_row);
+  free(error_next);
+}
+
+static void
+dither_threshold(
+  const unsigned char *levels,
+  unsigned int levels_count,
+  const unsigned char *tone,
+  const unsigned char *src,
+  unsigned char *dst,
+  unsigned int stride,
+  unsigned int x1,
+  unsigned int y1,
+  unsigned int x2,
+  unsigned int y2
+)
+{
+  /* No dithering: pick the level whose band the value falls in */
+  for (unsigned int y = y1; y < y2; y++) {
+    for (unsigned int x = x1; x < x2; x++) {
+      unsigned char grey = src[x + y * stride];
+      if (tone) {
+        grey = tone[grey];
+      }
+      dst[x + y * stride] = levels[grey * levels_count / 256];
+    }
+  }
+}
+
+void
+dither_region(
+  enum dither_method method,
+  const unsigned char *levels,
+  unsigned int levels_count,
+  const unsigned char *tone,
+  const unsigned char *src,
+  unsigned char *dst,
+  unsigned int stride,
+  unsigned int x1,
+  unsigned int y1,
+  unsigned int x2,
+  unsigned int y2
+)
+{
+  if (levels_count < 2 || levels_count > DITHER_MAX_LEVELS
+      || x2 <= x1 || y2 <= y1) {
+    return;
+  }
+
+  switch (method) {
+  case DITHER_BAYER:
+  case DITHER_BLUE_NOISE:
+    dither_ordered(planes_get(method, levels_count), levels, tone,
+                   src, dst, stride, x1, y1, x2, y2);
+    break;
+  case DITHER_FLOYD_STEINBERG:
+    dither_floyd_steinberg(levels, levels_count, tone,
+                           src, dst, stride, x1, y1, x2, y2);
+    break;
+  default:
+    dither_threshold(levels, levels_count, tone,
+                     src, dst, stride, x1, y1, x2, y2);
+    break;
+  }
+}
+
+void
+dither_finish(
+  void
+)
+{
+  for (unsigned int i = 0; i <= DITHER_MAX_LEVELS; i++) {
+    struct dither_planes **caches[] = { &bayer_planes[i],
+      &blue_noise_planes[i]
+    };
+
+    for (unsigned int c = 0; c < 2; c++) {
+      if (*caches[c]) {
+        free((*caches[c])->thresholds);
+        free(*caches[c]);
+        *caches[c] = NULL;
+      }
+    }
+  }
+
+  free(blue_noise_matrix);
+  blue_noise_matrix = NULL;
+}
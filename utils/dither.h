@@ -0,0 +1,53 @@
+#ifndef EPD_UTILS_DITHER_H
+#define EPD_UTILS_DITHER_H
+
+
+enum dither_method
+{
+  DITHER_NONE = 0,
+  DITHER_BAYER,
+  DITHER_BLUE_NOISE,
+  DITHER_FLOYD_STEINBERG,
+};
+
+
+// Parse "none", "bayer", "blue-noise" or "floyd-steinberg". Returns
+// -1 for anything else.
+int dither_method_from_string(
+  const char *name
+);
+
+const char *dither_method_to_string(
+  enum dither_method method
+);
+
+// Quantise src onto `levels` (ascending, levels_count of them) inside
+// the rectangle [x1, x2) x [y1, y2), writing the result to dst. Both
+// buffers are one byte per pixel, `stride` bytes per row, and
+// addressed in absolute coordinates. The ordered methods key their
+// thresholds off those absolute coordinates, so dithering a small
+// rectangle gives exactly the same pixels as dithering a larger one
+// containing it.
+//
+// If `tone` is not NULL, each src value is looked up in it (256
+// entries) before being quantised.
+void dither_region(
+  enum dither_method method,
+  const unsigned char *levels,
+  unsigned int levels_count,
+  const unsigned char *tone,
+  const unsigned char *src,
+  unsigned char *dst,
+  unsigned int stride,
+  unsigned int x1,
+  unsigned int y1,
+  unsigned int x2,
+  unsigned int y2
+);
+
+void dither_finish(
+  void
+);
+
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#include <stdlib.h>
+
+#include <utils/env.h>
+
+int
+env_get_int(
+  const char *name,
+  int fallback
+)
+{
+  /* Most of the tuning knobs are environment variables (like
+     EPD_WM_DEVICE). An unset, empty or unparseable variable gives you
+     the fallback rather than zero.
+   */
+  const char *value = getenv(name);
+  if (value == NULL || *value == '\0') {
+    return fallback;
+  }
+
+  char *end;
+  long parsed = strtol(value, &end, 10);
+  if (*end != '\0') {
+    return fallback;
+  }
+
+  return (int) parsed;
+}
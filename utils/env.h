@@ -0,0 +1,11 @@
+#ifndef EPD_UTILS_ENV_H
+#define EPD_UTILS_ENV_H
+
+
+int env_get_int(
+  const char *name,
+  int fallback
+);
+
+
+#endif
@@ -176,6 +176,29 @@ pgm_print(
   return 0;
 }
 
+int
+pgm_save(
+  pgm * image,
+  char path[]
+)
+{
+  FILE *fd = fopen(path, "w");
+  if (fd == NULL) {
+    printf("Failed to open PGM file for writing.\n");
+    return -1;
+  }
+
+  size_t size = image->width * image->height * image->bytes_per_pixel;
+  fprintf(fd, "P5\n%u %u\n255\n", image->width, image->height);
+  if (fwrite(image->pixels, 1, size, fd) != size) {
+    printf("Failed to write PGM file.\n");
+    fclose(fd);
+    return -1;
+  }
+
+  return fclose(fd) == 0 ? 0 : -1;
+}
+
 pgm *
 pgm_generate_solid_color(
   unsigned int color,
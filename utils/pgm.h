@@ -30,6 +30,11 @@ int pgm_print(
   pgm * image
 );
 
+int pgm_save(
+  pgm * image,
+  char path[]
+);
+
 pgm *pgm_generate_solid_color(
   unsigned int color,
   unsigned int width,
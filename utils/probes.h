@@ -0,0 +1,62 @@
+#ifndef EPD_UTILS_PROBES_H
+#define EPD_UTILS_PROBES_H
+
+
+#include "config.h"
+
+
+/* Static probes
+
+   Built with -Dprobes=true, these are USDT probes (provider epd_wm)
+   that bpftrace, perf and friends can attach to while epd-wm runs,
+   for seeing what it's doing on a machine where rebuilding with more
+   logging isn't an option. Until something attaches, each is a nop.
+   Without the option they aren't there at all, and their arguments
+   aren't evaluated.
+
+   Probe names are one word so they can be written as is, e.g.
+   usdt:/usr/local/bin/epd-wm:epd_wm:display_area. See contrib/bpftrace
+   for what's there and what their arguments are.
+ */
+
+
+#ifdef EPD_WM_HAS_PROBES
+
+#include <sys/sdt.h>
+
+#define PROBE0(name) \
+  DTRACE_PROBE(epd_wm, name)
+#define PROBE1(name, a) \
+  DTRACE_PROBE1(epd_wm, name, a)
+#define PROBE2(name, a, b) \
+  DTRACE_PROBE2(epd_wm, name, a, b)
+#define PROBE3(name, a, b, c) \
+  DTRACE_PROBE3(epd_wm, name, a, b, c)
+#define PROBE4(name, a, b, c, d) \
+  DTRACE_PROBE4(epd_wm, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e) \
+  DTRACE_PROBE5(epd_wm, name, a, b, c, d, e)
+#define PROBE6(name, a, b, c, d, e, f) \
+  DTRACE_PROBE6(epd_wm, name, a, b, c, d, e, f)
+
+#else
+
+#define PROBE0(name) \
+  do { } while (0)
+#define PROBE1(name, a) \
+  do { (void) sizeof(a); } while (0)
+#define PROBE2(name, a, b) \
+  do { (void) sizeof(a); (void) sizeof(b); } while (0)
+#define PROBE3(name, a, b, c) \
+  do { PROBE2(name, a, b); (void) sizeof(c); } while (0)
+#define PROBE4(name, a, b, c, d) \
+  do { PROBE3(name, a, b, c); (void) sizeof(d); } while (0)
+#define PROBE5(name, a, b, c, d, e) \
+  do { PROBE4(name, a, b, c, d); (void) sizeof(e); } while (0)
+#define PROBE6(name, a, b, c, d, e, f) \
+  do { PROBE5(name, a, b, c, d, e); (void) sizeof(f); } while (0)
+
+#endif
+
+
+#endif
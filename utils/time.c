@@ -32,3 +32,30 @@ timespec_diff(
 
   return;
 }
+
+long long
+timespec_diff_ms(
+  struct timespec *start,
+  struct timespec *stop
+)
+{
+  return (long long) (stop->tv_sec - start->tv_sec) * 1000
+    + (stop->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+void
+timespec_add_ms(
+  struct timespec *time,
+  long long ms
+)
+{
+  long long nsec = time->tv_nsec + (ms % 1000) * 1000000;
+
+  time->tv_sec += ms / 1000 + nsec / 1000000000;
+  time->tv_nsec = nsec % 1000000000;
+
+  if (time->tv_nsec < 0) {
+    time->tv_sec -= 1;
+    time->tv_nsec += 1000000000;
+  }
+}
@@ -14,4 +14,16 @@ void timespec_diff(
 );
 
 
+long long timespec_diff_ms(
+  struct timespec *start,
+  struct timespec *stop
+);
+
+
+void timespec_add_ms(
+  struct timespec *time,
+  long long ms
+);
+
+
 #endif
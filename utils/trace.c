@@ -0,0 +1,280 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <utils/trace.h>
+
+
+/* Timeline tracing
+
+   With EPD_WM_TRACE set to a file name, everything from input events
+   to the panel's waveforms is written there as Chrome trace events,
+   which chrome://tracing and ui.perfetto.dev both open. Each track is
+   a row: input, the compositor's own work, USB commands and the
+   panel's waveforms (which overlap, so they're async events).
+
+   Inputs start arrows (flow events) that step through the next commit
+   that changed anything and end at the display command after that:
+   roughly, the refresh that showed what the input did. With lots of
+   input in flight the newest TRACE_MAX_FLOWS are kept.
+
+   Events are written with stdio through a large buffer. That's cheap,
+   but not free: tracing is for finding where the time goes, not for
+   leaving on.
+ */
+
+
+bool trace_enabled = false;
+
+static FILE *trace_file;
+static bool trace_first;
+static unsigned long long trace_next_id = 1;
+
+static unsigned long long input_flows[TRACE_MAX_FLOWS];
+static int input_flows_count;
+static unsigned long long committed_flows[TRACE_MAX_FLOWS];
+static int committed_flows_count;
+
+static const char *TRACK_NAMES[] = {
+  [TRACE_INPUT] = "input",
+  [TRACE_COMPOSITOR] = "compositor",
+  [TRACE_USB] = "usb",
+  [TRACE_PANEL] = "panel",
+};
+
+
+static void
+begin_event(
+  const char *phase,
+  enum trace_track track,
+  const char *name,
+  uint64_t ts
+)
+{
+  fprintf(trace_file, "%s{\"ph\": \"%s\", \"pid\": 1, \"tid\": %i, "
+          "\"ts\": %.3f, \"name\": \"%s\", \"cat\": \"%s\"",
+          trace_first ? "" : ",\n", phase, track, ts / 1000.0, name,
+          TRACK_NAMES[track]);
+  trace_first = false;
+}
+
+static void
+end_event(
+  const char *args_format,
+  va_list args
+)
+{
+  if (args_format != NULL) {
+    fprintf(trace_file, ", \"args\": {");
+    vfprintf(trace_file, args_format, args);
+    fprintf(trace_file, "}");
+  }
+  fprintf(trace_file, "}");
+}
+
+static void
+push_flow(
+  unsigned long long *flows,
+  int *count,
+  unsigned long long id
+)
+{
+  if (*count == TRACE_MAX_FLOWS) {
+    memmove(flows, flows + 1, (TRACE_MAX_FLOWS - 1) * sizeof(*flows));
+    *count -= 1;
+  }
+  flows[(*count)++] = id;
+}
+
+uint64_t
+trace_now(
+  void
+)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void
+trace_slice(
+  enum trace_track track,
+  const char *name,
+  uint64_t start,
+  uint64_t end,
+  const char *args_format,
+  ...
+)
+{
+  if (!trace_enabled) {
+    return;
+  }
+
+  begin_event("X", track, name, start);
+  fprintf(trace_file, ", \"dur\": %.3f", (end - start) / 1000.0);
+
+  va_list args;
+  va_start(args, args_format);
+  end_event(args_format, args);
+  va_end(args);
+}
+
+void
+trace_instant(
+  enum trace_track track,
+  const char *name,
+  const char *args_format,
+  ...
+)
+{
+  if (!trace_enabled) {
+    return;
+  }
+
+  begin_event("i", track, name, trace_now());
+  fprintf(trace_file, ", \"s\": \"t\"");
+
+  va_list args;
+  va_start(args, args_format);
+  end_event(args_format, args);
+  va_end(args);
+}
+
+void
+trace_async(
+  enum trace_track track,
+  const char *name,
+  uint64_t start,
+  uint64_t end,
+  const char *args_format,
+  ...
+)
+{
+  if (!trace_enabled) {
+    return;
+  }
+
+  unsigned long long id = trace_next_id++;
+
+  begin_event("b", track, name, start);
+  fprintf(trace_file, ", \"id\": %llu", id);
+  va_list args;
+  va_start(args, args_format);
+  end_event(args_format, args);
+  va_end(args);
+
+  begin_event("e", track, name, end);
+  fprintf(trace_file, ", \"id\": %llu}", id);
+}
+
+void
+trace_input(
+  const char *name,
+  const char *args_format,
+  ...
+)
+{
+  if (!trace_enabled) {
+    return;
+  }
+
+  /* Flow events attach to the slice they fall in, so give the event
+     a microsecond */
+  uint64_t now = trace_now();
+  unsigned long long id = trace_next_id++;
+
+  begin_event("X", TRACE_INPUT, name, now);
+  fprintf(trace_file, ", \"dur\": 1");
+  va_list args;
+  va_start(args, args_format);
+  end_event(args_format, args);
+  va_end(args);
+
+  begin_event("s", TRACE_INPUT, "input", now);
+  fprintf(trace_file, ", \"id\": %llu}", id);
+
+  push_flow(input_flows, &input_flows_count, id);
+}
+
+void
+trace_flow_commit(
+  uint64_t when
+)
+{
+  if (!trace_enabled) {
+    return;
+  }
+
+  for (int i = 0; i < input_flows_count; i++) {
+    begin_event("t", TRACE_COMPOSITOR, "input", when);
+    fprintf(trace_file, ", \"id\": %llu}", input_flows[i]);
+    push_flow(committed_flows, &committed_flows_count, input_flows[i]);
+  }
+  input_flows_count = 0;
+}
+
+void
+trace_flow_display(
+  uint64_t when
+)
+{
+  if (!trace_enabled) {
+    return;
+  }
+
+  for (int i = 0; i < committed_flows_count; i++) {
+    begin_event("f", TRACE_USB, "input", when);
+    fprintf(trace_file, ", \"id\": %llu, \"bp\": \"e\"}",
+            committed_flows[i]);
+  }
+  committed_flows_count = 0;
+}
+
+int
+trace_init(
+  const char *path
+)
+{
+  trace_file = fopen(path, "w");
+  if (trace_file == NULL) {
+    return -1;
+  }
+
+  setvbuf(trace_file, NULL, _IOFBF, 1 << 20);
+  fprintf(trace_file, "[\n");
+  trace_first = true;
+  trace_enabled = true;
+
+  for (int track = TRACE_INPUT; track <= TRACE_PANEL; track++) {
+    begin_event("M", track, "thread_name", 0);
+    fprintf(trace_file, ", \"args\": {\"name\": \"%s\"}}",
+            TRACK_NAMES[track]);
+  }
+  return 0;
+}
+
+void
+trace_finish(
+  void
+)
+{
+  if (!trace_enabled) {
+    return;
+  }
+
+  fprintf(trace_file, "\n]\n");
+  fclose(trace_file);
+  trace_file = NULL;
+  trace_enabled = false;
+}
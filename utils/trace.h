@@ -0,0 +1,99 @@
+#ifndef EPD_UTILS_TRACE_H
+#define EPD_UTILS_TRACE_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define TRACE_MAX_FLOWS 16
+
+
+// Rows in the timeline
+enum trace_track
+{
+  TRACE_INPUT = 1,
+  TRACE_COMPOSITOR,
+  TRACE_USB,
+  TRACE_PANEL,
+};
+
+
+// True while a trace is being written: check before doing any work
+// just for the trace.
+extern bool trace_enabled;
+
+
+// Start writing a Chrome trace (JSON array format) to path
+int trace_init(
+  const char *path
+);
+
+
+void trace_finish(
+  void
+);
+
+
+// ns, CLOCK_MONOTONIC
+uint64_t trace_now(
+  void
+);
+
+
+// Something on track that took from start to end. args_format, if not
+// NULL, gives the inside of a JSON object, like "\"bytes\": %u".
+void trace_slice(
+  enum trace_track track,
+  const char *name,
+  uint64_t start,
+  uint64_t end,
+  const char *args_format,
+  ...
+) __attribute__((format(printf, 5, 6)));
+
+
+// Something on track that happened just now
+void trace_instant(
+  enum trace_track track,
+  const char *name,
+  const char *args_format,
+  ...
+) __attribute__((format(printf, 3, 4)));
+
+
+// Something on track from start to end that may overlap others there
+void trace_async(
+  enum trace_track track,
+  const char *name,
+  uint64_t start,
+  uint64_t end,
+  const char *args_format,
+  ...
+) __attribute__((format(printf, 5, 6)));
+
+
+// An input event, which starts an arrow to the commit and then the
+// display command that show its effects
+void trace_input(
+  const char *name,
+  const char *args_format,
+  ...
+) __attribute__((format(printf, 2, 3)));
+
+
+// Continue arrows from the inputs since the last commit to this one,
+// which has a slice on TRACE_COMPOSITOR around when
+void trace_flow_commit(
+  uint64_t when
+);
+
+
+// End arrows from committed inputs at this display command, which has
+// a slice on TRACE_USB around when
+void trace_flow_display(
+  uint64_t when
+);
+
+
+#endif
@@ -12,6 +12,7 @@
 #include <wlr/types/wlr_idle.h>
 #include <wlr/types/wlr_idle_inhibit_v1.h>
 
+#include "epd/epd_output.h"
 #include "wm/idle_inhibit_v1.h"
 #include "wm/server.h"
 
@@ -37,6 +38,14 @@ idle_inhibit_v1_check_active(
      accordingly. */
   bool inhibited = !wl_list_empty(&server->inhibitors);
   wlr_idle_set_enabled(server->idle, NULL, !inhibited);
+
+  /* Something keeping the screen awake is most likely playing video,
+     so let the output switch to A2 sooner. */
+  if (server->output) {
+    struct epd_output *epd_output =
+      epd_output_from_output(server->output->wlr_output);
+    epd_animation_set_video_hint(&epd_output->animation, inhibited);
+  }
 }
 
 static void
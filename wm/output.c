@@ -22,15 +22,22 @@
 #endif
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_data_device.h>
+#include <wlr/types/wlr_idle.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_output_damage.h>
 #include <wlr/types/wlr_output_layout.h>
+#ifdef EPD_WM_HAS_PRESENTATION
+#include <wlr/types/wlr_presentation_time.h>
+#endif
 #include <wlr/types/wlr_surface.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/util/log.h>
 #include <wlr/util/region.h>
 
+#include "epd/epd_output.h"
+#include "utils/trace.h"
+
 #include "wm/output.h"
 #include "wm/server.h"
 #include "wm/view.h"
@@ -59,6 +66,35 @@ scissor_output(
   wlr_renderer_scissor(renderer, &box);
 }
 
+void
+output_box_to_buffer(
+  struct wlr_output *output,
+  pixman_box32_t * box
+)
+{
+  /* Views and the cursor live in layout coordinates, the EPD works on
+     the buffer, which is rotated when the output is (-r). Same as the
+     frame damage in handle_output_damage_frame. */
+  struct wlr_box wlr_box = {
+    .x = box->x1,
+    .y = box->y1,
+    .width = box->x2 - box->x1,
+    .height = box->y2 - box->y1,
+  };
+
+  int output_width, output_height;
+  wlr_output_transformed_resolution(output, &output_width, &output_height);
+  enum wl_output_transform transform =
+    wlr_output_transform_invert(output->transform);
+  wlr_box_transform(&wlr_box, &wlr_box, transform, output_width,
+                    output_height);
+
+  box->x1 = wlr_box.x;
+  box->y1 = wlr_box.y;
+  box->x2 = wlr_box.x + wlr_box.width;
+  box->y2 = wlr_box.y + wlr_box.height;
+}
+
 static void
 send_frame_done(
   struct wlr_surface *surface,
@@ -78,6 +114,7 @@ struct damage_data
   double x;
   double y;
   bool whole;
+  pixman_region32_t *view_damage;       // all of it, for epd_clients
 };
 
 static void
@@ -109,6 +146,10 @@ damage_surface(
 
   if (ddata->whole) {
     wlr_output_damage_add_box(output->damage, &box);
+    if (ddata->view_damage) {
+      pixman_region32_union_rect(ddata->view_damage, ddata->view_damage,
+                                 box.x, box.y, box.width, box.height);
+    }
   } else if (pixman_region32_not_empty(&surface->buffer_damage)) {
     pixman_region32_t damage;
     pixman_region32_init(&damage);
@@ -124,6 +165,9 @@ damage_surface(
     }
     pixman_region32_translate(&damage, box.x, box.y);
     wlr_output_damage_add(output->damage, &damage);
+    if (ddata->view_damage) {
+      pixman_region32_union(ddata->view_damage, ddata->view_damage, &damage);
+    }
     pixman_region32_fini(&damage);
   }
 }
@@ -137,6 +181,9 @@ struct render_data
   struct timespec *when;
   pixman_region32_t *damage;
   double x, y;
+#ifdef EPD_WM_HAS_PRESENTATION
+  struct wlr_presentation *presentation;
+#endif
 };
 
 static void
@@ -160,6 +207,10 @@ render_surface(
     return;
   }
 
+#ifdef EPD_WM_HAS_PRESENTATION
+  wlr_presentation_surface_sampled(rdata->presentation, surface);
+#endif
+
   double x = rdata->x + sx, y = rdata->y + sy;
   wlr_output_layout_output_coords(rdata->output_layout, output, &x, &y);
 
@@ -226,6 +277,7 @@ handle_output_damage_frame(
   struct cg_output *output = wl_container_of(listener, output, damage_frame);
   struct wlr_renderer *renderer =
     wlr_backend_get_renderer(output->server->backend);
+  uint64_t start = trace_now();
 
   struct timespec now;
   clock_gettime(CLOCK_MONOTONIC, &now);
@@ -270,6 +322,9 @@ handle_output_damage_frame(
     .output = output->wlr_output,
     .when = &now,
     .damage = &buffer_damage,
+#ifdef EPD_WM_HAS_PRESENTATION
+    .presentation = output->server->presentation,
+#endif
   };
 
   struct cg_view *view;
@@ -317,13 +372,42 @@ renderer_end:
 
 buffer_damage_finish:
   pixman_region32_fini(&buffer_damage);
+  trace_slice(TRACE_COMPOSITOR, "damage_frame", start, trace_now(), NULL);
 
+  /* A window whose last frame is still queued for the panel waits
+     for it to be sent, handle_output_sent lets it go. The present
+     event still comes once the waveforms have run. */
+  struct epd_output *epd_output = epd_output_from_output(output->wlr_output);
   wl_list_for_each_reverse(view, &output->server->views, link) {
-    view_for_each_surface(view, send_frame_done, &now);
+    view->frame_held = epd_output_client_waiting(epd_output, view);
+    if (!view->frame_held) {
+      view_for_each_surface(view, send_frame_done, &now);
+    }
   }
   drag_icons_for_each_surface(output->server, send_frame_done, &now);
 }
 
+static void
+handle_output_sent(
+  struct wl_listener *listener,
+  void *data
+)
+{
+  struct cg_output *output = wl_container_of(listener, output, sent);
+  struct epd_output *epd_output = data;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  struct cg_view *view;
+  wl_list_for_each_reverse(view, &output->server->views, link) {
+    if (view->frame_held && !epd_output_client_waiting(epd_output, view)) {
+      view->frame_held = false;
+      view_for_each_surface(view, send_frame_done, &now);
+    }
+  }
+}
+
 static void
 handle_output_transform(
   struct wl_listener *listener,
@@ -352,6 +436,73 @@ handle_output_mode(
   }
 }
 
+#ifdef EPD_WM_HAS_PRESENTATION
+struct present_data
+{
+  struct wlr_presentation *presentation;
+  struct wlr_presentation_event *event;
+};
+
+static void
+send_presented(
+  struct wlr_surface *surface,
+  int _unused,
+  int _not_used,
+  void *data
+)
+{
+  struct present_data *pdata = data;
+  wlr_presentation_send_surface_presented(pdata->presentation, surface,
+                                          pdata->event);
+}
+#endif
+
+static void
+handle_output_present(
+  struct wl_listener *listener,
+  void *data
+)
+{
+  /* Sent once the frame's waveforms have run, which is also the time
+     it carries */
+#ifdef EPD_WM_HAS_PRESENTATION
+  struct cg_output *output = wl_container_of(listener, output, present);
+  struct wlr_output_event_present *output_event = data;
+  struct wlr_presentation_event event;
+  wlr_presentation_event_from_output(&event, output_event);
+
+  struct present_data pdata = {
+    .presentation = output->server->presentation,
+    .event = &event,
+  };
+
+  struct cg_view *view;
+  wl_list_for_each_reverse(view, &output->server->views, link) {
+    view_for_each_surface(view, send_presented, &pdata);
+  }
+#endif
+}
+
+static void
+handle_output_idle(
+  struct wl_listener *listener,
+  void *data
+)
+{
+  struct cg_output *output = wl_container_of(listener, output, idle);
+  epd_output_set_idle(epd_output_from_output(output->wlr_output), true);
+}
+
+static void
+handle_output_resume(
+  struct wl_listener *listener,
+  void *data
+)
+{
+  struct cg_output *output = wl_container_of(listener, output, resume);
+  epd_output_set_idle(epd_output_from_output(output->wlr_output), false);
+}
+
 static void
 output_destroy(
   struct cg_output *output
@@ -359,6 +510,11 @@ output_destroy(
 {
   struct cg_server *server = output->server;
 
+  wl_list_remove(&output->present.link);
+  wl_list_remove(&output->sent.link);
+  wl_list_remove(&output->idle.link);
+  wl_list_remove(&output->resume.link);
+  wlr_idle_timeout_destroy(output->idle_timeout);
   wl_list_remove(&output->destroy.link);
   wl_list_remove(&output->mode.link);
   wl_list_remove(&output->transform.link);
@@ -420,6 +576,8 @@ handle_new_output(
   wl_signal_add(&wlr_output->events.transform, &server->output->transform);
   server->output->destroy.notify = handle_output_destroy;
   wl_signal_add(&wlr_output->events.destroy, &server->output->destroy);
+  server->output->present.notify = handle_output_present;
+  wl_signal_add(&wlr_output->events.present, &server->output->present);
   server->output->damage_frame.notify = handle_output_damage_frame;
   wl_signal_add(&server->output->damage->events.frame,
                 &server->output->damage_frame);
@@ -427,6 +585,21 @@ handle_new_output(
   wl_signal_add(&server->output->damage->events.destroy,
                 &server->output->damage_destroy);
 
+  struct epd_output *epd_output = epd_output_from_output(wlr_output);
+  server->output->sent.notify = handle_output_sent;
+  wl_signal_add(&epd_output->events.sent, &server->output->sent);
+
+  /* wlr_idle sees all seat activity, not just what reaches us */
+  server->output->idle_timeout =
+    wlr_idle_timeout_create(server->idle, server->seat->seat,
+                            epd_output->governor.idle_timeout);
+  server->output->idle.notify = handle_output_idle;
+  wl_signal_add(&server->output->idle_timeout->events.idle,
+                &server->output->idle);
+  server->output->resume.notify = handle_output_resume;
+  wl_signal_add(&server->output->idle_timeout->events.resume,
+                &server->output->resume);
+
   wlr_output_set_transform(wlr_output, server->output_transform);
 
   wlr_output_layout_add_auto(server->output_layout, wlr_output);
@@ -447,19 +620,74 @@ handle_new_output(
   wlr_output_damage_add_whole(server->output->damage);
 }
 
+/* Tell the EPD which window the damage came from, so it can work out
+   what each one costs. It follows damage to the inks, which are in
+   buffer coordinates. */
+static void
+damage_client(
+  struct cg_output *cg_output,
+  struct cg_view *view,
+  pixman_region32_t * damage
+)
+{
+  if (!pixman_region32_not_empty(damage)) {
+    return;
+  }
+
+  struct wlr_output *wlr_output = cg_output->wlr_output;
+  int output_width, output_height;
+  wlr_output_transformed_resolution(wlr_output, &output_width,
+                                    &output_height);
+
+  pixman_region32_t buffer_damage;
+  pixman_region32_init(&buffer_damage);
+  wlr_region_transform(&buffer_damage, damage,
+                       wlr_output_transform_invert(wlr_output->transform),
+                       output_width, output_height);
+
+  struct epd_output *epd_output = epd_output_from_output(wlr_output);
+  epd_output_client_damage(epd_output, view, view_get_app_id(view),
+                           view->impl->get_title(view), view_get_pid(view),
+                           &buffer_damage);
+  pixman_region32_fini(&buffer_damage);
+}
+
 void
 output_damage_view_surface(
   struct cg_output *cg_output,
   struct cg_view *view
 )
 {
+  pixman_region32_t view_damage;
+  pixman_region32_init(&view_damage);
+
   struct damage_data data = {
     .output = cg_output,
     .x = view->x,
     .y = view->y,
     .whole = false,
+    .view_damage = &view_damage,
   };
   view_for_each_surface(view, damage_surface, &data);
+  damage_client(cg_output, view, &view_damage);
+  pixman_region32_fini(&view_damage);
+
+  /* Let the EPD learn how often this client draws */
+  int width, height;
+  view->impl->get_geometry(view, &width, &height);
+
+  pixman_box32_t box = {
+    .x1 = view->x,
+    .y1 = view->y,
+    .x2 = view->x + width,
+    .y2 = view->y + height,
+  };
+  output_box_to_buffer(cg_output->wlr_output, &box);
+  struct epd_output *epd_output =
+    epd_output_from_output(cg_output->wlr_output);
+  epd_output_client_commit(epd_output,
+                           wl_resource_get_client(view->wlr_surface->resource),
+                           &box);
 }
 
 void
@@ -468,13 +696,30 @@ output_damage_view_whole(
   struct cg_view *view
 )
 {
+  pixman_region32_t view_damage;
+  pixman_region32_init(&view_damage);
+
   struct damage_data data = {
     .output = cg_output,
     .x = view->x,
     .y = view->y,
     .whole = true,
+    .view_damage = &view_damage,
   };
   view_for_each_surface(view, damage_surface, &data);
+  damage_client(cg_output, view, &view_damage);
+  pixman_region32_fini(&view_damage);
+}
+
+void
+output_forget_view(
+  struct cg_output *cg_output,
+  struct cg_view *view
+)
+{
+  struct epd_output *epd_output =
+    epd_output_from_output(cg_output->wlr_output);
+  epd_output_client_gone(epd_output, view);
 }
 
 void
@@ -1,8 +1,10 @@
 #ifndef CG_OUTPUT_H
 #define CG_OUTPUT_H
 
+#include <pixman.h>
 #include <wayland-server.h>
 #include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_idle.h>
 #include <wlr/types/wlr_output_damage.h>
 
 #include "wm/seat.h"
@@ -20,6 +22,13 @@ struct cg_output
   struct wl_listener destroy;
   struct wl_listener damage_frame;
   struct wl_listener damage_destroy;
+  struct wl_listener present;
+  struct wl_listener sent;      // epd_output events.sent
+
+  // Tells the refresh governor when the user goes idle and comes back
+  struct wlr_idle_timeout *idle_timeout;
+  struct wl_listener idle;
+  struct wl_listener resume;
 };
 
 void handle_new_output(
@@ -34,10 +43,19 @@ void output_damage_view_whole(
   struct cg_output *cg_output,
   struct cg_view *view
 );
+void output_forget_view(
+  struct cg_output *output,
+  struct cg_view *view
+);
 void output_damage_drag_icon(
   struct cg_output *output,
   struct cg_drag_icon *icon
 );
+// Turn a box in layout coordinates into one in the output's buffer
+void output_box_to_buffer(
+  struct wlr_output *output,
+  pixman_box32_t * box
+);
 void output_set_window_title(
   struct cg_output *output,
   const char *title
@@ -20,15 +20,22 @@
 #include <wlr/types/wlr_primary_selection.h>
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_surface.h>
+#include <wlr/types/wlr_virtual_keyboard_v1.h>
+#ifdef EPD_WM_HAS_VIRTUAL_POINTER
+#include <wlr/types/wlr_virtual_pointer_v1.h>
+#endif
 #include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/util/log.h>
 #include <wlr/xwayland.h>
 
 #include "epd/epd_output.h"
+#include "utils/probes.h"
+#include "utils/trace.h"
 
 #include "wm/output.h"
 #include "wm/seat.h"
 #include "wm/server.h"
+#include "wm/text_input_v3.h"
 #include "wm/view.h"
 #include "wm/xwayland.h"
 
@@ -93,6 +100,33 @@ desktop_view_at(
   return NULL;
 }
 
+static void
+wet_ink_point(
+  struct cg_seat *seat,
+  double lx,
+  double ly,
+  bool down
+)
+{
+  /* The stroke is drawn straight into the buffer, which is rotated
+     when the output is */
+  struct wlr_output *wlr_output = seat->server->output->wlr_output;
+  pixman_box32_t point = {
+    .x1 = lx,
+    .y1 = ly,
+    .x2 = lx + 1,
+    .y2 = ly + 1,
+  };
+  output_box_to_buffer(wlr_output, &point);
+
+  struct epd_output *epd_output = epd_output_from_output(wlr_output);
+  if (down) {
+    epd_wet_ink_down(&epd_output->wet_ink, point.x1, point.y1);
+  } else {
+    epd_wet_ink_motion(&epd_output->wet_ink, point.x1, point.y1);
+  }
+}
+
 static void
 press_cursor_button(
   struct cg_seat *seat,
@@ -107,6 +141,19 @@ press_cursor_button(
   struct cg_server *server = seat->server;
 
   if (state == WLR_BUTTON_PRESSED) {
+    /* Whatever changes around here next is what the user is waiting
+       on */
+    pixman_box32_t hint = {
+      .x1 = lx,
+      .y1 = ly,
+      .x2 = lx + 1,
+      .y2 = ly + 1,
+    };
+    output_box_to_buffer(server->output->wlr_output, &hint);
+    struct epd_output *epd_output =
+      epd_output_from_output(server->output->wlr_output);
+    epd_output_notify_input(epd_output, &hint);
+
     double sx, sy;
     struct wlr_surface *surface;
     struct cg_view *view = desktop_view_at(server, lx, ly,
@@ -123,9 +170,6 @@ press_cursor_button(
     }
 
     /* Schedule a redraw in 5 ms */
-    struct cg_output *output = server->output;
-    struct epd_output *epd_output =
-      epd_output_from_output(output->wlr_output);
     wl_event_source_timer_update(epd_output->frame_timer, 5);
   }
 }
@@ -157,6 +201,18 @@ update_capabilities(
   }
 }
 
+/* Note an input, to time how long until the panel shows what it did */
+static void
+stamp_input(
+  struct cg_seat *seat,
+  enum epd_input kind
+)
+{
+  struct epd_output *epd_output =
+    epd_output_from_output(seat->server->output->wlr_output);
+  epd_stats_input(&epd_output->stats, kind);
+}
+
 static void
 handle_touch_destroy(
   struct wl_listener *listener,
@@ -284,6 +340,13 @@ handle_keyboard_key(
   struct cg_seat *seat = keyboard->seat;
   struct wlr_event_keyboard_key *event = data;
 
+  trace_input("key", "\"keycode\": %u, \"pressed\": %s", event->keycode,
+              event->state == WLR_KEY_PRESSED ? "true" : "false");
+  PROBE2(key, event->keycode, event->state);
+  if (event->state == WLR_KEY_PRESSED) {
+    stamp_input(seat, EPD_INPUT_KEY);
+  }
+
   /* Translate from libinput keycode to an xkbcommon keycode. */
   xkb_keycode_t keycode = event->keycode + 8;
 
@@ -313,6 +376,7 @@ handle_keyboard_key(
   /* Fast-forward the next scheduled redraw to 5 ms time */
   struct cg_output *output = seat->server->output;
   struct epd_output *epd_output = epd_output_from_output(output->wlr_output);
+  epd_output_notify_input(epd_output, NULL);
   wl_event_source_timer_update(epd_output->frame_timer, 5);
 
   wlr_idle_notify_activity(seat->server->idle, seat->seat);
@@ -420,6 +484,38 @@ handle_new_input(
   update_capabilities(seat);
 }
 
+void
+handle_virtual_keyboard_v1_new(
+  struct wl_listener *listener,
+  void *data
+)
+{
+  struct cg_server *server =
+    wl_container_of(listener, server, new_virtual_keyboard_v1);
+  struct wlr_virtual_keyboard_v1 *keyboard = data;
+
+  /* The client sends its own keymap before any keys, replacing the
+     default one this gives it */
+  handle_new_keyboard(server->seat, &keyboard->input_device);
+  update_capabilities(server->seat);
+}
+
+#ifdef EPD_WM_HAS_VIRTUAL_POINTER
+void
+handle_virtual_pointer_v1_new(
+  struct wl_listener *listener,
+  void *data
+)
+{
+  struct cg_server *server =
+    wl_container_of(listener, server, new_virtual_pointer_v1);
+  struct wlr_virtual_pointer_v1_new_pointer_event *event = data;
+
+  handle_new_pointer(server->seat, &event->new_pointer->input_device);
+  update_capabilities(server->seat);
+}
+#endif
+
 static void
 handle_request_set_primary_selection(
   struct wl_listener *listener,
@@ -480,9 +576,13 @@ handle_touch_down(
   struct cg_seat *seat = wl_container_of(listener, seat, touch_down);
   struct wlr_event_touch_down *event = data;
 
+  trace_input("touch", NULL);
+
   double lx, ly;
   wlr_cursor_absolute_to_layout_coords(seat->cursor, event->device,
                                        event->x, event->y, &lx, &ly);
+  PROBE3(touch_down, event->touch_id, (int) lx, (int) ly);
+  stamp_input(seat, EPD_INPUT_POINTER);
 
   double sx, sy;
   struct wlr_surface *surface;
@@ -502,6 +602,7 @@ handle_touch_down(
     seat->touch_y = ly;
     press_cursor_button(seat, event->device, event->time_msec,
                         BTN_LEFT, WLR_BUTTON_PRESSED, lx, ly);
+    wet_ink_point(seat, lx, ly, true);
   }
 
   wlr_idle_notify_activity(seat->server->idle, seat->seat);
@@ -526,6 +627,12 @@ handle_touch_up(
                         seat->touch_x, seat->touch_y);
   }
 
+  if (event->touch_id == seat->touch_id) {
+    struct epd_output *epd_output =
+      epd_output_from_output(seat->server->output->wlr_output);
+    epd_wet_ink_up(&epd_output->wet_ink);
+  }
+
   wlr_seat_touch_notify_up(seat->seat, event->time_msec, event->touch_id);
   wlr_idle_notify_activity(seat->server->idle, seat->seat);
 }
@@ -565,6 +672,7 @@ handle_touch_motion(
   if (event->touch_id == seat->touch_id) {
     seat->touch_x = lx;
     seat->touch_y = ly;
+    wet_ink_point(seat, lx, ly, false);
   }
 
   wlr_idle_notify_activity(seat->server->idle, seat->seat);
@@ -591,6 +699,10 @@ handle_cursor_axis(
   struct cg_seat *seat = wl_container_of(listener, seat, cursor_axis);
   struct wlr_event_pointer_axis *event = data;
 
+  trace_input("axis", NULL);
+  PROBE2(axis, event->orientation, event->delta_discrete);
+  stamp_input(seat, EPD_INPUT_POINTER);
+
   wlr_seat_pointer_notify_axis(seat->seat,
                                event->time_msec, event->orientation,
                                event->delta, event->delta_discrete,
@@ -607,6 +719,13 @@ handle_cursor_button(
   struct cg_seat *seat = wl_container_of(listener, seat, cursor_button);
   struct wlr_event_pointer_button *event = data;
 
+  trace_input("button", "\"button\": %u, \"pressed\": %s", event->button,
+              event->state == WLR_BUTTON_PRESSED ? "true" : "false");
+  PROBE2(button, event->button, event->state);
+  if (event->state == WLR_BUTTON_PRESSED) {
+    stamp_input(seat, EPD_INPUT_POINTER);
+  }
+
   wlr_seat_pointer_notify_button(seat->seat, event->time_msec,
                                  event->button, event->state);
   press_cursor_button(seat, event->device, event->time_msec,
@@ -625,6 +744,9 @@ process_cursor_motion(
   struct wlr_seat *wlr_seat = seat->seat;
   struct wlr_surface *surface = NULL;
 
+  trace_instant(TRACE_INPUT, "motion", NULL);
+  PROBE2(motion, (int) seat->cursor->x, (int) seat->cursor->y);
+
   struct cg_view *view = desktop_view_at(seat->server,
                                          seat->cursor->x, seat->cursor->y,
                                          &surface, &sx, &sy);
@@ -989,6 +1111,7 @@ seat_set_focus(
     wlr_seat_keyboard_notify_enter(wlr_seat, view->wlr_surface,
                                    NULL, 0, NULL);
   }
+  text_input_v3_set_focus(server, view->wlr_surface);
 
   process_cursor_motion(seat, -1);
 }
@@ -102,5 +102,15 @@ void seat_set_focus(
   struct cg_seat *seat,
   struct cg_view *view
 );
+void handle_virtual_keyboard_v1_new(
+  struct wl_listener *listener,
+  void *data
+);
+#ifdef EPD_WM_HAS_VIRTUAL_POINTER
+void handle_virtual_pointer_v1_new(
+  struct wl_listener *listener,
+  void *data
+);
+#endif
 
 #endif
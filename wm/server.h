@@ -8,6 +8,10 @@
 #include <wlr/types/wlr_idle.h>
 #include <wlr/types/wlr_idle_inhibit_v1.h>
 #include <wlr/types/wlr_output_layout.h>
+#ifdef EPD_WM_HAS_PRESENTATION
+#include <wlr/types/wlr_presentation_time.h>
+#endif
+#include <wlr/types/wlr_text_input_v3.h>
 #include <wlr/types/wlr_xdg_decoration_v1.h>
 #include <wlr/xwayland.h>
 
@@ -27,6 +31,19 @@ struct cg_server
   struct wl_listener new_idle_inhibitor_v1;
   struct wl_list inhibitors;
 
+  struct wlr_text_input_manager_v3 *text_input_v3;
+  struct wl_listener new_text_input_v3;
+  struct wl_list text_inputs;
+
+  struct wl_listener new_virtual_keyboard_v1;
+#ifdef EPD_WM_HAS_VIRTUAL_POINTER
+  struct wl_listener new_virtual_pointer_v1;
+#endif
+
+#ifdef EPD_WM_HAS_PRESENTATION
+  struct wlr_presentation *presentation;
+#endif
+
   struct wlr_output_layout *output_layout;
   struct cg_output *output;
   struct wl_listener new_output;
@@ -36,6 +53,7 @@ struct cg_server
   struct wl_listener new_xwayland_surface;
 
   bool xdg_decoration;
+  bool headless;
   enum wl_output_transform output_transform;
 #ifdef DEBUG
   bool debug_damage_tracking;
@@ -0,0 +1,215 @@
+/*
+ * epd-wm: a Wayland window manager for IT8951 E-Paper displays
+ *
+ * Copyright (C) 2020 Daniel Jones
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#include <stdlib.h>
+#include <wayland-server.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/types/wlr_text_input_v3.h>
+#include <wlr/util/log.h>
+
+#include "epd/epd_output.h"
+#include "wm/output.h"
+#include "wm/seat.h"
+#include "wm/server.h"
+#include "wm/text_input_v3.h"
+#include "wm/view.h"
+
+/* We don't run an input method, so text-input-v3 is only here to find
+   out where the focused client's text cursor is. Typing then gets a
+   small, fast update around it ahead of everything else. */
+
+struct cg_text_input_v3
+{
+  struct cg_server *server;
+  struct wlr_text_input_v3 *wlr_text_input;
+
+  struct wl_list link;          // server::text_inputs
+  struct wl_listener enable;
+  struct wl_listener commit;
+  struct wl_listener disable;
+  struct wl_listener destroy;
+};
+
+static void
+set_text_cursor(
+  struct cg_server *server,
+  pixman_box32_t * cursor
+)
+{
+  if (!server->output) {
+    return;
+  }
+
+  if (cursor != NULL) {
+    output_box_to_buffer(server->output->wlr_output, cursor);
+  }
+
+  struct epd_output *epd_output =
+    epd_output_from_output(server->output->wlr_output);
+  epd_output_set_text_cursor(epd_output, cursor);
+}
+
+static void
+update_text_cursor(
+  struct cg_text_input_v3 *text_input
+)
+{
+  struct wlr_text_input_v3 *wlr_text_input = text_input->wlr_text_input;
+  struct cg_view *view = seat_get_focus(text_input->server->seat);
+
+  /* The rectangle is relative to the surface, and we only know where
+     the focused view's main surface is. Clients that never set one
+     leave it all zero. */
+  if (!wlr_text_input->current_enabled || !view
+      || view->wlr_surface != wlr_text_input->focused_surface
+      || wlr_text_input->current.cursor_rectangle.height <= 0) {
+    set_text_cursor(text_input->server, NULL);
+    return;
+  }
+
+  pixman_box32_t cursor = {
+    .x1 = view->x + wlr_text_input->current.cursor_rectangle.x,
+    .y1 = view->y + wlr_text_input->current.cursor_rectangle.y,
+  };
+  cursor.x2 = cursor.x1 + wlr_text_input->current.cursor_rectangle.width + 1;
+  cursor.y2 = cursor.y1 + wlr_text_input->current.cursor_rectangle.height;
+
+  set_text_cursor(text_input->server, &cursor);
+}
+
+static void
+handle_enable(
+  struct wl_listener *listener,
+  void *data
+)
+{
+  struct cg_text_input_v3 *text_input =
+    wl_container_of(listener, text_input, enable);
+  update_text_cursor(text_input);
+}
+
+static void
+handle_commit(
+  struct wl_listener *listener,
+  void *data
+)
+{
+  struct cg_text_input_v3 *text_input =
+    wl_container_of(listener, text_input, commit);
+  update_text_cursor(text_input);
+}
+
+static void
+handle_disable(
+  struct wl_listener *listener,
+  void *data
+)
+{
+  struct cg_text_input_v3 *text_input =
+    wl_container_of(listener, text_input, disable);
+  set_text_cursor(text_input->server, NULL);
+}
+
+static void
+handle_destroy(
+  struct wl_listener *listener,
+  void *data
+)
+{
+  struct cg_text_input_v3 *text_input =
+    wl_container_of(listener, text_input, destroy);
+
+  if (text_input->wlr_text_input->current_enabled) {
+    set_text_cursor(text_input->server, NULL);
+  }
+
+  wl_list_remove(&text_input->link);
+  wl_list_remove(&text_input->enable.link);
+  wl_list_remove(&text_input->commit.link);
+  wl_list_remove(&text_input->disable.link);
+  wl_list_remove(&text_input->destroy.link);
+  free(text_input);
+}
+
+static void
+send_focus(
+  struct cg_text_input_v3 *text_input,
+  struct wlr_surface *surface
+)
+{
+  /* A text input only hears about surfaces from its own client */
+  struct wlr_text_input_v3 *wlr_text_input = text_input->wlr_text_input;
+
+  if (wlr_text_input->focused_surface == surface) {
+    return;
+  }
+
+  if (wlr_text_input->focused_surface) {
+    wlr_text_input_v3_send_leave(wlr_text_input);
+  }
+
+  if (surface && wl_resource_get_client(wlr_text_input->resource)
+      == wl_resource_get_client(surface->resource)) {
+    wlr_text_input_v3_send_enter(wlr_text_input, surface);
+  }
+}
+
+void
+text_input_v3_set_focus(
+  struct cg_server *server,
+  struct wlr_surface *surface
+)
+{
+  struct cg_text_input_v3 *text_input;
+  wl_list_for_each(text_input, &server->text_inputs, link) {
+    send_focus(text_input, surface);
+  }
+
+  set_text_cursor(server, NULL);
+}
+
+void
+handle_text_input_v3_new(
+  struct wl_listener *listener,
+  void *data
+)
+{
+  struct cg_server *server =
+    wl_container_of(listener, server, new_text_input_v3);
+  struct wlr_text_input_v3 *wlr_text_input = data;
+
+  if (wlr_text_input->seat != server->seat->seat) {
+    return;
+  }
+
+  struct cg_text_input_v3 *text_input =
+    calloc(1, sizeof(struct cg_text_input_v3));
+  if (!text_input) {
+    wlr_log(WLR_ERROR, "Failed to allocate text input");
+    return;
+  }
+
+  text_input->server = server;
+  text_input->wlr_text_input = wlr_text_input;
+  wl_list_insert(&server->text_inputs, &text_input->link);
+
+  text_input->enable.notify = handle_enable;
+  wl_signal_add(&wlr_text_input->events.enable, &text_input->enable);
+  text_input->commit.notify = handle_commit;
+  wl_signal_add(&wlr_text_input->events.commit, &text_input->commit);
+  text_input->disable.notify = handle_disable;
+  wl_signal_add(&wlr_text_input->events.disable, &text_input->disable);
+  text_input->destroy.notify = handle_destroy;
+  wl_signal_add(&wlr_text_input->events.destroy, &text_input->destroy);
+
+  struct cg_view *view = seat_get_focus(server->seat);
+  if (view) {
+    send_focus(text_input, view->wlr_surface);
+  }
+}
@@ -0,0 +1,14 @@
+#ifndef CG_TEXT_INPUT_V3_H
+#define CG_TEXT_INPUT_V3_H
+
+#include <wayland-server.h>
+#include <wlr/types/wlr_surface.h>
+
+struct cg_server;
+
+void handle_text_input_v3_new(struct wl_listener *listener, void *data);
+
+void text_input_v3_set_focus(struct cg_server *server,
+                             struct wlr_surface *surface);
+
+#endif
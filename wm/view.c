@@ -153,6 +153,22 @@ view_get_title(
   return strndup(title, strlen(title));
 }
 
+const char *
+view_get_app_id(
+  struct cg_view *view
+)
+{
+  return view->impl->get_app_id(view);
+}
+
+pid_t
+view_get_pid(
+  struct cg_view *view
+)
+{
+  return view->impl->get_pid(view);
+}
+
 bool
 view_is_primary(
   struct cg_view *view
@@ -307,6 +323,7 @@ view_destroy(
   if (view->wlr_surface != NULL) {
     view_unmap(view);
   }
+  output_forget_view(server->output, view);
 
   view->impl->destroy(view);
 
@@ -25,6 +25,7 @@ struct cg_view
   struct wl_list children;      // cg_view_child::link
   struct wlr_surface *wlr_surface;
   int x, y;
+  bool frame_held;              // until the EPD has sent what it drew
 
   enum cg_view_type type;
   const struct cg_view_impl *impl;
@@ -39,6 +40,16 @@ struct cg_view_impl
   ) (
   struct cg_view * view
   );
+  char *(
+  *get_app_id
+  ) (
+  struct cg_view * view
+  );
+  pid_t (
+  *get_pid
+  ) (
+  struct cg_view * view
+  );
   void (
   *get_geometry
   ) (
@@ -120,6 +131,12 @@ struct cg_subsurface
 char *view_get_title(
   struct cg_view *view
 );
+const char *view_get_app_id(
+  struct cg_view *view
+);
+pid_t view_get_pid(
+  struct cg_view *view
+);
 bool view_is_primary(
   struct cg_view *view
 );
@@ -14,6 +14,7 @@
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/util/log.h>
 
+#include "utils/trace.h"
 #include "wm/server.h"
 #include "wm/view.h"
 #include "wm/xdg_shell.h"
@@ -193,6 +194,28 @@ get_title(
   return xdg_shell_view->xdg_surface->toplevel->title;
 }
 
+static char *
+get_app_id(
+  struct cg_view *view
+)
+{
+  struct cg_xdg_shell_view *xdg_shell_view = xdg_shell_view_from_view(view);
+  return xdg_shell_view->xdg_surface->toplevel->app_id;
+}
+
+static pid_t
+get_pid(
+  struct cg_view *view
+)
+{
+  struct cg_xdg_shell_view *xdg_shell_view = xdg_shell_view_from_view(view);
+  pid_t pid = 0;
+  wl_client_get_credentials(wl_resource_get_client
+                            (xdg_shell_view->xdg_surface->resource), &pid,
+                            NULL, NULL);
+  return pid;
+}
+
 static void
 get_geometry(
   struct cg_view *view,
@@ -322,6 +345,7 @@ handle_xdg_shell_surface_commit(
   struct cg_xdg_shell_view *xdg_shell_view =
     wl_container_of(listener, xdg_shell_view, commit);
   struct cg_view *view = &xdg_shell_view->view;
+  trace_instant(TRACE_COMPOSITOR, "surface_commit", NULL);
   view_damage_surface(view);
 }
 
@@ -383,6 +407,8 @@ handle_xdg_shell_surface_destroy(
 
 static const struct cg_view_impl xdg_shell_view_impl = {
   .get_title = get_title,
+  .get_app_id = get_app_id,
+  .get_pid = get_pid,
   .get_geometry = get_geometry,
   .is_primary = is_primary,
   .is_transient_for = is_transient_for,
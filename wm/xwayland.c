@@ -14,6 +14,7 @@
 #include <wlr/xwayland.h>
 #include <wlr/util/log.h>
 
+#include "utils/trace.h"
 #include "wm/server.h"
 #include "wm/view.h"
 #include "wm/xwayland.h"
@@ -46,6 +47,25 @@ get_title(
   return xwayland_view->xwayland_surface->title;
 }
 
+static char *
+get_app_id(
+  struct cg_view *view
+)
+{
+  struct cg_xwayland_view *xwayland_view = xwayland_view_from_view(view);
+  return xwayland_view->xwayland_surface->class;
+}
+
+static pid_t
+get_pid(
+  struct cg_view *view
+)
+{
+  /* Not Xwayland's own, which all X clients share */
+  struct cg_xwayland_view *xwayland_view = xwayland_view_from_view(view);
+  return xwayland_view->xwayland_surface->pid;
+}
+
 static void
 get_geometry(
   struct cg_view *view,
@@ -169,6 +189,7 @@ handle_xwayland_surface_commit(
   struct cg_xwayland_view *xwayland_view =
     wl_container_of(listener, xwayland_view, commit);
   struct cg_view *view = &xwayland_view->view;
+  trace_instant(TRACE_COMPOSITOR, "surface_commit", NULL);
   view_damage_surface(view);
 }
 
@@ -235,6 +256,8 @@ handle_xwayland_surface_destroy(
 
 static const struct cg_view_impl xwayland_view_impl = {
   .get_title = get_title,
+  .get_app_id = get_app_id,
+  .get_pid = get_pid,
   .get_geometry = get_geometry,
   .is_primary = is_primary,
   .is_transient_for = is_transient_for,